@@ -0,0 +1,52 @@
+/////
+// bench.cpp
+//! @file Benchmark runner
+/////
+
+#include "bench.h"
+
+#include <iomanip>
+#include <iostream>
+
+namespace
+{
+  const void* volatile g_sink = nullptr;
+}
+
+namespace bench
+{
+  std::vector<Benchmark>& Registry()
+  {
+    static std::vector<Benchmark> registry;
+    return registry;
+  }
+
+  void Report(const std::string& name, double value, const char* unit)
+  {
+    std::cout << "  " << std::left << std::setw(40) << name <<
+      std::right << std::setw(14) << std::fixed << std::setprecision(2) <<
+      value << " " << unit << std::endl;
+  }
+
+  void DoNotOptimize(const void* value)
+  {
+    g_sink = value;
+  }
+} // namespace bench
+
+int main(int argc, char** argv)
+{
+  // Optional argument only runs the benchmarks containing it in their name
+  std::string filter = (argc > 1) ? argv[1] : "";
+
+  for (const auto& benchmark : bench::Registry())
+  {
+    if (benchmark.name.find(filter) == std::string::npos)
+      continue;
+
+    std::cout << benchmark.name << std::endl;
+    benchmark.run();
+  }
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+/////
+// bench.h
+//! @file Benchmark harness
+/////
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+
+namespace bench
+{
+
+//! A benchmark that can be run by name
+struct Benchmark
+{
+  std::string name;
+  std::function<void()> run;
+};
+
+//! Gets every registered benchmark.
+std::vector<Benchmark>& Registry();
+
+//! Registers a benchmark when constructed; see @ref BENCHMARK.
+struct Registrar
+{
+  Registrar(const char* name, std::function<void()> run)
+  {
+    Registry().push_back({ name, std::move(run) });
+  }
+};
+
+//! Prints a single result of a benchmark.
+//! @param[in] name The name of the measurement.
+//! @param[in] value The measured value.
+//! @param[in] unit The unit of the measured value.
+void Report(const std::string& name, double value, const char* unit);
+
+//! Keeps the compiler from optimizing away a value.
+void DoNotOptimize(const void* value);
+
+//! Runs a function repeatedly.
+//! @param[in] iterations The number of times to run the function.
+//! @param[in] func The function to measure; given the iteration number.
+//! @returns The average number of nanoseconds per run.
+template<typename F> double NanosecondsPer(size_t iterations, F&& func)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < iterations; ++i)
+  {
+    func(i);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) /
+    static_cast<double>(iterations);
+}
+
+} // namespace bench
+
+//! Defines a benchmark that is run by lifx-bench.
+#define BENCHMARK(name) \
+  static void name(); \
+  static bench::Registrar name##Registrar(#name, name); \
+  static void name()
@@ -0,0 +1,140 @@
+/////
+// devices.cpp
+//! @file Device registry scan & lookup benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/devices.h>
+#include <lib-lifx/lifx.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include <string.h>
+
+namespace
+{
+  constexpr size_t DEVICES = 100000;
+  constexpr size_t SCANS = 100;
+  constexpr size_t LOOKUPS = 1000000;
+
+  //! How the CLI keeps its bulbs: three strings and a few fields, by value
+  //! in a map
+  struct MapBulb
+  {
+    std::string label;
+    std::array<uint8_t, 8> mac_address;
+    bool power;
+    lifx::HSBK color;
+    struct { std::string label; uint64_t updated_at; } group;
+    struct { uint32_t vendor, product, version; } version;
+    struct { std::string label; uint64_t updated_at; } location;
+  };
+
+  std::array<uint8_t, 8> MakeTarget(size_t i)
+  {
+    return { { 0xD0, 0x73, 0xD5, static_cast<uint8_t>(i >> 16),
+      static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) } };
+  }
+
+  void Report(const char* name, double nanoseconds, size_t devices)
+  {
+    bench::Report(name, nanoseconds / 1000.0, "us/scan");
+    bench::Report(std::string(name) + " per device",
+      nanoseconds / static_cast<double>(devices), "ns");
+  }
+}
+
+BENCHMARK(Registry)
+{
+  std::mt19937 random(1);
+  lifx::DeviceRegistry registry(DEVICES);
+  std::unordered_map<uint64_t, MapBulb> bulbs;
+  std::vector<std::array<uint8_t, 8>> targets;
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    targets.push_back(MakeTarget(i));
+    lifx::message::light::State state = { };
+    state.color = { static_cast<uint16_t>(random()), 65535,
+      static_cast<uint16_t>(random()), 3500 };
+    state.power = (random() & 1) != 0 ? 65535 : 0;
+    snprintf(state.label, sizeof(state.label), "Bulb %zu", i);
+    registry.Update(registry.Add(targets.back().data()), state);
+
+    auto& bulb = bulbs[lifx::TargetKey(targets.back().data())];
+    bulb.label = state.label;
+    bulb.mac_address = targets.back();
+    bulb.power = state.power != 0;
+    bulb.color = state.color;
+    bulb.group.label = "Living room";
+    bulb.location.label = "Home";
+  }
+
+  // How many lights are on and how bright they are, across the fleet
+  uint64_t result = 0;
+  Report("map scan by copy", bench::NanosecondsPer(SCANS, [&](size_t)
+  {
+    uint64_t brightness = 0;
+    for (auto iter : bulbs)
+    {
+      brightness += iter.second.power ? iter.second.color.brightness : 0;
+    }
+    result += brightness;
+  }), DEVICES);
+  Report("map scan", bench::NanosecondsPer(SCANS, [&](size_t)
+  {
+    uint64_t brightness = 0;
+    for (const auto& iter : bulbs)
+    {
+      brightness += iter.second.power ? iter.second.color.brightness : 0;
+    }
+    result += brightness;
+  }), DEVICES);
+  Report("registry scan", bench::NanosecondsPer(SCANS, [&](size_t)
+  {
+    uint64_t brightness = 0;
+    const auto* powers = registry.Powers();
+    const auto* colors = registry.Colors();
+    for (size_t i = 0; i < registry.Size(); ++i)
+    {
+      brightness += powers[i] != 0 ? colors[i].brightness : 0;
+    }
+    result += brightness;
+  }), DEVICES);
+
+  // Labels that start with a prefix, the common filter
+  Report("map label scan", bench::NanosecondsPer(SCANS, [&](size_t)
+  {
+    size_t matches = 0;
+    for (const auto& iter : bulbs)
+    {
+      matches += iter.second.label.compare(0, 6, "Bulb 9") == 0 ? 1 : 0;
+    }
+    result += matches;
+  }), DEVICES);
+  Report("registry label scan", bench::NanosecondsPer(SCANS, [&](size_t)
+  {
+    size_t matches = 0;
+    const auto* labels = registry.Labels();
+    for (size_t i = 0; i < registry.Size(); ++i)
+    {
+      matches += memcmp(labels[i].data(), "Bulb 9", 6) == 0 ? 1 : 0;
+    }
+    result += matches;
+  }), DEVICES);
+
+  double map = bench::NanosecondsPer(LOOKUPS, [&](size_t i)
+  {
+    result += bulbs.find(lifx::TargetKey(targets[(i * 7919) % DEVICES].data()))->
+      second.color.hue;
+  });
+  double lookup = bench::NanosecondsPer(LOOKUPS, [&](size_t i)
+  {
+    result += registry.Color(registry.Find(targets[(i * 7919) % DEVICES].data())).hue;
+  });
+  bench::Report("map lookup", map, "ns");
+  bench::Report("registry lookup", lookup, "ns");
+  bench::DoNotOptimize(&result);
+}
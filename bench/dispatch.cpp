@@ -0,0 +1,111 @@
+/////
+// dispatch.cpp
+//! @file Received message dispatch benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/codec.h>
+#include <lib-lifx/lifx.h>
+
+#include <array>
+#include <functional>
+#include <unordered_map>
+
+namespace
+{
+  constexpr size_t ITERATIONS = 10000000;
+
+  //! Exposes the client's receive path without a socket read
+  class DispatchClient : public lifx::LifxClient
+  {
+    public:
+      using LifxClient::ProcessDatagram;
+      using LifxClient::RunCallback;
+  };
+
+  void Report(const char* name, double nanoseconds)
+  {
+    bench::Report(name, nanoseconds, "ns/callback");
+    bench::Report(std::string(name) + " rate", 1000.0 / nanoseconds,
+      "M callbacks/s");
+  }
+}
+
+BENCHMARK(Dispatch)
+{
+  uint64_t total = 0;
+  lifx::Header header = lifx::MakeHeader<lifx::message::light::StatePower>(
+    nullptr, 0, 1);
+  lifx::message::light::StatePower msg = { 1 };
+
+  // How callbacks were held before: a std::function taking the header by
+  // value, wrapped in another that casts the payload
+  std::function<void(const lifx::Header, const lifx::message::light::StatePower&)>
+    user = [&total](const lifx::Header h, const lifx::message::light::StatePower& m)
+    { total += m.level + h.sequence; };
+  std::function<void(const lifx::Header, const void*)> nested =
+    [user](const lifx::Header h, const void* data)
+  {
+    if (h.type == lifx::message::light::StatePower::type)
+    {
+      user(h, *static_cast<const lifx::message::light::StatePower*>(data));
+    }
+  };
+  auto before = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    header.sequence = static_cast<uint8_t>(i);
+    nested(header, &msg);
+  });
+  Report("nested std::function", before);
+
+  lifx::Delegate<void(const lifx::Header&, const void*)> delegate =
+    [&total](const lifx::Header& h, const void* data)
+  {
+    total += static_cast<const lifx::message::light::StatePower*>(data)->level +
+      h.sequence;
+  };
+  auto after = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    header.sequence = static_cast<uint8_t>(i);
+    delegate(header, &msg);
+  });
+  Report("delegate", after);
+
+  // The lookup the client did before subscribers existed
+  std::unordered_map<uint16_t, decltype(nested)> callbacks;
+  callbacks[lifx::message::light::StatePower::type] = nested;
+  auto lookup = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    header.sequence = static_cast<uint8_t>(i);
+    auto callback = callbacks.find(lifx::message::light::StatePower::type);
+    if (callback != callbacks.end())
+    {
+      callback->second(header, &msg);
+    }
+  });
+  Report("std::function map", lookup);
+
+  DispatchClient client;
+  client.Subscribe<lifx::message::light::StatePower>(
+    [&total](const lifx::Header& h, const lifx::message::light::StatePower& m)
+    { total += m.level + h.sequence; });
+  auto subscribers = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    header.sequence = static_cast<uint8_t>(i);
+    client.RunCallback(header, msg);
+  });
+  Report("client subscribers", subscribers);
+
+  // Everything a received datagram goes through apart from the socket
+  std::array<char, lifx::MAX_LIFX_PACKET_SIZE> packet {};
+  auto length = lifx::EncodeInto(packet.data(), packet.size(), msg);
+  auto datagram = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    packet[lifx::HEADER_SEQUENCE_OFFSET] = static_cast<char>(i);
+    client.ProcessDatagram(packet.data(), length);
+  });
+  Report("validate + dispatch", datagram);
+
+  bench::DoNotOptimize(&total);
+}
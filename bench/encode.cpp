@@ -0,0 +1,51 @@
+/////
+// encode.cpp
+//! @file Header encoding benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/lifx.h>
+
+#include <array>
+
+namespace
+{
+  constexpr size_t ITERATIONS = 10000000;
+  constexpr size_t TARGETS = 64;
+
+  std::array<std::array<uint8_t, 8>, TARGETS> MakeTargets()
+  {
+    std::array<std::array<uint8_t, 8>, TARGETS> targets {};
+    for (size_t i = 0; i < TARGETS; ++i)
+    {
+      targets[i] = { { 0xD0, 0x73, 0xD5, 0x00, 0x00, static_cast<uint8_t>(i), 0, 0 } };
+    }
+    return targets;
+  }
+}
+
+BENCHMARK(EncodeHeader)
+{
+  auto targets = MakeTargets();
+  std::array<char, lifx::LIFX_HEADER_SIZE> buffer {};
+
+  // What Send did for every message before headers were cached
+  auto full = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    auto header = lifx::MakeHeader<lifx::message::light::SetColor>(
+      targets[i % TARGETS].data(), 1234, static_cast<uint8_t>(i), 0);
+    lifx::wire::EncodeHeader(header, buffer.data());
+    bench::DoNotOptimize(buffer.data());
+  });
+  bench::Report("build + EncodeHeader", full, "ns/packet");
+
+  lifx::HeaderCache cache;
+  auto cached = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    cache.Encode<lifx::message::light::SetColor>(buffer.data(),
+      targets[i % TARGETS].data(), 1234, static_cast<uint8_t>(i));
+    bench::DoNotOptimize(buffer.data());
+  });
+  bench::Report("HeaderCache", cached, "ns/packet");
+}
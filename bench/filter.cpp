@@ -0,0 +1,120 @@
+/////
+// filter.cpp
+//! @file Device selection benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/filter.h>
+#include <lib-lifx/lifx.h>
+
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include <stdio.h>
+
+namespace
+{
+  constexpr size_t DEVICES = 5000;
+  constexpr size_t GROUPS = 50;
+  constexpr size_t REGEX_SELECTS = 20;
+  constexpr size_t SELECTS = 2000;
+
+  //! What the CLI matched its filter against before
+  struct Bulb
+  {
+    std::string label;
+    std::array<uint8_t, 8> mac_address;
+    std::string group;
+    std::string location;
+  };
+
+  //! The MAC formatting the CLI used, including its raw bytes
+  std::string StreamMac(const uint8_t address[8])
+  {
+    std::stringstream ss;
+    ss << address[0] << ":" << address[1] << ":" << address[2] << ":"
+      << address[3] << ":" << address[4] << ":" << address[5];
+    return ss.str();
+  }
+
+  size_t RegexSelect(const std::unordered_map<uint64_t, Bulb>& bulbs,
+    const std::string& filter)
+  {
+    size_t count = 0;
+    std::regex filterRegex(".*" + filter + ".*");
+    for (const auto& iter : bulbs)
+    {
+      if (std::regex_match(iter.second.group, filterRegex) ||
+        std::regex_match(iter.second.label, filterRegex) ||
+        std::regex_match(iter.second.location, filterRegex) ||
+        std::regex_match(StreamMac(iter.second.mac_address.data()), filterRegex))
+      {
+        ++count;
+      }
+    }
+    return count;
+  }
+}
+
+BENCHMARK(Filter)
+{
+  std::unordered_map<uint64_t, Bulb> bulbs;
+  lifx::SelectorIndex index;
+  lifx::GroupIndex groups;
+  lifx::GroupIndex locations;
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    std::array<uint8_t, 8> target = { { 0xD0, 0x73, 0xD5,
+      static_cast<uint8_t>(i >> 16), static_cast<uint8_t>(i >> 8),
+      static_cast<uint8_t>(i) } };
+    char label[32] = { };
+    snprintf(label, sizeof(label), "Room %zu Lamp %zu", i / 4, i % 4);
+    lifx::message::device::StateGroup group = { { static_cast<uint8_t>(1 + i % GROUPS) },
+      "", 100 };
+    snprintf(group.label, sizeof(group.label), "Group %zu", i % GROUPS);
+    lifx::message::device::StateLocation location = { { 1 }, "Home", 100 };
+
+    bulbs[lifx::TargetKey(target.data())] = { label, target, group.label,
+      location.label };
+    index.Update(target.data(), label);
+    groups.Update(target.data(), group);
+    locations.Update(target.data(), location);
+  }
+
+  auto measure = [&](const char* name, const char* filter)
+  {
+    size_t count = 0;
+    auto ns = bench::NanosecondsPer(SELECTS, [&](size_t)
+    {
+      // Compiled each time, the way the CLI runs one command per filter
+      lifx::DeviceSelector selector(filter);
+      std::vector<lifx::SelectorIndex::Target> targets;
+      index.Select(selector, groups, locations, targets);
+      count = targets.size();
+      bench::DoNotOptimize(targets.data());
+    });
+    bench::Report(std::string(name), ns / 1000.0, "us/select");
+    bench::Report(std::string(name) + " matches", static_cast<double>(count),
+      "devices");
+  };
+
+  size_t count = 0;
+  auto ns = bench::NanosecondsPer(REGEX_SELECTS, [&](size_t)
+  {
+    count = RegexSelect(bulbs, "room 12 ");
+    bench::DoNotOptimize(&count);
+  });
+  bench::Report("regex per bulb", ns / 1000.0, "us/select");
+
+  // Sorts the index once, as the first select after discovery does
+  measure("exact", "=room 1234 lamp 2");
+  measure("prefix", "room 12 *");
+  measure("glob", "room 12? lamp 3");
+  measure("contains", "lamp 3");
+  measure("mac", "mac:d0:73:d5:00:13");
+  measure("group", "group 7");
+  measure("regex", "re:^room 12 ");
+}
@@ -0,0 +1,110 @@
+/////
+// latency.cpp
+//! @file Command-to-wire latency benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/transport.h>
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+
+namespace
+{
+  constexpr size_t COMMANDS = 2000;
+  constexpr int MIN_INTERVAL_US = 100;
+  constexpr int MAX_INTERVAL_US = 500;
+
+  using Clock = std::chrono::steady_clock;
+
+  int64_t Ticks()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now().time_since_epoch()).count();
+  }
+
+  //! Posts commands to a client at random intervals from another thread,
+  //! the way a show controller would, and reports how long each took from
+  //! being posted to its sendto returning.
+  //! @param[in] lowLatency Whether to put the client in low-latency mode.
+  void Measure(const char* name, bool lowLatency)
+  {
+    lifx::SocketTransport sink(lifx::EPHEMERAL_PORT);
+    auto* transport = new lifx::SocketTransport(lifx::EPHEMERAL_PORT,
+      "127.0.0.1", sink.LocalPort());
+    if (lowLatency)
+    {
+      lifx::LowLatencyOptions options;
+      // The I/O thread shares the CPU with the producer on small machines
+      options.yield = true;
+      options.priority = 6;
+      options.dscp = 46;
+      transport->EnableLowLatency(options);
+    }
+    lifx::LifxClient client(std::unique_ptr<lifx::Transport>(transport), 1);
+    client.SetRateLimits(1000000, 1000000);
+
+    // Start time of the command waiting for the I/O thread, or 0
+    std::atomic<int64_t> mailbox(0);
+    std::atomic<bool> done(false);
+    std::vector<double> latencies;
+    latencies.reserve(COMMANDS);
+
+    std::thread io([&]()
+    {
+      int64_t posted = 0;
+      while (!done.load(std::memory_order_acquire) || posted != 0)
+      {
+        if (posted == 0)
+        {
+          posted = mailbox.exchange(0, std::memory_order_acq_rel);
+          if (posted != 0)
+          {
+            client.Send(lifx::message::light::SetColor { });
+          }
+        }
+        // Blocking clients wait for packets, polling ones come straight back
+        auto result = lowLatency ? client.RunOnce(0, 0) : client.RunOnce(0, 1);
+        if (result == lifx::LifxClient::RunResult::RUN_SENT_DATA && posted != 0)
+        {
+          latencies.push_back(static_cast<double>(Ticks() - posted) / 1000.0);
+          posted = 0;
+        }
+      }
+    });
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<int> interval(MIN_INTERVAL_US, MAX_INTERVAL_US);
+    for (size_t i = 0; i < COMMANDS; ++i)
+    {
+      std::this_thread::sleep_for(std::chrono::microseconds(interval(random)));
+      mailbox.store(Ticks(), std::memory_order_release);
+    }
+    done.store(true, std::memory_order_release);
+    io.join();
+
+    // Commands posted before the last was picked up are overwritten
+    if (latencies.empty())
+      return;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p)
+    {
+      auto index = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+      return latencies[index];
+    };
+    bench::Report(std::string(name) + " p50", percentile(0.5), "us");
+    bench::Report(std::string(name) + " p99", percentile(0.99), "us");
+    bench::Report(std::string(name) + " p999", percentile(0.999), "us");
+    bench::Report(std::string(name) + " commands",
+      static_cast<double>(latencies.size()), "sent");
+  }
+}
+
+BENCHMARK(Latency)
+{
+  Measure("select", false);
+  Measure("low latency", true);
+}
@@ -0,0 +1,139 @@
+/////
+// sharded.cpp
+//! @file Sharded controller scaling benchmarks on a simulated network
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/loopback.h>
+#include <lib-lifx/sharded.h>
+#include <lib-lifx/simulator.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace
+{
+  constexpr size_t DEVICES = 4096;
+  constexpr int ROUNDS = 8;
+  constexpr auto TIMEOUT = std::chrono::seconds(60);
+
+  //! Sends a light::Get to every device of a simulated fleet a few times
+  //! over, and reports how fast the replies come back. Each shard gets a
+  //! thread of its own that plays its devices, so the fleet scales too.
+  void Measure(size_t threads)
+  {
+    lifx::LoopbackNetwork network;
+    std::vector<std::unique_ptr<lifx::SimulatedDevice>> devices;
+    std::vector<std::array<uint8_t, 8>> targets;
+    for (size_t i = 0; i < DEVICES; ++i)
+    {
+      targets.push_back({ { 0xD0, 0x73, 0xD5, 0, static_cast<uint8_t>(i >> 8),
+        static_cast<uint8_t>(i) } });
+      devices.emplace_back(new lifx::SimulatedDevice(network, targets.back().data()));
+    }
+
+    lifx::ShardedController controller(threads, [&network](size_t)
+    {
+      auto* transport = new lifx::LoopbackTransport(network);
+      transport->SetRouting(true);
+      return std::unique_ptr<lifx::Transport>(transport);
+    });
+    controller.SetRateLimits(UINT32_MAX, UINT32_MAX);
+    // Rounds reuse sequences to the same device within the expiry, and
+    // the simulated network never duplicates anything
+    controller.PostAll([](lifx::LifxClient& client)
+    {
+      client.SetDuplicateExpiry(std::chrono::seconds(0));
+    });
+
+    std::atomic<size_t> replies(0);
+    controller.Subscribe<lifx::message::device::StateService>(
+      [&replies](const lifx::Header&, const lifx::message::device::StateService&)
+      { ++replies; });
+    controller.Subscribe<lifx::message::light::State>(
+      [&replies](const lifx::Header&, const lifx::message::light::State&)
+      { ++replies; });
+
+    std::atomic<bool> done(false);
+    std::vector<std::thread> fleet;
+    for (size_t shard = 0; shard < threads; ++shard)
+    {
+      fleet.emplace_back([&, shard]()
+      {
+        std::vector<lifx::SimulatedDevice*> owned;
+        for (size_t i = 0; i < DEVICES; ++i)
+        {
+          if (controller.ShardOf(targets[i].data()) == shard)
+          {
+            owned.push_back(devices[i].get());
+          }
+        }
+        while (!done.load(std::memory_order_acquire))
+        {
+          size_t handled = 0;
+          for (auto* device : owned)
+          {
+            handled += device->Poll();
+          }
+          if (handled == 0)
+          {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+
+    auto wait = [&replies](size_t count)
+    {
+      auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+      while (replies.load() < count && std::chrono::steady_clock::now() < deadline)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    };
+
+    // Every shard discovers the fleet, which teaches it where devices are
+    controller.PostAll([](lifx::LifxClient& client)
+    {
+      client.Broadcast<lifx::message::device::GetService>();
+    });
+    wait(DEVICES * threads);
+    replies = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+      for (const auto& target : targets)
+      {
+        controller.Send(target.data(), lifx::message::light::Get());
+      }
+    }
+    wait(DEVICES * ROUNDS);
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+    done = true;
+    for (auto& thread : fleet)
+    {
+      thread.join();
+    }
+    controller.Stop();
+
+    auto name = std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+    bench::Report(name + " rate", 1000.0 * static_cast<double>(replies.load()) /
+      static_cast<double>(elapsed), "k replies/s");
+    bench::Report(name + " answered", 100.0 * static_cast<double>(replies.load()) /
+      (DEVICES * ROUNDS), "%");
+  }
+}
+
+BENCHMARK(Sharding)
+{
+  bench::Report("hardware threads", std::thread::hardware_concurrency(), "");
+  for (size_t threads : { 1, 2, 4, 8, 16 })
+  {
+    Measure(threads);
+  }
+}
@@ -0,0 +1,85 @@
+/////
+// simulator.cpp
+//! @file Discovery benchmarks on a simulated network
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/loopback.h>
+#include <lib-lifx/simulator.h>
+
+#include <memory>
+#include <unordered_set>
+
+namespace
+{
+  constexpr size_t DEVICES = 1000;
+  constexpr int MAX_ROUNDS = 20;
+  constexpr auto ROUND_TIME = std::chrono::milliseconds(100);
+  constexpr auto STEP = std::chrono::milliseconds(1);
+
+  //! Broadcasts GetService until every device has answered, the way a
+  //! client retries discovery, and reports how long it took.
+  void Measure(const char* name, double loss)
+  {
+    lifx::LoopbackNetwork network;
+    lifx::LoopbackFaults faults;
+    faults.loss = loss;
+    faults.delay = std::chrono::milliseconds(2);
+    faults.jitter = std::chrono::milliseconds(5);
+    network.SetFaults(faults);
+
+    lifx::LifxClient client(std::unique_ptr<lifx::Transport>(
+      new lifx::LoopbackTransport(network)), 1);
+    std::vector<std::unique_ptr<lifx::SimulatedDevice>> devices;
+    for (size_t i = 0; i < DEVICES; ++i)
+    {
+      uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, static_cast<uint8_t>(i >> 8),
+        static_cast<uint8_t>(i) };
+      devices.emplace_back(new lifx::SimulatedDevice(network, target));
+    }
+
+    std::unordered_set<uint64_t> found;
+    client.Subscribe<lifx::message::device::StateService>(
+      [&found](const lifx::Header& header, const lifx::message::device::StateService&)
+      {
+        found.insert(lifx::TargetKey(header.target));
+      });
+
+    int rounds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (; rounds < MAX_ROUNDS && found.size() < DEVICES; ++rounds)
+    {
+      client.Broadcast<lifx::message::device::GetService>();
+      for (auto time = STEP; time <= ROUND_TIME; time += STEP)
+      {
+        while (client.RunOnce(0, 0) != lifx::LifxClient::RunResult::RUN_WAITING) { }
+        for (auto& device : devices)
+        {
+          device->Poll();
+        }
+        network.Advance(STEP);
+      }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start).count();
+
+    auto stats = network.Stats();
+    bench::Report(std::string(name) + " discovered",
+      100.0 * static_cast<double>(found.size()) / DEVICES, "%");
+    bench::Report(std::string(name) + " rounds", rounds, "broadcasts");
+    bench::Report(std::string(name) + " network time",
+      static_cast<double>(rounds * ROUND_TIME.count()), "ms");
+    bench::Report(std::string(name) + " datagrams", static_cast<double>(stats.sent),
+      "sent");
+    bench::Report(std::string(name) + " simulation", elapsed / 1000.0, "ms");
+  }
+}
+
+BENCHMARK(Discovery)
+{
+  // Seeded, so every run of a build reports the same rounds & datagrams
+  Measure("no loss", 0);
+  Measure("10% loss", 0.1);
+  Measure("30% loss", 0.3);
+}
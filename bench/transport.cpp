@@ -0,0 +1,74 @@
+/////
+// transport.cpp
+//! @file Transport throughput benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/transport.h>
+
+#include <ctime>
+
+namespace
+{
+  constexpr size_t PACKETS = 200000;
+  constexpr size_t BATCH = 32;
+
+  //! Sends packets from one transport to another over the loopback
+  //! interface, a batch at a time, and reports the rate & CPU time.
+  void Measure(const char* name, lifx::TransportType type)
+  {
+    auto receiver = lifx::CreateTransport(type, lifx::EPHEMERAL_PORT);
+    auto port = static_cast<lifx::SocketTransport&>(*receiver).LocalPort();
+    auto sender = lifx::CreateTransport(type, lifx::EPHEMERAL_PORT,
+      "127.0.0.1", port);
+
+    auto packet = lifx::LifxClient::Encode(
+      lifx::MakeHeader<lifx::message::light::SetColor>(nullptr, 0, 1),
+      lifx::message::light::SetColor { });
+    size_t received = 0;
+    auto count = [&received](const lifx::Datagram&) { ++received; };
+
+    auto cpuStart = std::clock();
+    auto start = std::chrono::steady_clock::now();
+    size_t sent = 0;
+    while (sent < PACKETS)
+    {
+      for (size_t i = 0; i < BATCH; ++i)
+      {
+        sender->Send(packet.data(), packet.size());
+      }
+      sender->Flush();
+      sent += BATCH;
+
+      // Anything the socket dropped is given up on after a moment
+      for (int waits = 0; received < sent && waits < 10; )
+      {
+        if (receiver->Receive(std::chrono::milliseconds(1), count) == 0)
+        {
+          ++waits;
+        }
+      }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    auto cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    bench::Report(std::string(name) + " rate",
+      static_cast<double>(received) * 1000.0 / static_cast<double>(elapsed),
+      "M packets/s");
+    bench::Report(std::string(name) + " CPU",
+      cpu * 1e9 / static_cast<double>(received), "ns/packet");
+    bench::Report(std::string(name) + " delivered",
+      100.0 * static_cast<double>(received) / static_cast<double>(sent), "%");
+  }
+}
+
+BENCHMARK(Transport)
+{
+  // Both ends are in this process, so the CPU time covers send & receive
+  Measure("socket", lifx::TransportType::SOCKET);
+#ifdef LIFX_IO_URING
+  Measure("io_uring", lifx::TransportType::IO_URING);
+#endif
+}
@@ -0,0 +1,85 @@
+/////
+// wire.cpp
+//! @file Wire serialization benchmarks
+/////
+
+#include "bench.h"
+
+#include <lib-lifx/lifx.h>
+
+#include <array>
+
+namespace
+{
+  constexpr size_t ITERATIONS = 10000000;
+  constexpr size_t PACKET_SIZE =
+    lifx::LIFX_HEADER_SIZE + sizeof(lifx::message::light::SetColor);
+
+  lifx::message::light::SetColor MakeColor(size_t i)
+  {
+    lifx::message::light::SetColor msg = { };
+    msg.color = { static_cast<uint16_t>(i), 0xFFFF, 0x8000, 3500 };
+    msg.duration = static_cast<uint32_t>(i);
+    return msg;
+  }
+}
+
+BENCHMARK(WireEncode)
+{
+  uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0x00, 0x00, 0x01, 0, 0 };
+  auto header = lifx::MakeHeader<lifx::message::light::SetColor>(target, 1234, 1);
+  std::array<char, PACKET_SIZE> buffer {};
+
+  // Copying the packed structs only gives the wire format on little endian
+  // hosts that lay out bitfields like GCC does
+  auto copied = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    auto msg = MakeColor(i);
+    header.sequence = static_cast<uint8_t>(i);
+    memcpy(buffer.data(), &header, lifx::LIFX_HEADER_SIZE);
+    memcpy(buffer.data() + lifx::LIFX_HEADER_SIZE, &msg, sizeof(msg));
+    bench::DoNotOptimize(buffer.data());
+  });
+  bench::Report("memcpy", copied, "ns/packet");
+
+  auto serialized = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    auto msg = MakeColor(i);
+    header.sequence = static_cast<uint8_t>(i);
+    lifx::wire::EncodeHeader(header, buffer.data());
+    lifx::wire::Encode(msg, buffer.data() + lifx::LIFX_HEADER_SIZE);
+    bench::DoNotOptimize(buffer.data());
+  });
+  bench::Report("wire", serialized, "ns/packet");
+}
+
+BENCHMARK(WireDecode)
+{
+  uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0x00, 0x00, 0x01, 0, 0 };
+  auto packet = lifx::LifxClient::Encode(
+    lifx::MakeHeader<lifx::message::light::SetColor>(target, 1234, 1),
+    MakeColor(1));
+
+  auto copied = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    packet[lifx::HEADER_SEQUENCE_OFFSET] = static_cast<char>(i);
+    lifx::Header header;
+    lifx::message::light::SetColor msg;
+    memcpy(&header, packet.data(), lifx::LIFX_HEADER_SIZE);
+    memcpy(&msg, packet.data() + lifx::LIFX_HEADER_SIZE, sizeof(msg));
+    bench::DoNotOptimize(&header);
+    bench::DoNotOptimize(&msg);
+  });
+  bench::Report("memcpy", copied, "ns/packet");
+
+  auto deserialized = bench::NanosecondsPer(ITERATIONS, [&](size_t i)
+  {
+    packet[lifx::HEADER_SEQUENCE_OFFSET] = static_cast<char>(i);
+    lifx::message::light::SetColor msg = { };
+    auto header = lifx::wire::DecodeHeader(packet.data());
+    lifx::wire::Decode(packet.data() + lifx::LIFX_HEADER_SIZE, msg);
+    bench::DoNotOptimize(&header);
+    bench::DoNotOptimize(&msg);
+  });
+  bench::Report("wire", deserialized, "ns/packet");
+}
@@ -0,0 +1,127 @@
+/////
+// codec.h
+//! @file Stateless packet encoding & decoding into caller-owned buffers
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+#include <lib-lifx/wire.h>
+
+#include <utility>
+
+namespace lifx
+{
+
+//! Header fields of a packet that aren't defined by its message type
+struct HeaderOptions
+{
+  //! The target of the packet, or nullptr to broadcast.
+  const uint8_t* target = nullptr;
+  //! The source ID of the sender.
+  uint32_t source = 0;
+  //! The sequence of the packet.
+  uint8_t sequence = 0;
+  //! The device time at which the message takes effect, or 0 for now.
+  uint64_t atTime = 0;
+  //! Asks the device to acknowledge the packet.
+  bool ackRequired = false;
+  //! Asks the device to respond, for message types that have a response.
+  bool resRequired = true;
+};
+
+//! Result of decoding a packet
+enum class DecodeResult
+{
+  DECODED,        //!< The handler was called with the message
+  UNKNOWN_TYPE,   //!< The packet is valid but its type wasn't decoded
+  MALFORMED,      //!< The packet is truncated or not a LIFX packet
+};
+
+//! Encodes a packet into a caller-owned buffer. Neither allocates nor
+//! touches any client state.
+//! @tparam T The message type to encode.
+//! @param[out] buffer The buffer to encode into.
+//! @param[in] size The size of the buffer.
+//! @param[in] message The message payload.
+//! @param[in] options The rest of the header.
+//! @returns The length of the packet, or 0 if it doesn't fit in the buffer.
+template<typename T> size_t EncodeInto(char* buffer, size_t size,
+  const T& message, const HeaderOptions& options = HeaderOptions());
+
+//! Decodes and validates the header of a packet.
+//! @param[in] data The packet, starting with its header.
+//! @param[in] length The length of the packet.
+//! @param[out] header The decoded header.
+//! @returns false if the packet is truncated or not a LIFX packet.
+bool DecodeHeader(const char* data, size_t length, Header& header);
+
+//! Decodes the payload of a packet if it is of a given message type.
+//! @tparam T The message type to decode.
+//! @param[in] header The header returned by @ref DecodeHeader.
+//! @param[in] data The packet, starting with its header.
+//! @param[in] handler Called with the header & a view of the message that
+//! is only valid until it returns.
+template<typename T, typename Handler> DecodeResult DecodeMessage(
+  const Header& header, const char* data, Handler&& handler);
+
+//! Decodes a packet from a caller-owned buffer, dispatching it to a
+//! handler. Neither allocates nor touches any client state.
+//! @tparam T The message types to decode; other types are ignored.
+//! @param[in] data The packet, starting with its header.
+//! @param[in] length The length of the packet.
+//! @param[in] handler Called as handler(const Header&, const T&) for the
+//! message type of the packet, e.g. a generic lambda.
+template<typename ... T, typename Handler> DecodeResult Decode(
+  const char* data, size_t length, Handler&& handler);
+
+template<typename T>
+size_t EncodeInto(char* buffer, size_t size, const T& message,
+  const HeaderOptions& options)
+{
+  constexpr size_t length = LIFX_HEADER_SIZE + wire::Size<T>();
+  if (buffer == nullptr || size < length)
+    return 0;
+
+  auto header = MakeHeader<T>(options.target, options.source,
+    options.sequence, options.atTime);
+  header.ack_required = options.ackRequired ? 1 : 0;
+  header.res_required = options.resRequired ? header.res_required : 0;
+  wire::EncodeHeader(header, buffer);
+  wire::Encode(message, buffer + LIFX_HEADER_SIZE);
+  return length;
+}
+
+template<typename T, typename Handler>
+DecodeResult DecodeMessage(const Header& header, const char* data,
+  Handler&& handler)
+{
+  if (header.type != T::type)
+    return DecodeResult::UNKNOWN_TYPE;
+
+  // A payload shorter than the message would be read from stale bytes
+  if (header.size < LIFX_HEADER_SIZE + wire::Size<T>())
+    return DecodeResult::MALFORMED;
+
+  wire::View<T> view(data + LIFX_HEADER_SIZE);
+  handler(header, *view);
+  return DecodeResult::DECODED;
+}
+
+template<typename ... T, typename Handler>
+DecodeResult Decode(const char* data, size_t length, Handler&& handler)
+{
+  Header header;
+  if (!DecodeHeader(data, length, header))
+    return DecodeResult::MALFORMED;
+
+  // Expands to one DecodeMessage call per type in an initializer list,
+  // stopping at the first type that matches
+  auto result = DecodeResult::UNKNOWN_TYPE;
+  int _[] = { 0, (result = (result == DecodeResult::UNKNOWN_TYPE ?
+    DecodeMessage<T>(header, data, handler) : result), 0)... };
+  (void)_;
+  return result;
+}
+
+} // namespace lifx
@@ -0,0 +1,88 @@
+/////
+// dedup.h
+//! @file Fixed-size cache of recently received packets
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx_messages.h>
+
+#include <array>
+#include <chrono>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr size_t DUPLICATE_CACHE_SIZE = 256;
+constexpr auto DUPLICATE_EXPIRY = std::chrono::milliseconds(250);
+
+//! Remembers the packets received in the last moments, so that a reply
+//! that arrives twice, e.g. once per network interface or because the
+//! device resent it, is only handled once. Packets are identified by their
+//! target, source, sequence, type & a hash of their payload, so the expiry
+//! should be well below the time it takes a client to reuse a sequence for
+//! the same device & type. The payload tells apart the packets of a reply
+//! that comes in several, like the StateMultiZone or State64 answers to a
+//! single request, which share everything else.
+//! Each key maps to a single slot, so lookups are O(1) and never allocate;
+//! a key that collides with a newer one is forgotten early, which may let
+//! a duplicate through but never drops a packet that wasn't seen before.
+class DuplicateFilter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    //! Constructor for DuplicateFilter.
+    //! @param[in] expiry How long a packet is remembered. Zero disables
+    //! the filter.
+    DuplicateFilter(Clock::duration expiry = DUPLICATE_EXPIRY);
+
+    //! Checks if a packet was recorded within the expiry.
+    //! @param[in] header The header of the packet.
+    //! @param[in] now The current time.
+    //! @param[in] payload The @ref PayloadHash of the packet.
+    bool Contains(const Header& header, Clock::time_point now,
+      uint64_t payload = 0) const;
+    //! Records a packet, replacing whatever shared its slot.
+    void Record(const Header& header, Clock::time_point now,
+      uint64_t payload = 0);
+    //! Hashes the payload of a packet, for @ref Contains & @ref Record.
+    //! @param[in] data The payload.
+    //! @param[in] length The length of the payload.
+    static uint64_t PayloadHash(const char* data, size_t length);
+    //! Changes how long packets are remembered. Zero disables the filter.
+    void SetExpiry(Clock::duration expiry);
+    //! Checks if packets are remembered at all.
+    bool Enabled() const { return m_expiry > Clock::duration::zero(); }
+    //! Forgets every recorded packet.
+    void Clear();
+  protected:
+    //! A recorded packet
+    struct Entry
+    {
+      uint64_t target;
+      uint64_t payload;
+      uint32_t source;
+      uint16_t type;
+      uint8_t sequence;
+      bool used;
+      Clock::time_point time;   //!< When the packet was recorded
+    };
+
+    //! Finds the slot of a packet.
+    static size_t Slot(const Header& header);
+    //! Checks if an entry holds a packet.
+    static bool Matches(const Entry& entry, const Header& header,
+      uint64_t payload);
+
+    //! Recorded packets, one per slot.
+    std::array<Entry, DUPLICATE_CACHE_SIZE> m_entries;
+    //! How long a packet is remembered.
+    Clock::duration m_expiry;
+};
+
+} // namespace lifx
@@ -0,0 +1,192 @@
+/////
+// delegate.h
+//! @file Non-allocating callable wrapper
+/////
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr size_t DELEGATE_CAPACITY = 6 * sizeof(void*);
+
+template<typename Signature, size_t Capacity = DELEGATE_CAPACITY> class Delegate;
+
+//! Holds any callable in inline storage, like a std::function that never
+//! allocates. Callables that don't fit in Capacity bytes are rejected at
+//! compile time; capture large state by reference or pointer instead.
+//! @tparam R The return type of the callable.
+//! @tparam Args The argument types of the callable.
+//! @tparam Capacity The number of bytes available to the callable.
+template<typename R, typename ... Args, size_t Capacity>
+class Delegate<R(Args...), Capacity>
+{
+  public:
+    //! Creates an empty delegate.
+    Delegate() noexcept
+      : m_invoke(nullptr)
+      , m_manage(nullptr)
+    {
+    }
+
+    //! Creates an empty delegate.
+    Delegate(std::nullptr_t) noexcept
+      : Delegate()
+    {
+    }
+
+    //! Creates a delegate holding a copy of a callable.
+    template<typename F, typename = typename std::enable_if<
+      !std::is_same<typename std::decay<F>::type, Delegate>::value>::type>
+    Delegate(F&& callable)
+      : Delegate()
+    {
+      using Callable = typename std::decay<F>::type;
+      static_assert(sizeof(Callable) <= Capacity,
+        "Callable is too large for the delegate's inline storage");
+      static_assert(alignof(Callable) <= alignof(Storage),
+        "Callable is over-aligned for the delegate's inline storage");
+
+      new (&m_storage) Callable(std::forward<F>(callable));
+      m_invoke = &Invoke<Callable>;
+      m_manage = &Manage<Callable>;
+    }
+
+    Delegate(const Delegate& other)
+      : Delegate()
+    {
+      if (other.m_manage != nullptr)
+      {
+        other.m_manage(Operation::COPY, &m_storage, &other.m_storage);
+        m_invoke = other.m_invoke;
+        m_manage = other.m_manage;
+      }
+    }
+
+    Delegate(Delegate&& other) noexcept
+      : Delegate()
+    {
+      if (other.m_manage != nullptr)
+      {
+        other.m_manage(Operation::MOVE, &m_storage, &other.m_storage);
+        m_invoke = other.m_invoke;
+        m_manage = other.m_manage;
+        other.Reset();
+      }
+    }
+
+    ~Delegate()
+    {
+      Reset();
+    }
+
+    Delegate& operator=(const Delegate& other)
+    {
+      if (this != &other)
+      {
+        Delegate copy(other);
+        *this = std::move(copy);
+      }
+      return *this;
+    }
+
+    Delegate& operator=(Delegate&& other) noexcept
+    {
+      if (this != &other)
+      {
+        Reset();
+        if (other.m_manage != nullptr)
+        {
+          other.m_manage(Operation::MOVE, &m_storage, &other.m_storage);
+          m_invoke = other.m_invoke;
+          m_manage = other.m_manage;
+          other.Reset();
+        }
+      }
+      return *this;
+    }
+
+    Delegate& operator=(std::nullptr_t) noexcept
+    {
+      Reset();
+      return *this;
+    }
+
+    //! Calls the held callable. The delegate must not be empty.
+    R operator()(Args... args) const
+    {
+      return m_invoke(&m_storage, std::forward<Args>(args)...);
+    }
+
+    //! Checks if the delegate holds a callable.
+    explicit operator bool() const noexcept
+    {
+      return m_invoke != nullptr;
+    }
+  private:
+    using Storage = typename std::aligned_storage<Capacity,
+      alignof(std::max_align_t)>::type;
+
+    //! What @ref Manage does with the held callable
+    enum class Operation
+    {
+      COPY,
+      MOVE,
+      DESTROY,
+    };
+
+    template<typename Callable>
+    static R Invoke(const void* storage, Args... args)
+    {
+      // Mutable lambdas are allowed to change their captures, as they are
+      // when held by a std::function
+      auto& callable = *const_cast<Callable*>(
+        static_cast<const Callable*>(storage));
+      return callable(std::forward<Args>(args)...);
+    }
+
+    template<typename Callable>
+    static void Manage(Operation operation, void* destination,
+      const void* source)
+    {
+      auto callable = const_cast<Callable*>(static_cast<const Callable*>(source));
+      switch (operation)
+      {
+        case Operation::COPY:
+          new (destination) Callable(*callable);
+          break;
+        case Operation::MOVE:
+          new (destination) Callable(std::move(*callable));
+          break;
+        case Operation::DESTROY:
+          callable->~Callable();
+          break;
+      }
+    }
+
+    void Reset() noexcept
+    {
+      if (m_manage != nullptr)
+      {
+        m_manage(Operation::DESTROY, nullptr, &m_storage);
+      }
+      m_invoke = nullptr;
+      m_manage = nullptr;
+    }
+
+    //! Inline storage of the callable.
+    Storage m_storage;
+    //! Calls the callable in @ref m_storage.
+    R (*m_invoke)(const void* storage, Args... args);
+    //! Copies, moves or destroys the callable in @ref m_storage.
+    void (*m_manage)(Operation operation, void* destination,
+      const void* source);
+};
+
+} // namespace lifx
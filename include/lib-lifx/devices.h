@@ -0,0 +1,105 @@
+/////
+// devices.h
+//! @file Registry of known devices, stored as a structure of arrays
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx_messages.h>
+
+#include <array>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr size_t DEVICE_LABEL_SIZE = 32;
+constexpr uint32_t INVALID_DEVICE = UINT32_MAX;
+
+//! The state of every known device, one array per field so that a scan of
+//! the whole fleet only touches the fields it reads. Devices are numbered
+//! densely from 0, and a MAC address is looked up through an open-addressed
+//! hash table of those numbers. Removing a device moves the last one into
+//! its place, so indexes are only stable until the next @ref Remove.
+class DeviceRegistry
+{
+  public:
+    //! Index of a device in every array
+    using Index = uint32_t;
+    //! A label, padded with zeros; as on the wire, it is not terminated
+    //! when all 32 characters are used.
+    using Label = std::array<char, DEVICE_LABEL_SIZE>;
+
+    //! Constructor for DeviceRegistry.
+    //! @param[in] capacity The number of devices to make room for.
+    DeviceRegistry(size_t capacity = 0);
+
+    //! Makes room for a number of devices without growing again.
+    void Reserve(size_t capacity);
+    //! Adds a device, or finds it if it is already known.
+    //! @returns The index of the device.
+    Index Add(const uint8_t target[8]);
+    //! Finds a device by its MAC address.
+    //! @returns The index of the device, or @ref INVALID_DEVICE.
+    Index Find(const uint8_t target[8]) const;
+    //! Finds a device by the @ref TargetKey of its MAC address.
+    Index Find(uint64_t mac) const;
+    //! Removes a device, moving the last device into its index.
+    //! @returns false if the device wasn't known.
+    bool Remove(const uint8_t target[8]);
+    //! Forgets every device.
+    void Clear();
+    //! Gets the number of devices.
+    size_t Size() const { return m_macs.size(); }
+
+    //! Updates the color, power & label of a device from its state.
+    void Update(Index index, const message::light::State& state);
+    //! Changes the color of a device.
+    void SetColor(Index index, const HSBK& color) { m_colors[index] = color; }
+    //! Changes the power level of a device.
+    void SetPower(Index index, uint16_t power) { m_powers[index] = power; }
+    //! Changes the label of a device.
+    void SetLabel(Index index, const char label[DEVICE_LABEL_SIZE]);
+
+    //! Gets the @ref TargetKey of a device's MAC address.
+    uint64_t Mac(Index index) const { return m_macs[index]; }
+    //! Gets the color of a device.
+    const HSBK& Color(Index index) const { return m_colors[index]; }
+    //! Gets the power level of a device.
+    uint16_t Power(Index index) const { return m_powers[index]; }
+    //! Gets the label of a device.
+    const Label& GetLabel(Index index) const { return m_labels[index]; }
+
+    //! Gets the MAC of every device, for scans; @ref Size long.
+    const uint64_t* Macs() const { return m_macs.data(); }
+    //! Gets the color of every device.
+    const HSBK* Colors() const { return m_colors.data(); }
+    //! Gets the power level of every device.
+    const uint16_t* Powers() const { return m_powers.data(); }
+    //! Gets the label of every device.
+    const Label* Labels() const { return m_labels.data(); }
+  protected:
+    //! Gets the slot a MAC hashes to in @ref m_slots.
+    size_t Home(uint64_t mac) const;
+    //! Finds the slot of a MAC in @ref m_slots, or the empty slot it would
+    //! go in.
+    size_t Slot(uint64_t mac) const;
+    //! Rebuilds @ref m_slots with room for a number of devices.
+    void Rehash(size_t capacity);
+
+    std::vector<uint64_t> m_macs;
+    std::vector<HSBK> m_colors;
+    std::vector<uint16_t> m_powers;
+    std::vector<Label> m_labels;
+    //! Device indexes by hash of their MAC, @ref INVALID_DEVICE when empty.
+    //! A power of two long and at most half full.
+    std::vector<Index> m_slots;
+    //! Turns a hash into a slot, 64 minus the bits of a slot number.
+    unsigned m_shift;
+};
+
+} // namespace lifx
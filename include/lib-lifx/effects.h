@@ -0,0 +1,124 @@
+/////
+// effects.h
+//! @file Keyframe effects engine
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace lifx
+{
+
+// Constant definitions
+//! @ref EffectEngine::Update stops queueing while the client has this many
+//! messages queued, as a client can't queue more than it has sequences for.
+constexpr size_t EFFECT_QUEUE_LIMIT = 128;
+
+//! How the color moves towards a keyframe from the one before it
+enum class Easing
+{
+  LINEAR      = 0, //!< Constant rate of change
+  EASE_IN     = 1, //!< Starts slow, ends fast
+  EASE_OUT    = 2, //!< Starts fast, ends slow
+  EASE_IN_OUT = 3, //!< Starts and ends slow
+  STEP        = 4, //!< Holds the previous color, then jumps at the keyframe
+};
+
+//! A color that an effect reaches at a point in time
+struct Keyframe
+{
+  uint32_t time;   //!< Milliseconds since the start of the effect
+  HSBK color;      //!< Color at this point in time
+  Easing easing;   //!< Easing from the previous keyframe to this one
+};
+
+//! An animation described by keyframes, optionally repeated
+struct Effect
+{
+  //! Keyframes, ordered by time. The first keyframe should be at time 0.
+  std::vector<Keyframe> keyframes;
+  //! The number of times the keyframes are played back to back.
+  uint32_t repeat = 1;
+};
+
+//! A single packet of a planned effect
+struct EffectStep
+{
+  uint32_t time;                     //!< Milliseconds since the effect started
+  bool waveform;                     //!< Whether @ref wave is sent instead of @ref color
+  message::light::SetColor color;    //!< Sent when waveform is false
+  message::light::SetWaveform wave;  //!< Sent when waveform is true
+};
+
+//! Plays keyframe effects on lights using as few packets as possible.
+//! Effects that match a device waveform are sent as a single
+//! @ref message::light::SetWaveform, linear segments are sent as one
+//! @ref message::light::SetColor with the segment's duration, and only
+//! eased segments are broken up into explicit frames.
+class EffectEngine
+{
+  public:
+    //! Constructor for EffectEngine.
+    //! @param[in] client The client that effect packets are queued on.
+    //! @param[in] frameInterval The length of each explicit frame used to
+    //! approximate eased segments.
+    EffectEngine(LifxClient& client,
+      std::chrono::milliseconds frameInterval = std::chrono::milliseconds(100));
+
+    //! Works out the packets needed to play an effect on a single device.
+    //! @param[in] effect The effect to plan.
+    //! @param[in] frameInterval The length of each explicit frame in milliseconds.
+    //! @returns The packets to send, ordered by time.
+    static std::vector<EffectStep> Plan(const Effect& effect,
+      uint32_t frameInterval);
+    //! Starts playing an effect on a device.
+    //! @param[in] effect The effect to play.
+    //! @param[in] target The device to play the effect on.
+    //! @param[in] offset How long to delay the device's start by.
+    void Play(const Effect& effect, const uint8_t target[8],
+      std::chrono::milliseconds offset = std::chrono::milliseconds(0));
+    //! Starts playing an effect on several devices, with each device
+    //! starting phaseStep later than the previous one.
+    //! @param[in] effect The effect to play.
+    //! @param[in] targets The devices to play the effect on.
+    //! @param[in] phaseStep The delay between the start of consecutive devices.
+    void Play(const Effect& effect,
+      const std::vector<std::array<uint8_t, 8>>& targets,
+      std::chrono::milliseconds phaseStep = std::chrono::milliseconds(0));
+    //! Stops any effect playing on a device. Packets already queued on the
+    //! client are still sent.
+    void Stop(const uint8_t target[8]);
+    //! Stops every effect.
+    void StopAll();
+    //! Queues every packet that is due. Call this repeatedly alongside
+    //! @ref LifxClient::RunOnce. Once the client has @ref EFFECT_QUEUE_LIMIT
+    //! messages queued the rest are left for the next call.
+    //! @returns The number of packets queued.
+    size_t Update();
+    //! Checks if any effect still has packets left to send.
+    bool Playing() const;
+  protected:
+    //! An effect playing on a single device
+    struct Playback
+    {
+      std::shared_ptr<const std::vector<EffectStep>> steps;
+      std::array<uint8_t, 8> target;
+      std::chrono::steady_clock::time_point start;
+      size_t next;
+    };
+
+    //! The client that packets are queued on.
+    LifxClient& m_client;
+    //! The length of each explicit frame.
+    std::chrono::milliseconds m_frameInterval;
+    //! Effects currently playing.
+    std::vector<Playback> m_playbacks;
+};
+
+} // namespace lifx
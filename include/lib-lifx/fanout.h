@@ -0,0 +1,122 @@
+/////
+// fanout.h
+//! @file Fan-out planning for commands to many devices
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+#include <lib-lifx/scene.h>
+
+#include <array>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace lifx
+{
+
+//! Turns a command for many devices into as few packets as possible.
+//! When every known device gets the same message, the plan is a broadcast
+//! instead of one packet per device. Otherwise every device is sent its
+//! message directly.
+class FanoutPlanner
+{
+  public:
+    //! Constructor for FanoutPlanner.
+    //! @param[in] sourceId The source ID to put in planned messages.
+    FanoutPlanner(uint32_t sourceId = 0);
+
+    //! Adds a device that has been discovered on the network.
+    void AddDevice(const uint8_t target[8]);
+    //! Removes a device that is no longer on the network.
+    void RemoveDevice(const uint8_t target[8]);
+    //! Gets the number of known devices.
+    size_t DeviceCount() const;
+    //! Checks if a set of targets includes every known device.
+    bool CoversAllDevices(
+      const std::vector<std::array<uint8_t, 8>>& targets) const;
+    //! Plans sending the same message to a set of devices.
+    //! @tparam T The message type to send.
+    //! @param[in] targets The devices to send the message to.
+    //! @param[in] message The message to send.
+    //! @param[in] repeat How many times each packet is sent, for devices
+    //! that are known to drop messages.
+    //! @returns A scene to apply with @ref LifxClient::Apply.
+    template<typename T> std::shared_ptr<const Scene> Plan(
+      const std::vector<std::array<uint8_t, 8>>& targets, const T& message,
+      uint32_t repeat = 1) const;
+    //! Plans sending a message to each device in a set. If every message
+    //! is the same, this is planned the same as a single message.
+    //! @tparam T The message type to send.
+    //! @param[in] entries The devices and the message for each of them.
+    //! @param[in] repeat How many times each packet is sent.
+    //! @returns A scene to apply with @ref LifxClient::Apply.
+    template<typename T> std::shared_ptr<const Scene> Plan(
+      const std::vector<std::pair<std::array<uint8_t, 8>, T>>& entries,
+      uint32_t repeat = 1) const;
+  protected:
+    //! The source ID put in planned messages.
+    uint32_t m_sourceId;
+    //! @ref TargetKey of every known device.
+    std::unordered_set<uint64_t> m_devices;
+};
+
+template<typename T>
+std::shared_ptr<const Scene> FanoutPlanner::Plan(
+  const std::vector<std::array<uint8_t, 8>>& targets, const T& message,
+  uint32_t repeat) const
+{
+  SceneBuilder builder(m_sourceId);
+  if (CoversAllDevices(targets))
+  {
+    for (uint32_t i = 0; i < repeat; ++i)
+    {
+      builder.Add(nullptr, message);
+    }
+    return builder.Build();
+  }
+
+  for (uint32_t i = 0; i < repeat; ++i)
+  {
+    for (const auto& target : targets)
+    {
+      builder.Add(target.data(), message);
+    }
+  }
+  return builder.Build();
+}
+
+template<typename T>
+std::shared_ptr<const Scene> FanoutPlanner::Plan(
+  const std::vector<std::pair<std::array<uint8_t, 8>, T>>& entries,
+  uint32_t repeat) const
+{
+  // Only a single payload can go out as a broadcast without changing
+  // the order that any one device sees its messages in
+  bool identical = true;
+  std::vector<std::array<uint8_t, 8>> targets;
+  targets.reserve(entries.size());
+  for (const auto& entry : entries)
+  {
+    identical = identical &&
+      memcmp(&entry.second, &entries.front().second, sizeof(T)) == 0;
+    targets.push_back(entry.first);
+  }
+
+  if (!entries.empty() && identical)
+    return Plan(targets, entries.front().second, repeat);
+
+  SceneBuilder builder(m_sourceId);
+  for (uint32_t i = 0; i < repeat; ++i)
+  {
+    for (const auto& entry : entries)
+    {
+      builder.Add(entry.first.data(), entry.second);
+    }
+  }
+  return builder.Build();
+}
+
+} // namespace lifx
@@ -0,0 +1,124 @@
+/////
+// filter.h
+//! @file Selecting devices by label, MAC, group or location
+/////
+
+#pragma once
+
+#include <lib-lifx/groups.h>
+
+#include <array>
+#include <memory>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+//! A selector that has been parsed once, to be matched against many
+//! devices. Matching ignores ASCII case. Selectors are written as:
+//! - `all`: every device
+//! - `group:<name>`, `location:<name>`: the members of a group or location
+//! - `mac:<hex>`: devices whose MAC starts with the hex digits, which may
+//!   be separated by colons
+//! - `=<label>`: devices with exactly this label
+//! - `re:<regex>`: devices with a label the regular expression matches
+//!   part of
+//! - `<prefix>*`: devices with a label that starts with the prefix
+//! - a pattern with `*` or `?` elsewhere: a glob over the whole label
+//! - anything else: the group or location with this name, or otherwise
+//!   every device with the text in its label or hex MAC
+class DeviceSelector
+{
+  public:
+    //! How a selector matches
+    enum class Kind
+    {
+      ALL,        //!< Every device
+      NAME,       //!< A group or location name, or else text anywhere in
+                  //!< the label or hex MAC
+      EXACT,      //!< The whole label
+      PREFIX,     //!< The start of the label
+      GLOB,       //!< The whole label, with wildcards
+      REGEX,      //!< Part of the label, with a regular expression
+      GROUP,      //!< The members of a group
+      LOCATION,   //!< The members of a location
+      MAC,        //!< The start of the hex MAC
+    };
+
+    //! Constructor for DeviceSelector. Parses the selector.
+    //! @param[in] selector The selector, as described above.
+    DeviceSelector(const std::string& selector);
+
+    //! Checks if the selector could be parsed; a regular expression may
+    //! not be valid, and an empty selector never is.
+    bool Valid() const { return m_valid; }
+    //! Gets how the selector matches.
+    Kind GetKind() const { return m_kind; }
+    //! Gets what the selector matches against, lowercased, without its
+    //! prefix and wildcard.
+    const std::string& Pattern() const { return m_pattern; }
+    //! Checks if a device matches, for the kinds that only look at the
+    //! device itself.
+    //! @param[in] label The lowercased label of the device.
+    //! @param[in] mac The hex MAC of the device.
+    bool Matches(const std::string& label, const std::string& mac) const;
+  protected:
+    Kind m_kind;
+    std::string m_pattern;
+    //! The pattern as hex digits, for matching MACs.
+    std::string m_hex;
+    std::shared_ptr<std::regex> m_regex;
+    bool m_valid;
+};
+
+//! The lowercased labels and hex MACs of devices, sorted so that exact
+//! labels, label prefixes & MAC prefixes are found with a binary search
+//! instead of a scan.
+class SelectorIndex
+{
+  public:
+    using Target = GroupIndex::Target;
+
+    //! Adds a device or updates its label.
+    void Update(const uint8_t target[8], const char label[32]);
+    //! Forgets a device.
+    //! @returns false if the device wasn't known.
+    bool Remove(const uint8_t target[8]);
+    //! Gets the number of devices.
+    size_t Size() const { return m_targets.size(); }
+    //! Finds the devices a selector matches.
+    //! @param[in] selector The selector.
+    //! @param[in] groups The groups devices are in.
+    //! @param[in] locations The locations devices are in.
+    //! @param[out] targets Gets the matching devices appended.
+    void Select(const DeviceSelector& selector, const GroupIndex& groups,
+      const GroupIndex& locations, std::vector<Target>& targets) const;
+
+    //! Formats a MAC as 12 lowercase hex digits.
+    static std::string HexMac(const uint8_t target[8]);
+  protected:
+    //! Sorts @ref m_byLabel & @ref m_byMac if devices changed since.
+    void Sort() const;
+
+    std::vector<Target> m_targets;
+    //! Lowercased labels, in the order of @ref m_targets.
+    std::vector<std::string> m_labels;
+    //! Hex MACs, in the order of @ref m_targets.
+    std::vector<std::string> m_macs;
+    //! Index of each device, by @ref TargetKey.
+    std::unordered_map<uint64_t, uint32_t> m_indexes;
+    //! Devices sorted by label.
+    mutable std::vector<uint32_t> m_byLabel;
+    //! Devices sorted by hex MAC.
+    mutable std::vector<uint32_t> m_byMac;
+    //! Whether the sorted orders are out of date.
+    mutable bool m_dirty = false;
+};
+
+} // namespace lifx
@@ -0,0 +1,104 @@
+/////
+// groups.h
+//! @file Index of devices by the group or location they belong to
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx_messages.h>
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr size_t UUID_SIZE = 16;
+
+//! Devices by the UUID of their group, or of their location; keep one
+//! index for each. Devices report the UUID together with a label and the
+//! time the label was last changed, and as devices may hold on to an old
+//! label, the one changed last wins. Labels are resolved the same way when
+//! several groups share one, and without regard to ASCII case.
+//!
+//! Members are kept in a list per group, so selecting a group costs a hash
+//! lookup and its members can be handed straight to a @ref FanoutPlanner.
+class GroupIndex
+{
+  public:
+    using Uuid = std::array<uint8_t, UUID_SIZE>;
+    using Target = std::array<uint8_t, 8>;
+    using Members = std::vector<Target>;
+
+    //! Records the group a device belongs to, moving it out of the one it
+    //! was in before.
+    //! @param[in] target The MAC address of the device.
+    //! @param[in] uuid The UUID of the group.
+    //! @param[in] label The label of the group, as the device has it.
+    //! @param[in] updatedAt When that label was set, in nanoseconds since
+    //! the epoch.
+    void Update(const uint8_t target[8], const uint8_t uuid[UUID_SIZE],
+      const char label[32], uint64_t updatedAt);
+    //! Records the group a device reported.
+    void Update(const uint8_t target[8], const message::device::StateGroup& group);
+    //! Records the location a device reported.
+    void Update(const uint8_t target[8],
+      const message::device::StateLocation& location);
+    //! Forgets a device.
+    //! @returns false if the device wasn't in any group.
+    bool Remove(const uint8_t target[8]);
+    //! Forgets every group & device.
+    void Clear();
+
+    //! Gets the members of a group.
+    //! @returns nullptr if no known device is in the group.
+    const Members* Find(const Uuid& uuid) const;
+    //! Gets the members of the group with a label.
+    //! @returns nullptr if no group has the label.
+    const Members* Find(const std::string& label) const;
+    //! Finds the group with a label.
+    //! @returns false if no group has the label.
+    bool Resolve(const std::string& label, Uuid& uuid) const;
+    //! Finds the group a device is in.
+    //! @returns false if the device isn't in any group.
+    bool GroupOf(const uint8_t target[8], Uuid& uuid) const;
+    //! Gets the label of a group, or an empty string if it isn't known.
+    std::string Label(const Uuid& uuid) const;
+    //! Gets the number of groups.
+    size_t Size() const { return m_groups.size(); }
+  protected:
+    struct UuidHash
+    {
+      size_t operator()(const Uuid& uuid) const;
+    };
+
+    //! A group and its members
+    struct Group
+    {
+      std::string label;
+      uint64_t updatedAt;
+      Members members;
+    };
+
+    //! Lowercases a label for @ref m_labels.
+    static std::string Fold(const char* label, size_t length);
+    //! Removes a device from the members of a group.
+    void RemoveMember(const Uuid& uuid, const uint8_t target[8]);
+    //! Points a folded label at the group that set it last, or drops it if
+    //! no group has it any more.
+    void ResolveLabel(const std::string& folded);
+
+    std::unordered_map<Uuid, Group, UuidHash> m_groups;
+    //! The group of each device, by @ref TargetKey.
+    std::unordered_map<uint64_t, Uuid> m_devices;
+    //! Groups by their folded label.
+    std::unordered_map<std::string, Uuid> m_labels;
+};
+
+} // namespace lifx
@@ -5,11 +5,16 @@
 
 #pragma once
 
+#include <lib-lifx/dedup.h>
+#include <lib-lifx/delegate.h>
 #include <lib-lifx/lifx_messages.h>
+#include <lib-lifx/rate_limiter.h>
+#include <lib-lifx/wire.h>
 
+#include <array>
+#include <deque>
 #include <functional>
 #include <memory>
-#include <random>
 #include <vector>
 #include <type_traits>
 #include <unordered_map>
@@ -22,18 +27,88 @@ namespace lifx
 {
 
 // Constant definitions
-constexpr uint32_t MAX_LIFX_PACKET_SIZE = 512;
+constexpr uint32_t MAX_LIFX_PACKET_SIZE = 1024;
 constexpr uint8_t SERVICE_UDP = 1;
 constexpr uint32_t MAX_MESSAGES_PER_SECOND = 20;
+constexpr uint16_t LIFX_PORT = 56700;
+constexpr uint16_t EPHEMERAL_PORT = 0;
 
 constexpr auto LIFX_PROTOCOL = 1024;
+constexpr auto LIFX_HEADER_SIZE = wire::HEADER_SIZE;
 #ifdef _WIN32
-constexpr auto LIFX_HEADER_SIZE = sizeof(lifx::Header) - 1;
 constexpr auto LIFX_NETWORK_HEADER_SIZE = sizeof(lifx::NetworkHeader);
-#else
-constexpr auto LIFX_HEADER_SIZE = sizeof(lifx::Header);
 #endif
 
+// Byte offsets of the fields that change between otherwise identical headers
+constexpr size_t HEADER_SOURCE_OFFSET = 4;
+constexpr size_t HEADER_TARGET_OFFSET = 8;
+constexpr size_t HEADER_FLAGS_OFFSET = 22;
+constexpr uint8_t HEADER_ACK_REQUIRED_BIT = 0x02;
+constexpr size_t HEADER_SEQUENCE_OFFSET = 23;
+constexpr size_t HEADER_AT_TIME_OFFSET = 24;
+
+class Scene;
+class Transport;
+
+//! Creates the header for a message.
+//! @tparam T The message type the header is for.
+//! @param[in] target The target of the message, or nullptr to broadcast.
+//! @param[in] source The source ID of the sender.
+//! @param[in] sequence The sequence of the message.
+//! @param[in] atTime The device time at which the message takes effect.
+template<typename T> Header MakeHeader(const uint8_t target[8],
+  uint32_t source, uint8_t sequence, uint64_t atTime = 0);
+
+//! Identifies a message type sent to or received from a single target
+struct TargetTypeKey
+{
+  uint64_t target;    //!< @ref TargetKey of the target
+  uint16_t type;      //!< The message type
+
+  bool operator==(const TargetTypeKey& other) const
+  {
+    return target == other.target && type == other.type;
+  }
+};
+
+//! Hash for @ref TargetTypeKey
+struct TargetTypeKeyHash
+{
+  size_t operator()(const TargetTypeKey& key) const
+  {
+    return std::hash<uint64_t>()(key.target ^
+      (static_cast<uint64_t>(key.type) << 48));
+  }
+};
+
+//! Cache of encoded headers for each target & message type. Everything in
+//! a header apart from its source, sequence, ack flag and time is the same
+//! every time a message type is sent to a target, so that part is only
+//! encoded once and copied afterwards.
+class HeaderCache
+{
+  public:
+    //! Writes the encoded header of a message into a buffer.
+    //! @tparam T The message type the header is for.
+    //! @param[out] buffer Receives @ref LIFX_HEADER_SIZE bytes.
+    //! @param[in] target The target of the message, or nullptr to broadcast.
+    //! @param[in] source The source ID of the sender.
+    //! @param[in] sequence The sequence of the message.
+    //! @param[in] atTime The device time at which the message takes effect.
+    //! @param[in] ackRequired Whether the device should acknowledge the message.
+    template<typename T> void Encode(char* buffer, const uint8_t target[8],
+      uint32_t source, uint8_t sequence, uint64_t atTime = 0,
+      bool ackRequired = false);
+    //! Gets the number of cached headers.
+    size_t Size() const { return m_templates.size(); }
+    //! Removes every cached header.
+    void Clear() { m_templates.clear(); }
+  protected:
+    //! Encoded headers with a zero source, sequence and time.
+    std::unordered_map<TargetTypeKey, std::array<char, LIFX_HEADER_SIZE>,
+      TargetTypeKeyHash> m_templates;
+};
+
 class LifxClient
 {
   public:
@@ -49,13 +124,25 @@ class LifxClient
 
     //! Callback template for received messages
     template<typename T> using LifxCallback =
-      std::function<void(const Header header, const T& message)>;
+      Delegate<void(const Header& header, const T& message)>;
+    //! Identifies a callback added with @ref Subscribe; 0 is never used
+    using Subscription = uint64_t;
+    //! Callback for when every message of an applied scene has been sent
+    using SceneCallback = std::function<void(uint32_t id)>;
 
     //! Constructor for LifxClient that optionally sets the source ID.
     //! This creates the socket in which all LIFX messages are sent and received.
     //! @param[in] sourceId Optional Source ID for all messages. Can be
     //! checked on received messages to see which LifxClient sent the request.
-    LifxClient(uint32_t sourceId = 0);
+    //! @param[in] port The local port to listen on. Devices reply to the port
+    //! a request came from, so @ref EPHEMERAL_PORT keeps the broadcasts of
+    //! other controllers on the LAN from ever reaching the client.
+    LifxClient(uint32_t sourceId = 0, uint16_t port = LIFX_PORT);
+    //! Constructor for LifxClient that sends & receives through a given
+    //! transport, e.g. one made by @ref CreateTransport.
+    //! @param[in] transport The transport to use; the client owns it.
+    //! @param[in] sourceId Optional Source ID for all messages.
+    LifxClient(std::unique_ptr<Transport> transport, uint32_t sourceId = 0);
     //! Default destructor. Deletes all callbacks and closes the created socket.
     virtual ~LifxClient();
     //! Broadcasts a message to all LIFX devices on the local network
@@ -81,12 +168,43 @@ class LifxClient
     //! @param[in] target The target to send the message to. If this is
     //! nullptr, the message will be broadcasted on the current network instead.
     template<typename T> uint8_t Send(const uint8_t target[8] = nullptr);
+    //! Sends a message that the device should apply at a specific time.
+    //! If target is nullptr, the message will be broadcasted instead.
+    //! @tparam T The message type to send.
+    //! @param[in] message The message that will be sent.
+    //! @param[in] atTime The device time, in nanoseconds since the epoch,
+    //! at which the message should take effect. 0 applies it immediately.
+    //! @param[in] target The target to send the message to. If this is
+    //! nullptr, the message will be broadcasted on the current network instead.
+    template<typename T> uint8_t SendAt(const T& message, uint64_t atTime,
+      const uint8_t target[8] = nullptr);
     //! Registers a @ref LifxCallback callback function for when
-    //! a specific message type is received.
+    //! a specific message type is received. Replaces the callback that was
+    //! registered for the type before, but not any subscriptions.
     //! @tparam T The message type to trigger the callback function for.
     //! @param[in] callback The callback to be triggered when the
-    //! specified message type si received.
-    template<typename T> void RegisterCallback(LifxCallback<T> callback);
+    //! specified message type si received. Any callable that takes a
+    //! const Header& and a const T&, such as a lambda or a @ref LifxCallback.
+    template<typename T, typename F> void RegisterCallback(F&& callback);
+    //! Adds a callback for when a specific message type is received,
+    //! alongside any other callbacks for the type.
+    //! @tparam T The message type to trigger the callback function for.
+    //! @param[in] callback The callback to be triggered, like for
+    //! @ref RegisterCallback.
+    //! @param[in] target Only trigger for messages from this device, or
+    //! nullptr for every device.
+    //! @returns The subscription to pass to @ref Unsubscribe.
+    template<typename T, typename F> Subscription Subscribe(F&& callback,
+      const uint8_t target[8] = nullptr);
+    //! Removes a callback added with @ref Subscribe. Safe to call from
+    //! within a callback.
+    //! @returns false if the subscription doesn't exist.
+    bool Unsubscribe(Subscription subscription);
+    //! Sets the message types that received packets are decoded as; packets
+    //! of any other type are dropped. Defined in @ref registry.h.
+    //! @tparam List A @ref MessageList, e.g. @ref DefaultMessages with
+    //! user-defined messages appended.
+    template<typename List> void UseMessages();
     //! Runs the LifxClient's internal processing for one loop. Call this
     //! repeatedly to continue functionality.
     //! @param[in] seconds The number of seconds that the client may process for.
@@ -95,20 +213,136 @@ class LifxClient
     virtual RunResult RunOnce(long seconds = 0, long milliseconds = 1);
     //! Checks if there are any messages waiting in the client's queue to be sent.
     virtual bool WaitingToSend() const;
+    //! Queues every message of a prebuilt @ref Scene. Messages are sent
+    //! in the scene's order, within both the client's rate limit and the
+    //! rate limit of each device.
+    //! @param[in] scene The scene to apply. It may be applied again later
+    //! without being rebuilt.
+    //! @param[in] callback Optional callback for when the whole scene was sent.
+    //! @returns An ID to check the progress of the scene with.
+    uint32_t Apply(std::shared_ptr<const Scene> scene,
+      SceneCallback callback = nullptr);
+    //! Checks if an applied scene still has messages left to send.
+    //! @param[in] id The ID returned by @ref Apply.
+    bool Applying(uint32_t id) const;
+    //! Changes the rate limits of the client.
+    //! @param[in] perSecond Messages per second across all devices.
+    //! @param[in] devicePerSecond Messages per second to a single device.
+    void SetRateLimits(uint32_t perSecond, uint32_t devicePerSecond);
+    //! Gets the messages per second allowed across all devices.
+    uint32_t RateLimit() const;
+    //! Drops received packets that weren't sent in reply to this client,
+    //! judged by the source ID in their header, before they are decoded.
+    //! Also drops this client's own broadcasts, which come back from its
+    //! own address & port; that includes the replies of a device emulator
+    //! on this host that shares the port, so bind to @ref EPHEMERAL_PORT
+    //! to use one.
+    //! @param[in] enabled Whether to filter by source ID.
+    //! @param[in] allowDeviceInitiated Keep packets with a source ID of 0,
+    //! which devices use for messages that aren't a reply to anyone.
+    void FilterSources(bool enabled, bool allowDeviceInitiated = true);
+    //! Gets the number of received packets dropped because they came from
+    //! another controller or were this client's own broadcasts.
+    uint64_t FilteredCount() const;
+    //! Changes how long received packets are remembered to drop the
+    //! copies that arrive after them. See @ref DuplicateFilter.
+    //! @param[in] expiry How long a packet is remembered; zero keeps
+    //! every copy.
+    void SetDuplicateExpiry(DuplicateFilter::Clock::duration expiry);
+    //! Gets the number of received packets dropped as duplicates.
+    uint64_t DuplicateCount() const;
+    //! Gets the number of messages waiting in the client's queue to be sent.
+    size_t PendingSendCount() const;
+    //! Gets the number of messages of applied scenes still to be sent.
+    size_t PendingSceneCount() const;
+    //! Gets the source ID the client sends with.
+    uint32_t SourceId() const;
+    //! Gets the time at which a message was last handed to the network.
+    //! @param[in] sequence The sequence returned when the message was queued.
+    //! @returns Nanoseconds since the epoch, or 0 if nothing with this
+    //! sequence has been sent yet.
+    uint64_t SendTime(uint8_t sequence) const;
+    //! Gets the time at which the packet being handled was received, for
+    //! use in callbacks. This is the kernel's timestamp where the transport
+    //! has one, so it doesn't include the time the packet waited for the
+    //! client to read it.
+    //! @returns Nanoseconds since the epoch, or 0 outside of a callback
+    //! for a received packet.
+    uint64_t ReceiveTime() const;
+    //! Replaces the payload of a message that is still waiting in the
+    //! client's queue, keeping its sequence.
+    //! @tparam T The message type that was queued.
+    //! @param[in] sequence The sequence returned when the message was queued.
+    //! @param[in] message The payload that replaces the queued one.
+    //! @param[in] target The target the message was queued for.
+    //! @returns true if a matching message was pending and has been replaced.
+    template<typename T> bool Replace(uint8_t sequence, const T& message,
+      const uint8_t target[8] = nullptr);
+    //! Replaces the payload of a queued message, if the queued payload is
+    //! still the one the caller means. Sequences are reused once a message
+    //! has been sent, so the type & target alone may match a newer message,
+    //! e.g. the frame of another tile.
+    //! @param[in] matches Called with the queued payload, returns whether
+    //! it may be replaced.
+    template<typename T, typename F> bool Replace(uint8_t sequence,
+      const T& message, const uint8_t target[8], F&& matches);
+    //! Gets the number of received datagrams that were dropped because
+    //! they were truncated or not LIFX packets.
+    uint64_t RejectedCount() const;
+    //! Converts a @ref Header to a @ref NetworkHeader
+    //! @param[in] h @ref Header to convert
+    //! @returns A @ref NetworkHeader whose first @ref LIFX_HEADER_SIZE bytes
+    //! are the header in wire format
+    static NetworkHeader ToNetwork(const Header& h);
+    //! Converts a @ref NetworkHeader to a @ref Header
+    //! @param[in] nh @ref NetworkHeader holding a header in wire format
+    //! @returns A converted @ref Header object
+    static Header FromNetwork(const NetworkHeader& nh);
+    //! Copies a header & message into a buffer ready to be sent.
+    //! @param[in] header The header of the message.
+    //! @param[in] message The message payload.
+    template<typename T> static std::vector<char> Encode(const Header& header,
+      const T& message);
   protected:
-    //! Internal callback template for received messages
-    using LifxInternalCallback =
-      std::function<void(const Header header, const void* data)>;
+    //! A scene that is being sent
+    struct ActiveScene
+    {
+      uint32_t id;
+      std::shared_ptr<const Scene> scene;
+      size_t next;
+      SceneCallback callback;
+    };
+
+    //! Internal callback for received messages, large enough to hold any
+    //! callable that fits in a @ref LifxCallback, or a @ref LifxCallback
+    using LifxInternalCallback = Delegate<void(const Header& header,
+      const void* data), sizeof(Delegate<void()>)>;
+    //! A callback in the subscriber index
+    struct Subscriber
+    {
+      Subscription id;
+      LifxInternalCallback callback;
+      bool active;    //!< false once unsubscribed
+    };
 
-    //! Sends the buffer put together by the internal client system.
+    //! Sends the buffer put together by the internal client system
+    //! through the client's @ref Transport.
     //! @param[in] buffer The buffer to send over the network.
     virtual int SendBuffer(const std::vector<char>& buffer);
-    //! Attempts to receive any of the provided types of messages
-    //! @tparam T Variadic template of possible types to receive
-    //! @param header The header that identifies the incoming message in the buffer
-    //! @param buffer The buffer containing the raw message
-    template<typename ... T> void ReceiveMessageTypes(const Header& header,
-      const char* buffer);
+    //! Decodes a validated packet as one of the types in a message list and
+    //! runs its callback.
+    //! @tparam List The @ref MessageList to decode with.
+    //! @returns false if the payload is too short for its type.
+    template<typename List> static bool DispatchMessages(LifxClient& client,
+      const Header& header, const char* data);
+    //! Validates a received datagram and dispatches it to the callback of
+    //! its message type.
+    //! @param[in] data The datagram, starting with its header.
+    //! @param[in] length The number of bytes received.
+    //! @param[in] timestamp When the datagram was received, in nanoseconds
+    //! since the epoch, or 0 for now.
+    //! @returns false if the datagram was rejected.
+    bool ProcessDatagram(const char* data, size_t length, uint64_t timestamp = 0);
     //! Tries to retrieve a message from a provided buffer
     //! based on the provided header.
     //! @tparam T The type of the message to retrieve from the buffer.
@@ -116,78 +350,208 @@ class LifxClient
     //! @param[in] buffer The buffer to retrieve the message from.
     template<typename T> void TryReceiveMessage(const Header& header,
       const char* buffer);
-    //! Runs the callback registered to a message type.
-    //! @tparam T The type of the message to run the callback for.
+    //! Runs the callbacks subscribed to a message type.
+    //! @tparam T The type of the message to run the callbacks for.
     //! @param[in] header The header of the received message.
     //! @param[in] msg The message payload.
     template<typename T> void RunCallback(const Header& header, const T& msg);
+    //! Runs the callbacks subscribed to a message's type, first those for
+    //! every device, then those for the device that sent it.
+    void Notify(const Header& header, const void* msg);
+    //! Adds a callback to the subscriber index.
+    Subscription AddSubscriber(const TargetTypeKey& key,
+      LifxInternalCallback callback);
+    //! Applies the subscription changes made while callbacks were running.
+    void FlushSubscribers();
+    //! Sends the next message of the oldest applied scene whose device
+    //! isn't at its rate limit.
+    //! @returns false if the devices of every scene are at their limit.
+    bool SendSceneMessage(RateLimiter::Clock::time_point now);
+    //! Gets how long until @ref RunOnce can send its next message, taking
+    //! the rate limit of the devices of applied scenes into account.
+    RateLimiter::Clock::duration SendDelay(RateLimiter::Clock::time_point now);
 
-    //! Converts a @ref Header to a @ref NetworkHeader
-    //! @param[in] h @ref Header to convert
-    //! @returns A converted @ref NetworkHeader object
-    static NetworkHeader ToNetwork(const Header& h);
-    //! Converts a @ref NetworkHeader to a @ref Header
-    //! @param[in] nh @ref NetworkHeader to convert
-    //! @returns A converted @ref Header object
-    static Header FromNetwork(const NetworkHeader& nh);
-
-    //! Map that contains the callbacks that are waiting to be triggered.
-    std::unordered_map<uint16_t, LifxInternalCallback> m_callbacks;
+    //! Callbacks by the device & message type they are for. Callbacks for
+    //! every device are under a target of 0.
+    std::unordered_map<TargetTypeKey, std::vector<Subscriber>,
+      TargetTypeKeyHash> m_subscribers;
+    //! Where each subscription is in @ref m_subscribers.
+    std::unordered_map<Subscription, TargetTypeKey> m_subscriptions;
+    //! Subscriptions made while callbacks were running, added afterwards.
+    std::vector<std::pair<TargetTypeKey, Subscriber>> m_newSubscribers;
+    //! Subscription of the callback of each @ref RegisterCallback type.
+    std::unordered_map<uint16_t, Subscription> m_registered;
+    //! The ID of the next subscription.
+    Subscription m_nextSubscription;
+    //! How many @ref Notify calls are running.
+    uint32_t m_notifyDepth;
+    //! Whether unsubscribed callbacks are left in @ref m_subscribers.
+    bool m_removedSubscribers;
+    //! The sequence @ref SendAt tries next.
+    uint8_t m_nextSequence;
     //! Map that contains the buffers pending being sent.
     std::unordered_map<uint8_t, std::vector<char>> m_pendingSends;
+    //! Sequences of @ref m_pendingSends in the order they were queued.
+    std::deque<uint8_t> m_sendOrder;
+    //! Time each sequence was last sent at, in nanoseconds since the epoch.
+    std::array<uint64_t, UCHAR_MAX + 1> m_sendTimes;
+    //! Time the packet being handled was received at.
+    uint64_t m_receiveTime;
+    //! Headers already encoded by @ref Send.
+    HeaderCache m_headerCache;
+    //! Scenes that are being sent, oldest first.
+    std::deque<ActiveScene> m_activeScenes;
+    //! The ID given to the next applied scene.
+    uint32_t m_nextSceneId;
+    //! Limits the messages sent across all devices.
+    RateLimiter m_rateLimiter;
+    //! Messages per second allowed across all devices.
+    uint32_t m_perSecond;
+    //! Limits the messages sent to each device.
+    std::unordered_map<uint64_t, RateLimiter> m_deviceLimiters;
+    //! Messages per second allowed to a single device.
+    uint32_t m_devicePerSecond;
     //! The source ID of the client; optionally provided in constructor.
     uint32_t m_sourceId;
+    //! Number of received datagrams that were rejected.
+    uint64_t m_rejectedCount;
+    //! Decodes received packets, generated by @ref UseMessages.
+    bool (*m_dispatch)(LifxClient& client, const Header& header,
+      const char* data);
+    //! Whether received packets are filtered by source ID.
+    bool m_filterSources;
+    //! Whether packets with a source ID of 0 pass the source filter.
+    bool m_allowDeviceInitiated;
+    //! Number of received datagrams that were filtered out.
+    uint64_t m_filteredCount;
+    //! Packets received recently, to drop their duplicates.
+    DuplicateFilter m_duplicates;
+    //! Number of received datagrams that were duplicates.
+    uint64_t m_duplicateCount;
+    //! Sends & receives the client's packets.
+    std::unique_ptr<Transport> m_transport;
 };
 
-template<typename T>
-uint8_t LifxClient::Broadcast(T&& message)
-{
-  return std::move(Send<T>(std::forward<T>(message), nullptr));
-}
-
-template<typename T>
-uint8_t LifxClient::Broadcast()
+//! Packs a target into a single number, e.g. for use as a map key.
+inline uint64_t TargetKey(const uint8_t target[8])
 {
-  return std::move(Send<T>(nullptr));
+  uint64_t key = 0;
+  if (target != nullptr)
+  {
+    memcpy(&key, target, sizeof(key));
+  }
+  return key;
 }
 
 template<typename T>
-uint8_t LifxClient::Send(const T& message, const uint8_t target[8])
+Header MakeHeader(const uint8_t target[8], uint32_t source, uint8_t sequence,
+  uint64_t atTime)
 {
-  // Create header
   lifx::Header header = { };
-  header.size = lifx::LIFX_HEADER_SIZE;
+  header.size = static_cast<uint16_t>(LIFX_HEADER_SIZE + wire::Size<T>());
   header.origin = 0;
-  header.tagged = std::remove_reference<T>::type::type == message::device::GetService::type ? 1 : 0;
+  // Devices only act on a broadcast if it is tagged
+  header.tagged = TargetKey(target) == 0 ? 1 : 0;
   header.addressable = 1;
   header.protocol = LIFX_PROTOCOL;
-  header.source = m_sourceId;
+  header.source = source;
   for (auto&& i : { 0,1,2,3,4,5,6,7 })
   {
     header.target[i] = (target == nullptr) ? 0 : target[i];
   }
   header.ack_required = 0;
   header.res_required = std::remove_reference<T>::type::has_response ? 1 : 0;
+  header.sequence = sequence;
+  header.at_time = atTime;
   header.type = std::remove_reference<T>::type::type;
-  // Generate a random sequence for each message
+  return header;
+}
+
+template<typename T>
+std::vector<char> LifxClient::Encode(const Header& header, const T& message)
+{
+  // Serialize header & message to buffer
+  std::vector<char> buffer(LIFX_HEADER_SIZE + wire::Size<T>(), 0);
+  wire::EncodeHeader(header, buffer.data());
+  wire::Encode(message, buffer.data() + LIFX_HEADER_SIZE);
+  return buffer;
+}
+
+template<typename T>
+void HeaderCache::Encode(char* buffer, const uint8_t target[8],
+  uint32_t source, uint8_t sequence, uint64_t atTime, bool ackRequired)
+{
+  TargetTypeKey key = { TargetKey(target), T::type };
+  auto cached = m_templates.find(key);
+  if (cached == m_templates.end())
+  {
+    cached = m_templates.emplace(key,
+      std::array<char, LIFX_HEADER_SIZE>()).first;
+    wire::EncodeHeader(MakeHeader<T>(target, 0, 0, 0), cached->second.data());
+  }
+
+  memcpy(buffer, cached->second.data(), LIFX_HEADER_SIZE);
+
+  // Patch the fields that differ between sends, little endian on the wire
+  for (size_t i = 0; i < sizeof(source); ++i)
+  {
+    buffer[HEADER_SOURCE_OFFSET + i] = static_cast<char>(source >> (8 * i));
+  }
+  buffer[HEADER_SEQUENCE_OFFSET] = static_cast<char>(sequence);
+  if (ackRequired)
+  {
+    buffer[HEADER_FLAGS_OFFSET] |= HEADER_ACK_REQUIRED_BIT;
+  }
+  if (atTime != 0)
+  {
+    for (size_t i = 0; i < sizeof(atTime); ++i)
+    {
+      buffer[HEADER_AT_TIME_OFFSET + i] = static_cast<char>(atTime >> (8 * i));
+    }
+  }
+}
+
+template<typename T>
+uint8_t LifxClient::Broadcast(T&& message)
+{
+  return std::move(Send<T>(std::forward<T>(message), nullptr));
+}
+
+template<typename T>
+uint8_t LifxClient::Broadcast()
+{
+  return std::move(Send<T>(nullptr));
+}
+
+template<typename T>
+uint8_t LifxClient::Send(const T& message, const uint8_t target[8])
+{
+  return SendAt(message, 0, target);
+}
+
+template<typename T>
+uint8_t LifxClient::SendAt(const T& message, uint64_t atTime,
+  const uint8_t target[8])
+{
+  // Hand out sequences in turn, so a device only sees one again after 255
+  // other sends; its replies to the two can then be told apart by the
+  // duplicate filter, which only remembers packets for a moment
   uint8_t generatedSequence;
   do {
-    static std::random_device randomDevice;
-    static std::mt19937 mtRand(randomDevice());
-    static std::uniform_int_distribution<short> uniformDistribution{ 1, UCHAR_MAX };
-    generatedSequence = static_cast<uint8_t>(uniformDistribution(mtRand));
-    header.sequence = generatedSequence;
-  } while (m_pendingSends.find(header.sequence) != m_pendingSends.end());
-
-  // Copy header & message to buffer
-  auto messageSize = sizeof(T);
-  std::vector<char> buffer(LIFX_HEADER_SIZE + messageSize, 0);
-  auto nh = ToNetwork(header);
-  memcpy(buffer.data(), &nh, LIFX_HEADER_SIZE);
-  memcpy((buffer.data() + LIFX_HEADER_SIZE), &message, messageSize);
+    generatedSequence = m_nextSequence;
+    m_nextSequence = m_nextSequence == UCHAR_MAX ? 1 :
+      static_cast<uint8_t>(m_nextSequence + 1);
+  } while (m_pendingSends.find(generatedSequence) != m_pendingSends.end());
+
+  // Serialize header & message to buffer
+  std::vector<char> buffer(LIFX_HEADER_SIZE + wire::Size<T>());
+  m_headerCache.Encode<T>(buffer.data(), target, m_sourceId,
+    generatedSequence, atTime);
+  wire::Encode(message, buffer.data() + LIFX_HEADER_SIZE);
 
   // Queue the send
-  m_pendingSends[generatedSequence] = buffer;
+  m_pendingSends[generatedSequence] = std::move(buffer);
+  m_sendOrder.push_back(generatedSequence);
 
   return std::move(generatedSequence);
 }
@@ -199,17 +563,63 @@ uint8_t LifxClient::Send(const uint8_t target[8])
 }
 
 template<typename T>
-void LifxClient::RegisterCallback(LifxClient::LifxCallback<T> callback)
+bool LifxClient::Replace(uint8_t sequence, const T& message,
+  const uint8_t target[8])
 {
-  m_callbacks[T::type] =
-  [callback = std::move(callback)]
-  (const Header header, const void* data)
+  return Replace(sequence, message, target, [](const T&) { return true; });
+}
+
+template<typename T, typename F>
+bool LifxClient::Replace(uint8_t sequence, const T& message,
+  const uint8_t target[8], F&& matches)
+{
+  auto iter = m_pendingSends.find(sequence);
+  if (iter == m_pendingSends.end() ||
+    iter->second.size() != LIFX_HEADER_SIZE + wire::Size<T>())
   {
-    if (header.type == T::type)
-    {
-      callback(header, *(static_cast<const T*>(data)));
-    }
-  };
+    return false;
+  }
+
+  // Make sure the sequence hasn't been reused by an unrelated message
+  auto header = wire::DecodeHeader(iter->second.data());
+  if (header.type != T::type)
+    return false;
+  for (auto&& i : { 0,1,2,3,4,5,6,7 })
+  {
+    if (header.target[i] != ((target == nullptr) ? 0 : target[i]))
+      return false;
+  }
+  if (!matches(*wire::View<T>(iter->second.data() + LIFX_HEADER_SIZE)))
+    return false;
+
+  wire::Encode(message, iter->second.data() + LIFX_HEADER_SIZE);
+  return true;
+}
+
+template<typename T, typename F>
+void LifxClient::RegisterCallback(F&& callback)
+{
+  auto registered = m_registered.find(T::type);
+  if (registered != m_registered.end())
+  {
+    Unsubscribe(registered->second);
+  }
+  m_registered[T::type] = Subscribe<T>(std::forward<F>(callback));
+}
+
+template<typename T, typename F>
+LifxClient::Subscription LifxClient::Subscribe(F&& callback,
+  const uint8_t target[8])
+{
+  // The callback is stored inline in the subscriber, so dispatching is a
+  // single indirect call straight into it. Subscribers are indexed by
+  // type, so the payload is always a T.
+  return AddSubscriber({ TargetKey(target), T::type },
+  [callback = typename std::decay<F>::type(std::forward<F>(callback))]
+  (const Header& header, const void* data) mutable
+  {
+    callback(header, *(static_cast<const T*>(data)));
+  });
 }
 
 template<typename T>
@@ -218,25 +628,27 @@ void LifxClient::TryReceiveMessage(const Header& header, const char* buffer)
   if (header.type != T::type)
     return;
 
-  T msg;
+  if (buffer == nullptr)
+  {
+    RunCallback(header, T { });
+    return;
+  }
 
-  if (buffer != nullptr)
+  // A payload shorter than the message would be read from stale bytes
+  if (header.size < LIFX_HEADER_SIZE + wire::Size<T>())
   {
-    memset(&msg, 0, sizeof(T));
-    memcpy(&msg, (buffer + LIFX_HEADER_SIZE), sizeof(T));
+    ++m_rejectedCount;
+    return;
   }
 
-  RunCallback(header, std::move(msg));
+  wire::View<T> view(buffer + LIFX_HEADER_SIZE);
+  RunCallback(header, *view);
 }
 
 template<typename T>
 void LifxClient::RunCallback(const Header& header, const T& msg)
 {
-  auto callbackIter = m_callbacks.find(T::type);
-  if (callbackIter != m_callbacks.cend())
-  {
-    callbackIter->second(header, static_cast<const void*>(&msg));
-  }
+  Notify(header, static_cast<const void*>(&msg));
 }
 
 } // namespace lifx
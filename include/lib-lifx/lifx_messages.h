@@ -23,8 +23,8 @@ namespace lifx
     // Frame Address - 128
     uint8_t   target[8];
     uint8_t   site[6];
-    uint8_t   ack_required : 1;
     uint8_t   res_required : 1;
+    uint8_t   ack_required : 1;
     uint8_t:6;
     uint8_t   sequence;
     // Protocol Header - 96
@@ -54,6 +54,36 @@ namespace lifx
     uint16_t  brightness;
     uint16_t  kelvin;
   } HSBK;
+
+  enum class Waveform : uint8_t
+  {
+    SAW       = 0,
+    SINE      = 1,
+    HALF_SINE = 2,
+    TRIANGLE  = 3,
+    PULSE     = 4,
+  };
+
+  typedef struct
+  {
+    int16_t   accel_meas_x;
+    int16_t   accel_meas_y;
+    int16_t   accel_meas_z;
+    int16_t:16;
+    float     user_x;
+    float     user_y;
+    uint8_t   width;
+    uint8_t   height;
+    uint8_t:8;
+    uint32_t  device_version_vendor;
+    uint32_t  device_version_product;
+    uint32_t  device_version_version;
+    uint64_t  firmware_build;
+    uint64_t:64;
+    uint16_t  firmware_version_minor;
+    uint16_t  firmware_version_major;
+    uint32_t:32;
+  } Tile;
 #pragma pack(pop)
 
 
@@ -277,6 +307,19 @@ namespace message
       uint32_t duration;
     };
 
+    struct SetWaveform
+    {
+      static constexpr uint16_t type = 103;
+      static constexpr bool has_response = false;
+      uint8_t:8;
+      uint8_t transient;
+      HSBK color;
+      uint32_t period;
+      float cycles;
+      int16_t skew_ratio;
+      uint8_t waveform;
+    };
+
     struct State
     {
       static constexpr uint16_t type = 107;
@@ -308,8 +351,121 @@ namespace message
       static constexpr bool has_response = false;
       uint16_t level;
     };
+
+    struct SetWaveformOptional
+    {
+      static constexpr uint16_t type = 119;
+      static constexpr bool has_response = false;
+      uint8_t:8;
+      uint8_t transient;
+      HSBK color;
+      uint32_t period;
+      float cycles;
+      int16_t skew_ratio;
+      uint8_t waveform;
+      uint8_t set_hue;
+      uint8_t set_saturation;
+      uint8_t set_brightness;
+      uint8_t set_kelvin;
+    };
   } // namespace light
 
+  namespace multizone
+  {
+    struct SetColorZones
+    {
+      static constexpr uint16_t type = 501;
+      static constexpr bool has_response = false;
+      uint8_t start_index;
+      uint8_t end_index;
+      HSBK color;
+      uint32_t duration;
+      uint8_t apply;
+    };
+
+    struct GetColorZones
+    {
+      static constexpr uint16_t type = 502;
+      static constexpr bool has_response = true;
+      uint8_t start_index;
+      uint8_t end_index;
+    };
+
+    struct StateZone
+    {
+      static constexpr uint16_t type = 503;
+      static constexpr bool has_response = false;
+      uint8_t count;
+      uint8_t index;
+      HSBK color;
+    };
+
+    struct StateMultiZone
+    {
+      static constexpr uint16_t type = 506;
+      static constexpr bool has_response = false;
+      uint8_t count;
+      uint8_t index;
+      HSBK color[8];
+    };
+  } // namespace multizone
+
+  namespace tile
+  {
+    struct GetDeviceChain
+    {
+      static constexpr uint16_t type = 701;
+      static constexpr bool has_response = true;
+    };
+
+    struct StateDeviceChain
+    {
+      static constexpr uint16_t type = 702;
+      static constexpr bool has_response = false;
+      uint8_t start_index;
+      Tile tile_devices[16];
+      uint8_t total_count;
+    };
+
+    struct Get64
+    {
+      static constexpr uint16_t type = 707;
+      static constexpr bool has_response = true;
+      uint8_t tile_index;
+      uint8_t length;
+      uint8_t:8;
+      uint8_t x;
+      uint8_t y;
+      uint8_t width;
+    };
+
+    struct State64
+    {
+      static constexpr uint16_t type = 711;
+      static constexpr bool has_response = false;
+      uint8_t tile_index;
+      uint8_t:8;
+      uint8_t x;
+      uint8_t y;
+      uint8_t width;
+      HSBK colors[64];
+    };
+
+    struct Set64
+    {
+      static constexpr uint16_t type = 715;
+      static constexpr bool has_response = false;
+      uint8_t tile_index;
+      uint8_t length;
+      uint8_t:8;
+      uint8_t x;
+      uint8_t y;
+      uint8_t width;
+      uint32_t duration;
+      HSBK colors[64];
+    };
+  } // namespace tile
+
 #pragma pack(pop)
 } // namespace message
 
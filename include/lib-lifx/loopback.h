@@ -0,0 +1,150 @@
+/////
+// loopback.h
+//! @file In-process network with fault injection for deterministic tests
+/////
+
+#pragma once
+
+#include <lib-lifx/delegate.h>
+#include <lib-lifx/transport.h>
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr uint32_t LOOPBACK_BROADCAST = UINT32_MAX;
+
+//! Faults injected into every datagram sent over a @ref LoopbackNetwork
+struct LoopbackFaults
+{
+  double loss = 0;        //!< Chance that a datagram is dropped
+  double duplicate = 0;   //!< Chance that a datagram arrives twice
+  double reorder = 0;     //!< Chance that a datagram overtakes the one queued before it
+  std::chrono::microseconds delay { 0 };    //!< Time every datagram takes to arrive
+  std::chrono::microseconds jitter { 0 };   //!< Up to this much extra random delay
+};
+
+//! What has happened to the datagrams sent over a @ref LoopbackNetwork
+struct LoopbackStats
+{
+  uint64_t sent;          //!< Datagrams sent, counting each endpoint of a broadcast
+  uint64_t delivered;     //!< Datagrams handed to an endpoint
+  uint64_t lost;          //!< Datagrams dropped by @ref LoopbackFaults::loss
+  uint64_t duplicated;    //!< Extra copies made by @ref LoopbackFaults::duplicate
+  uint64_t reordered;     //!< Datagrams moved by @ref LoopbackFaults::reorder
+};
+
+//! A network of endpoints in a single process. Faults are drawn from a
+//! seeded generator and time only moves with @ref Advance, so the same
+//! sequence of calls always delivers the same datagrams in the same order.
+//! Endpoints may be used from different threads.
+class LoopbackNetwork
+{
+  public:
+    //! Called for each delivered datagram; the data is only valid while it runs.
+    using Handler = Delegate<void(uint32_t from, const char* data, size_t length)>;
+
+    //! Constructor for LoopbackNetwork.
+    //! @param[in] seed Seeds the faults that are injected.
+    LoopbackNetwork(uint32_t seed = 1);
+
+    //! Adds an endpoint to the network.
+    //! @returns The address of the endpoint.
+    uint32_t Attach();
+    //! Removes an endpoint, dropping whatever is queued for it.
+    void Detach(uint32_t address);
+    //! Sends a datagram, subject to the network's faults.
+    //! @param[in] from The address of the sender.
+    //! @param[in] to The address of the receiver, or @ref LOOPBACK_BROADCAST
+    //! for every endpoint but the sender.
+    //! @param[in] data The datagram.
+    //! @param[in] length The length of the datagram.
+    void Send(uint32_t from, uint32_t to, const char* data, size_t length);
+    //! Hands an endpoint every datagram that has arrived for it by now.
+    //! @returns The number of datagrams delivered.
+    size_t Deliver(uint32_t address, const Handler& handler);
+    //! Moves the time of the network forward.
+    void Advance(std::chrono::nanoseconds time);
+    //! Gets the time of the network, starting from 0.
+    std::chrono::nanoseconds Now() const;
+    //! Changes the faults injected into datagrams sent from now on.
+    void SetFaults(const LoopbackFaults& faults);
+    //! Gets what has happened to the datagrams sent so far.
+    LoopbackStats Stats() const;
+    //! Gets the number of datagrams that haven't been delivered yet.
+    size_t InFlight() const;
+  protected:
+    //! A datagram on its way
+    struct Packet
+    {
+      std::chrono::nanoseconds due;   //!< When it arrives
+      uint32_t from;
+      std::vector<char> data;
+    };
+
+    //! Datagrams queued for an endpoint, in the order they arrive
+    struct Endpoint
+    {
+      std::deque<Packet> queue;
+      bool attached;
+    };
+
+    //! Queues a datagram for an endpoint, injecting faults.
+    void Enqueue(Endpoint& endpoint, uint32_t from, const char* data,
+      size_t length);
+    //! Draws a number in [0, 1).
+    double Chance();
+
+    mutable std::mutex m_mutex;
+    std::vector<Endpoint> m_endpoints;
+    LoopbackFaults m_faults;
+    LoopbackStats m_stats;
+    std::mt19937 m_random;
+    std::chrono::nanoseconds m_now;
+};
+
+//! A @ref Transport attached to a @ref LoopbackNetwork, e.g. for a
+//! @ref LifxClient talking to @ref SimulatedDevice "simulated devices".
+//! Receiving never waits, time on the network only moves with
+//! @ref LoopbackNetwork::Advance.
+class LoopbackTransport : public Transport
+{
+  public:
+    //! Constructor for LoopbackTransport. Attaches to the network.
+    //! @param[in] network The network to attach to; must outlive the transport.
+    //! @param[in] destination Where packets are sent, broadcast by default
+    //! like a @ref SocketTransport.
+    LoopbackTransport(LoopbackNetwork& network,
+      uint32_t destination = LOOPBACK_BROADCAST);
+    //! Detaches from the network.
+    ~LoopbackTransport() override;
+
+    int Send(const char* data, size_t length) override;
+    int Receive(std::chrono::microseconds timeout,
+      const ReceiveHandler& handler) override;
+    //! Gets the address of the transport on its network.
+    uint32_t Address() const;
+    //! Sends packets for a device straight to the address its packets came
+    //! from, the way a client unicasts to a device once it has heard from
+    //! it. Off by default, so every packet goes to the destination.
+    void SetRouting(bool enabled);
+  protected:
+    LoopbackNetwork& m_network;
+    uint32_t m_address;
+    uint32_t m_destination;
+    bool m_routing;
+    //! Address each device was last heard from, by @ref TargetKey.
+    std::unordered_map<uint64_t, uint32_t> m_routes;
+};
+
+} // namespace lifx
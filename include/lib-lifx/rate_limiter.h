@@ -0,0 +1,51 @@
+/////
+// rate_limiter.h
+//! @file Token bucket rate limiter
+/////
+
+#pragma once
+
+#include <chrono>
+
+#include <stdint.h>
+
+namespace lifx
+{
+
+//! Token bucket that allows a steady number of messages per second
+//! with bursts of up to a full bucket.
+class RateLimiter
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    //! Constructor for RateLimiter. The bucket starts full.
+    //! @param[in] perSecond The number of messages allowed per second.
+    //! @param[in] burst The number of messages that may be sent back to back.
+    RateLimiter(uint32_t perSecond, uint32_t burst);
+
+    //! Checks if a message may be sent right now.
+    bool Ready(Clock::time_point now);
+    //! Takes a token for a message that is being sent.
+    //! @returns false if there was no token left.
+    bool Acquire(Clock::time_point now);
+    //! Gets how long until a message may be sent, zero if one may be
+    //! sent right now.
+    Clock::duration Delay(Clock::time_point now);
+    //! Changes the rate, keeping the tokens that are left.
+    void SetRate(uint32_t perSecond, uint32_t burst);
+  protected:
+    //! Adds the tokens accumulated since the last refill.
+    void Refill(Clock::time_point now);
+
+    //! Messages allowed per second.
+    uint32_t m_perSecond;
+    //! Size of the bucket.
+    uint32_t m_burst;
+    //! Tokens in the bucket, scaled by @ref m_perSecond to stay integral.
+    uint64_t m_tokens;
+    //! The last time tokens were added.
+    Clock::time_point m_lastRefill;
+};
+
+} // namespace lifx
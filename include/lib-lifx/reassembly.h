@@ -0,0 +1,128 @@
+/////
+// reassembly.h
+//! @file Multi-packet response reassembly
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <functional>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr size_t MAX_PENDING_REASSEMBLIES = 16;
+constexpr size_t MAX_REASSEMBLY_COLORS = 16 * 64;
+
+//! Collects the fragments of zone and tile state responses into a single
+//! result. Each request is tracked by its target and sequence, and the
+//! colors of every fragment are written straight into a buffer provided by
+//! the caller, so no allocation happens per packet.
+//!
+//! The reassembler subscribes to @ref message::multizone::StateZone,
+//! @ref message::multizone::StateMultiZone and @ref message::tile::State64
+//! on the client it is created with, for as long as it exists.
+class Reassembler
+{
+  public:
+    //! Callback for a finished reassembly
+    //! @param target The device that responded.
+    //! @param colors The caller provided buffer that the colors were written to.
+    //! @param count The number of colors that were requested.
+    //! @param complete false if the request timed out before every
+    //! fragment was received.
+    using ReassemblyCallback = std::function<void(const uint8_t target[8],
+      const HSBK* colors, size_t count, bool complete)>;
+
+    //! Constructor for Reassembler.
+    //! @param[in] client The client to send requests and receive fragments on.
+    //! @param[in] timeout How long a request may wait for all of its fragments.
+    Reassembler(LifxClient& client,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(1000));
+    //! Destructor for Reassembler.
+    ~Reassembler();
+    //! Its subscriptions on the client point back at it, so it can't be
+    //! copied or moved.
+    Reassembler(const Reassembler&) = delete;
+    Reassembler(Reassembler&&) = delete;
+    Reassembler& operator=(const Reassembler&) = delete;
+    Reassembler& operator=(Reassembler&&) = delete;
+
+    //! Requests the colors of a range of zones on a multizone device.
+    //! @param[in] target The device to query.
+    //! @param[in] startIndex The first zone to query.
+    //! @param[in] endIndex The last zone to query.
+    //! @param[out] buffer Receives the colors of zones startIndex to endIndex.
+    //! @param[in] capacity The number of colors that fit in buffer.
+    //! @param[in] callback Triggered once all zones arrived or on timeout.
+    //! @returns The sequence of the request, or 0 if it could not be tracked.
+    uint8_t GetColorZones(const uint8_t target[8], uint8_t startIndex,
+      uint8_t endIndex, HSBK* buffer, size_t capacity,
+      ReassemblyCallback callback);
+    //! Requests the colors of a number of tiles in a device chain.
+    //! @param[in] target The device to query.
+    //! @param[in] tileIndex The first tile to query.
+    //! @param[in] length The number of tiles to query.
+    //! @param[out] buffer Receives 64 colors per tile, in tile order.
+    //! @param[in] capacity The number of colors that fit in buffer.
+    //! @param[in] callback Triggered once all tiles arrived or on timeout.
+    //! @returns The sequence of the request, or 0 if it could not be tracked.
+    uint8_t Get64(const uint8_t target[8], uint8_t tileIndex, uint8_t length,
+      HSBK* buffer, size_t capacity, ReassemblyCallback callback);
+    //! Finishes any requests that have timed out. Call this repeatedly
+    //! alongside @ref LifxClient::RunOnce.
+    void Update();
+    //! Gets the number of requests still waiting for fragments.
+    size_t Pending() const;
+  protected:
+    //! State of a single request being reassembled
+    struct Assembly
+    {
+      bool active;
+      uint8_t target[8];
+      uint8_t sequence;
+      uint16_t type;
+      uint16_t first;
+      uint16_t count;
+      HSBK* buffer;
+      std::bitset<MAX_REASSEMBLY_COLORS> received;
+      uint16_t receivedCount;
+      std::chrono::steady_clock::time_point deadline;
+      ReassemblyCallback callback;
+    };
+
+    //! Finds a free slot for a new request.
+    //! @returns nullptr if every slot is in use.
+    Assembly* Allocate();
+    //! Starts tracking a request that has already been queued.
+    void Track(Assembly& assembly, const uint8_t target[8], uint8_t sequence,
+      uint16_t type, uint16_t first, uint16_t count, HSBK* buffer,
+      ReassemblyCallback callback);
+    //! Finds the request that a fragment belongs to.
+    //! @returns nullptr if the fragment isn't part of a tracked request.
+    Assembly* Find(const Header& header, uint16_t type);
+    //! Copies the colors of a fragment into the request's buffer.
+    //! @param[in] index The position of the first color in the fragment.
+    //! @param[in] colors The colors in the fragment.
+    //! @param[in] count The number of colors in the fragment.
+    void Store(Assembly& assembly, uint16_t index, const HSBK* colors,
+      uint16_t count);
+    //! Triggers the callback of a request and frees its slot.
+    void Finish(Assembly& assembly, bool complete);
+
+    //! The client requests are sent on.
+    LifxClient& m_client;
+    //! How long a request may wait for its fragments.
+    std::chrono::milliseconds m_timeout;
+    //! Fixed pool of requests being reassembled.
+    std::array<Assembly, MAX_PENDING_REASSEMBLIES> m_assemblies;
+    //! Subscriptions to the fragment messages.
+    std::array<LifxClient::Subscription, 3> m_subscriptions;
+};
+
+} // namespace lifx
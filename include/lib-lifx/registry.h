@@ -0,0 +1,190 @@
+/////
+// registry.h
+//! @file Compile-time registry of the message types that can be received
+/////
+
+#pragma once
+
+#include <lib-lifx/codec.h>
+#include <lib-lifx/lifx.h>
+#include <lib-lifx/wire.h>
+
+#include <stddef.h>
+
+namespace lifx
+{
+
+//! A compile-time list of message types. Each type needs the static
+//! `type` & `has_response` members of the messages in @ref lifx_messages.h
+//! and a `Visit` overload describing its wire format, declared either in
+//! @ref lifx::wire or in the type's own namespace.
+template<typename ... T> struct MessageList
+{
+  //! The list with more message types added to the end.
+  template<typename ... U> using Append = MessageList<T..., U...>;
+  //! The number of message types in the list.
+  static constexpr size_t size = sizeof...(T);
+};
+
+//! Every message type that the library defines.
+using DefaultMessages = MessageList<
+  message::device::GetService,
+  message::device::StateService,
+  message::device::GetHostInfo,
+  message::device::StateHostInfo,
+  message::device::GetHostFirmware,
+  message::device::StateHostFirmware,
+  message::device::GetWifiInfo,
+  message::device::StateWifiInfo,
+  message::device::GetWifiFirmware,
+  message::device::StateWifiFirmware,
+  message::device::GetPower,
+  message::device::SetPower,
+  message::device::StatePower,
+  message::device::GetLabel,
+  message::device::SetLabel,
+  message::device::StateLabel,
+  message::device::GetVersion,
+  message::device::StateVersion,
+  message::device::GetInfo,
+  message::device::StateInfo,
+  message::device::Acknowledgement,
+  message::device::GetLocation,
+  message::device::StateLocation,
+  message::device::GetGroup,
+  message::device::StateGroup,
+  message::device::EchoRequest,
+  message::device::EchoResponse,
+  message::light::Get,
+  message::light::SetColor,
+  message::light::SetWaveform,
+  message::light::State,
+  message::light::GetPower,
+  message::light::SetPower,
+  message::light::StatePower,
+  message::light::SetWaveformOptional,
+  message::multizone::SetColorZones,
+  message::multizone::GetColorZones,
+  message::multizone::StateZone,
+  message::multizone::StateMultiZone,
+  message::tile::GetDeviceChain,
+  message::tile::StateDeviceChain,
+  message::tile::Get64,
+  message::tile::State64,
+  message::tile::Set64>;
+
+//! Message type IDs of a list, sorted at compile time so that a received
+//! type is found with a binary search.
+template<size_t N> struct TypeIndex
+{
+  uint16_t types[N];    //!< Sorted message type IDs
+  size_t slots[N];      //!< Position in the list of each sorted ID
+
+  constexpr TypeIndex(const uint16_t (&unsorted)[N])
+    : types(), slots()
+  {
+    for (size_t i = 0; i < N; ++i)
+    {
+      // Insertion sort, all that constexpr allows without std::sort
+      size_t j = i;
+      for (; j > 0 && types[j - 1] > unsorted[i]; --j)
+      {
+        types[j] = types[j - 1];
+        slots[j] = slots[j - 1];
+      }
+      types[j] = unsorted[i];
+      slots[j] = i;
+    }
+  }
+
+  //! Checks that no message type ID appears twice.
+  constexpr bool Unique() const
+  {
+    for (size_t i = 1; i < N; ++i)
+    {
+      if (types[i - 1] == types[i])
+        return false;
+    }
+    return true;
+  }
+
+  //! Finds the position in the list of a message type ID.
+  //! @returns N if the ID isn't in the list.
+  constexpr size_t Find(uint16_t type) const
+  {
+    size_t low = 0;
+    size_t high = N;
+    while (low < high)
+    {
+      size_t mid = low + (high - low) / 2;
+      if (types[mid] < type)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    return (low < N && types[low] == type) ? slots[low] : N;
+  }
+};
+
+//! Dispatches received packets to a handler through a table that is
+//! generated from a @ref MessageList.
+template<typename List> class Dispatcher;
+
+template<typename ... T> class Dispatcher<MessageList<T...>>
+{
+  static_assert(sizeof...(T) > 0, "A message list needs at least one type");
+
+  public:
+    //! Sorted message type IDs of the list.
+    static constexpr TypeIndex<sizeof...(T)> index = { { T::type... } };
+    static_assert(index.Unique(), "A message type ID appears twice");
+
+    //! Decodes the payload of a packet whose header has been validated.
+    //! @param[in] header The header returned by @ref DecodeHeader.
+    //! @param[in] data The packet, starting with its header.
+    //! @param[in] handler Called as handler(const Header&, const T&).
+    template<typename Handler> static DecodeResult Dispatch(
+      const Header& header, const char* data, Handler&& handler)
+    {
+      using Decoder = DecodeResult (*)(const Header&, const char*, Handler&);
+      static constexpr Decoder decoders[] = { &DecodeMessage<T, Handler&>... };
+
+      auto slot = index.Find(header.type);
+      if (slot == sizeof...(T))
+        return DecodeResult::UNKNOWN_TYPE;
+      return decoders[slot](header, data, handler);
+    }
+
+    //! Decodes a packet from a caller-owned buffer, like @ref Decode.
+    template<typename Handler> static DecodeResult Decode(
+      const char* data, size_t length, Handler&& handler)
+    {
+      Header header;
+      if (!DecodeHeader(data, length, header))
+        return DecodeResult::MALFORMED;
+      return Dispatch(header, data, handler);
+    }
+};
+
+template<typename ... T>
+constexpr TypeIndex<sizeof...(T)> Dispatcher<MessageList<T...>>::index;
+
+template<typename List>
+bool LifxClient::DispatchMessages(LifxClient& client, const Header& header,
+  const char* data)
+{
+  auto result = Dispatcher<List>::Dispatch(header, data,
+    [&client](const Header& h, const auto& msg)
+  {
+    client.RunCallback(h, msg);
+  });
+  return result != DecodeResult::MALFORMED;
+}
+
+template<typename List>
+void LifxClient::UseMessages()
+{
+  m_dispatch = &DispatchMessages<List>;
+}
+
+} // namespace lifx
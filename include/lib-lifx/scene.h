@@ -0,0 +1,83 @@
+/////
+// scene.h
+//! @file Prebuilt scenes of messages
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+#include <memory>
+#include <vector>
+
+namespace lifx
+{
+
+// Constant definitions
+//! Sequence used by scene messages. Scenes are fire and forget, so they
+//! stay clear of the sequences that @ref LifxClient::Send hands out.
+constexpr uint8_t SCENE_SEQUENCE = 0;
+
+//! An immutable list of messages that are encoded once and can be applied
+//! any number of times with @ref LifxClient::Apply. Build one with
+//! @ref SceneBuilder.
+class Scene
+{
+  public:
+    //! A single encoded message of the scene
+    struct Entry
+    {
+      uint64_t device;            //!< @ref TargetKey of the message's target
+      std::vector<char> packet;   //!< The message, ready to be sent
+    };
+
+    //! Gets the number of messages in the scene.
+    size_t Size() const;
+    //! Gets a message of the scene, in the order it is sent.
+    const Entry& GetEntry(size_t index) const;
+  protected:
+    friend class SceneBuilder;
+
+    //! The messages of the scene, in the order they are sent.
+    std::vector<Entry> m_entries;
+};
+
+//! Collects the messages of a @ref Scene.
+class SceneBuilder
+{
+  public:
+    //! Constructor for SceneBuilder.
+    //! @param[in] sourceId The source ID to put in every message; usually
+    //! the one of the client the scene is applied on.
+    SceneBuilder(uint32_t sourceId = 0);
+
+    //! Adds a message to the scene. Messages to the same device are sent
+    //! in the order they were added.
+    //! @tparam T The message type to add.
+    //! @param[in] target The device to send the message to, or nullptr to
+    //! broadcast it.
+    //! @param[in] message The message to send.
+    template<typename T> SceneBuilder& Add(const uint8_t target[8],
+      const T& message);
+    //! Encodes the scene. Messages are interleaved across devices so that
+    //! consecutive messages go to different devices where possible.
+    std::shared_ptr<const Scene> Build() const;
+  protected:
+    //! The source ID put in every message.
+    uint32_t m_sourceId;
+    //! The messages in the order they were added.
+    std::vector<Scene::Entry> m_entries;
+};
+
+template<typename T>
+SceneBuilder& SceneBuilder::Add(const uint8_t target[8], const T& message)
+{
+  auto header = MakeHeader<T>(target, m_sourceId, SCENE_SEQUENCE);
+  // Nobody waits on a response to a scene
+  header.res_required = 0;
+  m_entries.push_back({ TargetKey(target),
+    LifxClient::Encode(header, message) });
+  return *this;
+}
+
+} // namespace lifx
@@ -0,0 +1,140 @@
+/////
+// sharded.h
+//! @file Controller that spreads devices over several client threads
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+#include <lib-lifx/transport.h>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr long SHARD_POLL_MILLISECONDS = 1;
+//! Tasks wait while a shard's client has this many messages queued, as a
+//! client can't queue more than it has sequences for.
+constexpr size_t SHARD_QUEUE_LIMIT = 128;
+
+//! Runs a @ref LifxClient per worker thread and gives each one a share of
+//! the devices, picked by a hash of their MAC address. Every shard has its
+//! own transport, queues and rate limiters, and a source ID of its own.
+//! Devices answer to the port a request came from, so as long as every
+//! transport has a port of its own the replies to what a shard sends come
+//! back to that shard alone. Sockets that share a port, like several bound
+//! to @ref LIFX_PORT, each get only some of the replies, and the other
+//! shards' source filtering drops those.
+//!
+//! Clients are single-threaded, so they are only ever touched through
+//! tasks that run on their worker thread.
+class ShardedController
+{
+  public:
+    //! Creates the transport of a shard. A socket must be bound to
+    //! @ref EPHEMERAL_PORT, or another port no other shard uses.
+    using TransportFactory = std::function<std::unique_ptr<Transport>(size_t shard)>;
+    //! Runs on the worker thread of a shard with its client.
+    using Task = std::function<void(LifxClient& client)>;
+
+    //! Constructor for ShardedController. Starts the worker threads.
+    //! @param[in] shards The number of worker threads, at least 1.
+    //! @param[in] factory Creates the transport of each shard.
+    //! @param[in] sourceId The source ID of the first shard; each following
+    //! shard uses the next one.
+    ShardedController(size_t shards, const TransportFactory& factory,
+      uint32_t sourceId = 1);
+    //! Constructor for ShardedController. Starts the worker threads, each
+    //! with a transport bound to an ephemeral port.
+    //! @param[in] shards The number of worker threads, at least 1.
+    //! @param[in] type The kind of transport, see @ref CreateTransport.
+    //! @param[in] sourceId The source ID of the first shard; each following
+    //! shard uses the next one.
+    //! @param[in] destination The IPv4 address packets are sent to, or
+    //! nullptr to broadcast them.
+    //! @param[in] destinationPort The port packets are sent to.
+    ShardedController(size_t shards, TransportType type, uint32_t sourceId = 1,
+      const char* destination = nullptr, uint16_t destinationPort = LIFX_PORT);
+    //! Stops the worker threads.
+    ~ShardedController();
+
+    //! Gets the number of shards.
+    size_t ShardCount() const;
+    //! Gets the shard that owns a device.
+    size_t ShardOf(const uint8_t target[8]) const;
+    //! Gets the source ID the client of a shard sends with.
+    uint32_t SourceOf(size_t shard) const;
+    //! Runs a task on a shard's worker thread, after the tasks posted
+    //! before it. Tasks should queue a few messages at most, they are held
+    //! back while the client has @ref SHARD_QUEUE_LIMIT queued.
+    void Post(size_t shard, Task task);
+    //! Runs a task on the worker thread of the shard that owns a device.
+    void Post(const uint8_t target[8], Task task);
+    //! Runs a task on every shard.
+    void PostAll(const Task& task);
+    //! Sends a message to a device from the shard that owns it.
+    //! @tparam T The message type to send.
+    template<typename T> void Send(const uint8_t target[8], const T& message);
+    //! Adds a callback for a message type on every shard. It is called on
+    //! the worker threads, possibly at the same time.
+    //! @tparam T The message type to trigger the callback for.
+    template<typename T> void Subscribe(
+      std::function<void(const Header& header, const T& message)> callback);
+    //! Changes the rate limits. The overall rate is split evenly between
+    //! the shards; each device only ever hears from its own shard.
+    void SetRateLimits(uint32_t perSecond, uint32_t devicePerSecond);
+    //! Stops the worker threads. Tasks that haven't run are dropped.
+    void Stop();
+  protected:
+    //! A worker thread and the client it runs
+    struct Shard
+    {
+      std::unique_ptr<LifxClient> client;
+      //! Guards @ref tasks.
+      std::mutex mutex;
+      std::vector<Task> tasks;
+      std::thread thread;
+    };
+
+    //! Runs the tasks and the client of a shard until stopped.
+    void Run(Shard& shard);
+
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    uint32_t m_sourceId;
+    std::atomic<bool> m_running;
+};
+
+template<typename T>
+void ShardedController::Send(const uint8_t target[8], const T& message)
+{
+  std::array<uint8_t, 8> device;
+  std::copy(target, target + device.size(), device.begin());
+  Post(target, [device, message](LifxClient& client)
+  {
+    client.Send<T>(message, device.data());
+  });
+}
+
+template<typename T>
+void ShardedController::Subscribe(
+  std::function<void(const Header& header, const T& message)> callback)
+{
+  PostAll([callback](LifxClient& client)
+  {
+    client.Subscribe<T>(callback);
+  });
+}
+
+} // namespace lifx
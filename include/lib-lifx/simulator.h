@@ -0,0 +1,69 @@
+/////
+// simulator.h
+//! @file Simulated LIFX devices on a loopback network
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx_messages.h>
+#include <lib-lifx/loopback.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+//! A bulb on a @ref LoopbackNetwork that answers like a real device: it
+//! replies to discovery, gets & sets of its power, label, color, group and
+//! location, echoes, and acknowledges when asked to.
+class SimulatedDevice
+{
+  public:
+    //! Constructor for SimulatedDevice. Attaches to the network.
+    //! @param[in] network The network to attach to; must outlive the device.
+    //! @param[in] target The MAC address of the device.
+    //! @param[in] label The initial label of the device.
+    SimulatedDevice(LoopbackNetwork& network, const uint8_t target[8],
+      const char* label = "");
+    //! Detaches from the network.
+    ~SimulatedDevice();
+
+    //! Handles every packet that has arrived for the device.
+    //! @returns The number of packets received, including those for other
+    //! devices.
+    size_t Poll();
+    //! Gets the light state of the device, which includes its label.
+    const message::light::State& Light() const { return m_light; }
+    //! Gets the group of the device.
+    const message::device::StateGroup& Group() const { return m_group; }
+    //! Gets the location of the device.
+    const message::device::StateLocation& Location() const { return m_location; }
+    //! Changes the group the device reports.
+    void SetGroup(const message::device::StateGroup& group) { m_group = group; }
+    //! Changes the location the device reports.
+    void SetLocation(const message::device::StateLocation& location)
+    {
+      m_location = location;
+    }
+    //! Gets the number of packets addressed to the device.
+    uint64_t HandledCount() const { return m_handled; }
+  protected:
+    //! Handles a packet addressed to the device. Types the simulator
+    //! doesn't know are only acknowledged.
+    template<typename T> void Handle(const Header& header, const T& message);
+    //! Sends a reply to the sender of a request.
+    template<typename T> void Reply(const Header& request, const T& message);
+
+    LoopbackNetwork& m_network;
+    uint32_t m_address;
+    //! Sender of the packet being handled.
+    uint32_t m_replyTo;
+    uint8_t m_target[8];
+    message::light::State m_light;
+    message::device::StateGroup m_group;
+    message::device::StateLocation m_location;
+    uint64_t m_handled;
+};
+
+} // namespace lifx
@@ -0,0 +1,103 @@
+/////
+// sync.h
+//! @file Device clock synchronization
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr auto SYNC_DEFAULT_MARGIN = std::chrono::milliseconds(100);
+
+//! Estimates the clock offset of each device and uses it to make many
+//! devices apply messages at the same moment. Offsets are measured with
+//! @ref message::device::GetInfo: the device's time in
+//! @ref message::device::StateInfo is compared against the midpoint of the
+//! request's send time and the response's receive time, keeping the sample
+//! with the smallest round trip. Only replies to this clock sync's own
+//! samples are used, as the send time of anything else isn't known.
+//!
+//! The clock sync subscribes to @ref message::device::StateInfo on the
+//! client it is created with, for as long as it exists.
+class ClockSync
+{
+  public:
+    //! Estimated clock of a single device
+    struct Estimate
+    {
+      int64_t offset;   //!< Device time minus local time, in nanoseconds
+      uint64_t rtt;     //!< Round trip of the sample the offset came from
+    };
+
+    //! Constructor for ClockSync.
+    //! @param[in] client The client to measure and send on.
+    ClockSync(LifxClient& client);
+    //! Destructor for ClockSync.
+    ~ClockSync();
+
+    //! Gets the local time in nanoseconds since the epoch.
+    static uint64_t Now();
+    //! Queues a clock sample of a device. Take several samples per device
+    //! to filter out delayed responses.
+    //! @param[in] target The device to sample.
+    //! @returns The sequence of the request.
+    uint8_t Sample(const uint8_t target[8]);
+    //! Gets the clock estimate of a device.
+    //! @returns false if the device hasn't answered a sample yet.
+    bool GetEstimate(const uint8_t target[8], Estimate& estimate) const;
+    //! Converts a local time to the clock of a device. Devices without an
+    //! estimate are assumed to share the local clock.
+    uint64_t ToDeviceTime(const uint8_t target[8], uint64_t localTime) const;
+    //! Sends a message to many devices so that all of them apply it at
+    //! the same moment, regardless of the order the client sends them in.
+    //! @tparam T The message type to send.
+    //! @param[in] entries The devices and the message for each of them.
+    //! @param[in] margin Extra time on top of the time needed to drain
+    //! the client's queue and reach the slowest device.
+    //! @returns The local time, in nanoseconds since the epoch, at which
+    //! the devices apply their messages.
+    template<typename T> uint64_t Apply(
+      const std::vector<std::pair<std::array<uint8_t, 8>, T>>& entries,
+      std::chrono::milliseconds margin = SYNC_DEFAULT_MARGIN);
+  protected:
+    //! Works out how far in the future a synchronized apply must be.
+    //! @param[in] count The number of messages about to be queued.
+    uint64_t LeadTime(size_t count, std::chrono::milliseconds margin) const;
+
+    //! The client that samples and messages are sent on.
+    LifxClient& m_client;
+    //! Best estimate of each device's clock.
+    std::unordered_map<uint64_t, Estimate> m_estimates;
+    //! Device of each sample that hasn't been answered, by the sequence
+    //! of its request.
+    std::unordered_map<uint8_t, uint64_t> m_samples;
+    //! Subscription to @ref message::device::StateInfo.
+    LifxClient::Subscription m_subscription;
+};
+
+template<typename T>
+uint64_t ClockSync::Apply(
+  const std::vector<std::pair<std::array<uint8_t, 8>, T>>& entries,
+  std::chrono::milliseconds margin)
+{
+  uint64_t applyTime = Now() + LeadTime(entries.size(), margin);
+  for (const auto& entry : entries)
+  {
+    m_client.SendAt(entry.second,
+      ToDeviceTime(entry.first.data(), applyTime), entry.first.data());
+  }
+  return applyTime;
+}
+
+} // namespace lifx
@@ -0,0 +1,76 @@
+/////
+// tile.h
+//! @file Tile frame buffer streaming
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+#include <array>
+#include <vector>
+
+namespace lifx
+{
+
+// Constant definitions
+constexpr uint8_t TILE_WIDTH = 8;
+constexpr uint8_t TILE_PIXELS = TILE_WIDTH * TILE_WIDTH;
+
+//! Frame buffer for a chain of LIFX Tile devices behind a single target.
+//! Pixels are drawn into the back buffer and sent with @ref Commit, which
+//! only queues a @ref message::tile::Set64 for tiles that changed since the
+//! previous commit. A tile that still has an unsent Set64 in the client's
+//! queue has it replaced, so a chain never has more than one packet per
+//! tile waiting behind the client's rate limit.
+class TileFrameBuffer
+{
+  public:
+    //! A single 8x8 tile of colors, stored row by row.
+    using TileColors = std::array<HSBK, TILE_PIXELS>;
+
+    //! Constructor for TileFrameBuffer.
+    //! @param[in] client The client that the Set64 packets are queued on.
+    //! @param[in] target The device that the tile chain belongs to.
+    //! @param[in] tileCount The number of tiles in the chain, as reported by
+    //! @ref message::tile::StateDeviceChain::total_count.
+    TileFrameBuffer(LifxClient& client, const uint8_t target[8],
+      uint8_t tileCount);
+
+    //! Gets the number of tiles in the chain.
+    uint8_t TileCount() const;
+    //! Sets a single pixel of the back buffer.
+    //! @param[in] tile The index of the tile in the chain.
+    //! @param[in] x The column of the pixel, 0 to 7.
+    //! @param[in] y The row of the pixel, 0 to 7.
+    //! @param[in] color The color of the pixel.
+    void SetPixel(uint8_t tile, uint8_t x, uint8_t y, const HSBK& color);
+    //! Gets a single pixel of the back buffer.
+    const HSBK& GetPixel(uint8_t tile, uint8_t x, uint8_t y) const;
+    //! Gets the back buffer of a whole tile for drawing.
+    TileColors& GetTile(uint8_t tile);
+    //! Sets every pixel of every tile in the back buffer.
+    void Fill(const HSBK& color);
+    //! Queues the tiles that changed since the previous commit.
+    //! @param[in] duration The number of milliseconds the tiles should
+    //! take to transition to the new frame.
+    //! @returns The number of tiles that were queued or updated in the queue.
+    size_t Commit(uint32_t duration = 0);
+    //! Forces every tile to be sent on the next @ref Commit.
+    void Invalidate();
+  protected:
+    //! The client that packets are queued on.
+    LifxClient& m_client;
+    //! The device that owns the tile chain.
+    std::array<uint8_t, 8> m_target;
+    //! The frame currently being drawn.
+    std::vector<TileColors> m_frame;
+    //! The frame as of the previous commit.
+    std::vector<TileColors> m_committed;
+    //! Whether each tile of @ref m_committed reflects what was queued.
+    std::vector<bool> m_committedValid;
+    //! The sequence of the last Set64 queued for each tile, or 0 if none.
+    std::vector<uint8_t> m_sequences;
+};
+
+} // namespace lifx
@@ -0,0 +1,182 @@
+/////
+// transport.h
+//! @file Datagram transports that a LifxClient sends & receives through
+/////
+
+#pragma once
+
+#include <lib-lifx/delegate.h>
+#include <lib-lifx/lifx.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace lifx
+{
+
+#ifdef _WIN32
+using SocketHandle = uintptr_t;
+#else
+using SocketHandle = int;
+#endif
+
+//! A datagram handed to @ref Transport::ReceiveHandler
+struct Datagram
+{
+  const char* data;   //!< The datagram, only valid while the handler runs
+  size_t length;      //!< Its length; above @ref MAX_LIFX_PACKET_SIZE if it was cut short
+  bool loopback;      //!< Sent by this transport, e.g. one of its own broadcasts
+  uint64_t timestamp; //!< When the kernel received it, in nanoseconds since the epoch, or 0 if unknown
+};
+
+//! Options of @ref SocketTransport::EnableLowLatency, which trade CPU time
+//! for a shorter time from a send or a received packet to it being handled
+struct LowLatencyOptions
+{
+  //! Poll the socket instead of waiting for it, so the thread running the
+  //! client never sleeps and doesn't have to be woken up.
+  bool spin = true;
+  //! Yield the CPU between polls, for when the thread doesn't have one of
+  //! its own.
+  bool yield = false;
+  //! How long the kernel busy-polls the network device for packets before
+  //! a receive gives up (SO_BUSY_POLL, Linux only), or 0 to leave it off.
+  std::chrono::microseconds busyPoll { 50 };
+  //! CPU to pin the thread that receives to, or -1 to leave it alone.
+  int cpu = -1;
+  //! Priority of sent packets in the local queues (SO_PRIORITY, Linux
+  //! only), or -1 to leave it alone.
+  int priority = -1;
+  //! DSCP of sent packets for routers along the way, e.g. 46 for
+  //! expedited forwarding, or -1 to leave it alone.
+  int dscp = -1;
+};
+
+//! Moves packets between a @ref LifxClient and the network. The client
+//! only ever calls a transport from the thread that runs it.
+class Transport
+{
+  public:
+    //! Called for each received datagram.
+    using ReceiveHandler = Delegate<void(const Datagram& datagram)>;
+
+    virtual ~Transport() = default;
+    //! Sends a packet, or queues it until @ref Flush.
+    //! @param[in] data The packet.
+    //! @param[in] length The length of the packet.
+    //! @returns The number of bytes sent or queued, or -1 on error.
+    virtual int Send(const char* data, size_t length) = 0;
+    //! Hands every queued packet to the network.
+    virtual void Flush() { }
+    //! Waits for datagrams and hands them to a handler.
+    //! @param[in] timeout How long to wait for the first datagram.
+    //! @param[in] handler Called for each datagram.
+    //! @returns The number of datagrams received, or -1 on error.
+    virtual int Receive(std::chrono::microseconds timeout,
+      const ReceiveHandler& handler) = 0;
+};
+
+//! Sends & receives with a UDP socket, one system call per packet. Where
+//! the system supports it, datagrams carry the time the kernel received
+//! them (SO_TIMESTAMPNS).
+class SocketTransport : public Transport
+{
+  public:
+    //! Constructor for SocketTransport. Creates and binds the socket.
+    //! @param[in] port The local port to listen on, or @ref EPHEMERAL_PORT.
+    //! @param[in] destination The IPv4 address packets are sent to, or
+    //! nullptr to broadcast them.
+    //! @param[in] destinationPort The port packets are sent to.
+    SocketTransport(uint16_t port = LIFX_PORT, const char* destination = nullptr,
+      uint16_t destinationPort = LIFX_PORT);
+    //! Closes the socket.
+    ~SocketTransport() override;
+
+    int Send(const char* data, size_t length) override;
+    int Receive(std::chrono::microseconds timeout,
+      const ReceiveHandler& handler) override;
+    //! Gets the local port the socket was bound to.
+    uint16_t LocalPort() const;
+    //! Switches the socket to low-latency mode. @ref UringTransport only
+    //! takes the socket options, its receives always wait in the kernel.
+    //! @param[in] options What to change.
+    //! @returns false if an option isn't supported on this system; the
+    //! others are still applied.
+    bool EnableLowLatency(const LowLatencyOptions& options);
+  protected:
+    //! Checks if a datagram came from this socket.
+    //! @param[in] address The sender's IPv4 address, in network order.
+    //! @param[in] port The sender's port, in network order.
+    bool IsOwnAddress(uint32_t address, uint16_t port) const;
+
+    //! The UDP socket.
+    SocketHandle m_socket;
+    //! Where packets are sent, in network order.
+    uint32_t m_destinationAddress;
+    //! The port packets are sent to, in network order.
+    uint16_t m_destinationPort;
+    //! The port the socket is bound to, in network order.
+    uint16_t m_localPort;
+    //! Addresses of this host, which its own broadcasts come back from.
+    std::vector<uint32_t> m_localAddresses;
+    //! Whether @ref Receive polls instead of waiting in select.
+    bool m_spin;
+    //! Whether to yield the CPU between polls.
+    bool m_yield;
+    //! CPU to pin the receiving thread to on the next @ref Receive, or -1.
+    int m_pinCpu;
+};
+
+#ifdef LIFX_IO_URING
+//! Sends & receives through an io_uring on Linux. A multishot receive
+//! stays armed into a ring of registered buffers, and sends are queued
+//! until @ref Flush or the next @ref Receive, which submits them together
+//! with the wait in a single system call.
+class UringTransport : public SocketTransport
+{
+  public:
+    //! Constructor for UringTransport, see @ref SocketTransport. Check
+    //! @ref Valid before using it, the kernel may not support io_uring or
+    //! its multishot receives.
+    UringTransport(uint16_t port = LIFX_PORT, const char* destination = nullptr,
+      uint16_t destinationPort = LIFX_PORT);
+    //! Waits for queued sends to complete and tears down the ring.
+    ~UringTransport() override;
+
+    int Send(const char* data, size_t length) override;
+    void Flush() override;
+    int Receive(std::chrono::microseconds timeout,
+      const ReceiveHandler& handler) override;
+    //! Checks if the ring was set up and its receive armed.
+    bool Valid() const;
+  protected:
+    struct Ring;
+
+    //! The ring and everything the kernel reads & writes through it.
+    std::unique_ptr<Ring> m_ring;
+};
+#endif
+
+//! Kinds of @ref Transport that @ref CreateTransport can make
+enum class TransportType
+{
+  SOCKET,     //!< @ref SocketTransport
+  IO_URING,   //!< @ref UringTransport, if built with LIFX_IO_URING
+};
+
+//! Creates a transport, falling back to a @ref SocketTransport if the type
+//! isn't available in this build or on this system.
+//! @param[in] type The kind of transport to create.
+//! @param[in] port The local port to listen on, or @ref EPHEMERAL_PORT.
+//! @param[in] destination The IPv4 address packets are sent to, or nullptr
+//! to broadcast them.
+//! @param[in] destinationPort The port packets are sent to.
+std::unique_ptr<Transport> CreateTransport(TransportType type,
+  uint16_t port = LIFX_PORT, const char* destination = nullptr,
+  uint16_t destinationPort = LIFX_PORT);
+
+} // namespace lifx
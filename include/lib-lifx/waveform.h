@@ -0,0 +1,51 @@
+/////
+// waveform.h
+//! @file Helpers for device-side waveform effects
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx.h>
+
+namespace lifx
+{
+
+namespace waveform
+{
+  //! Converts a ratio to the skew_ratio field of a waveform message.
+  //! @param[in] ratio Ratio from 0 to 1. Values outside are clamped.
+  int16_t SkewRatio(float ratio);
+  //! Creates a waveform message.
+  //! @param[in] shape The shape of the waveform.
+  //! @param[in] color The color the device moves towards from its current color.
+  //! @param[in] period The length of one cycle in milliseconds.
+  //! @param[in] cycles The number of cycles to play.
+  //! @param[in] skew Ratio from 0 to 1 that skews the shape; the duty cycle
+  //! spent on color for @ref Waveform::PULSE.
+  //! @param[in] transient Whether the device returns to its original color
+  //! once all cycles have played.
+  message::light::SetWaveform Make(Waveform shape, const HSBK& color,
+    uint32_t period, float cycles, float skew = 0.5f, bool transient = true);
+  //! Smoothly fades to color and back, like breathing.
+  message::light::SetWaveform Breathe(const HSBK& color, uint32_t period,
+    float cycles);
+  //! Switches to color and back.
+  //! @param[in] duty The ratio of each period spent on color.
+  message::light::SetWaveform Pulse(const HSBK& color, uint32_t period,
+    float cycles, float duty = 0.5f);
+  //! Short flashes of color.
+  message::light::SetWaveform Strobe(const HSBK& color, uint32_t period,
+    float cycles);
+  //! Limits a waveform to some of the color components; components that
+  //! are not set keep the device's current value.
+  message::light::SetWaveformOptional Optional(
+    const message::light::SetWaveform& wave, bool setHue, bool setSaturation,
+    bool setBrightness, bool setKelvin);
+  //! Breathes the brightness only, leaving the hue, saturation and kelvin
+  //! that each device currently has. Suited to broadcasting one packet
+  //! to lights of different colors.
+  message::light::SetWaveformOptional BreatheBrightness(uint16_t brightness,
+    uint32_t period, float cycles);
+} // namespace waveform
+
+} // namespace lifx
@@ -0,0 +1,536 @@
+/////
+// wire.h
+//! @file Portable wire format of LIFX headers & messages
+/////
+
+#pragma once
+
+#include <lib-lifx/lifx_messages.h>
+
+#include <type_traits>
+
+#include <stddef.h>
+#include <string.h>
+
+namespace lifx
+{
+
+namespace wire
+{
+  // Constant definitions
+  constexpr size_t HEADER_SIZE = 36;
+#if defined(_WIN32) || \
+  (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+  //! The packed message structs are laid out exactly like the wire format
+  constexpr bool NATIVE_LAYOUT = true;
+#else
+  constexpr bool NATIVE_LAYOUT = false;
+#endif
+
+  //! Counts the bytes that a message takes up on the wire
+  class Sizer
+  {
+    public:
+      constexpr Sizer() : m_size(0) { }
+      template<typename V> constexpr void Value(const V&) { m_size += sizeof(V); }
+      constexpr void Reserved(size_t count) { m_size += count; }
+      constexpr size_t Get() const { return m_size; }
+    private:
+      size_t m_size;
+  };
+
+  //! Writes little endian values into a buffer
+  class Writer
+  {
+    public:
+      constexpr explicit Writer(char* data) : m_data(data), m_position(0) { }
+
+      template<typename V> constexpr
+      typename std::enable_if<std::is_integral<V>::value>::type Value(V value)
+      {
+        using U = typename std::make_unsigned<V>::type;
+        for (size_t i = 0; i < sizeof(V); ++i)
+        {
+          m_data[m_position++] = static_cast<char>(
+            static_cast<uint8_t>(static_cast<U>(value) >> (8 * i)));
+        }
+      }
+
+      void Value(float value)
+      {
+        uint32_t bits = 0;
+        memcpy(&bits, &value, sizeof(bits));
+        Value(bits);
+      }
+
+      constexpr void Reserved(size_t count)
+      {
+        for (size_t i = 0; i < count; ++i)
+        {
+          m_data[m_position++] = 0;
+        }
+      }
+
+      constexpr size_t Position() const { return m_position; }
+    private:
+      char* m_data;
+      size_t m_position;
+  };
+
+  //! Reads little endian values from a buffer
+  class Reader
+  {
+    public:
+      constexpr explicit Reader(const char* data) : m_data(data), m_position(0) { }
+
+      template<typename V> constexpr
+      typename std::enable_if<std::is_integral<V>::value>::type Value(V& value)
+      {
+        using U = typename std::make_unsigned<V>::type;
+        U bits = 0;
+        for (size_t i = 0; i < sizeof(V); ++i)
+        {
+          bits = static_cast<U>(bits |
+            static_cast<U>(static_cast<U>(static_cast<uint8_t>(m_data[m_position++])) << (8 * i)));
+        }
+        value = static_cast<V>(bits);
+      }
+
+      void Value(float& value)
+      {
+        uint32_t bits = 0;
+        Value(bits);
+        memcpy(&value, &bits, sizeof(value));
+      }
+
+      constexpr void Reserved(size_t count) { m_position += count; }
+
+      constexpr size_t Position() const { return m_position; }
+    private:
+      const char* m_data;
+      size_t m_position;
+  };
+
+  // Every field of a message is visited in wire order with one of the
+  // @ref Sizer, @ref Writer or @ref Reader. The same description of a
+  // message is used to size, encode & decode it.
+
+  template<typename IO, typename V> constexpr
+  typename std::enable_if<std::is_arithmetic<V>::value>::type Visit(IO& io, V& value)
+  {
+    io.Value(value);
+  }
+
+  template<typename IO, typename V, size_t N>
+  constexpr void Visit(IO& io, V (&values)[N]);
+
+  template<typename IO> constexpr void Visit(IO& io, HSBK& m)
+  {
+    Visit(io, m.hue);
+    Visit(io, m.saturation);
+    Visit(io, m.brightness);
+    Visit(io, m.kelvin);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, Tile& m)
+  {
+    Visit(io, m.accel_meas_x);
+    Visit(io, m.accel_meas_y);
+    Visit(io, m.accel_meas_z);
+    io.Reserved(2);
+    Visit(io, m.user_x);
+    Visit(io, m.user_y);
+    Visit(io, m.width);
+    Visit(io, m.height);
+    io.Reserved(1);
+    Visit(io, m.device_version_vendor);
+    Visit(io, m.device_version_product);
+    Visit(io, m.device_version_version);
+    Visit(io, m.firmware_build);
+    io.Reserved(8);
+    Visit(io, m.firmware_version_minor);
+    Visit(io, m.firmware_version_major);
+    io.Reserved(4);
+  }
+
+  template<typename IO, typename V, size_t N>
+  constexpr void Visit(IO& io, V (&values)[N])
+  {
+    for (size_t i = 0; i < N; ++i)
+    {
+      Visit(io, values[i]);
+    }
+  }
+
+  //! Messages without a payload
+  template<typename IO, typename T> constexpr
+  typename std::enable_if<std::is_empty<T>::value>::type Visit(IO&, T&)
+  {
+  }
+
+  // device
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateService& m)
+  {
+    Visit(io, m.service);
+    Visit(io, m.port);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateHostInfo& m)
+  {
+    Visit(io, m.signal);
+    Visit(io, m.tx);
+    Visit(io, m.rx);
+    io.Reserved(2);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateHostFirmware& m)
+  {
+    Visit(io, m.build);
+    io.Reserved(8);
+    Visit(io, m.version);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateWifiInfo& m)
+  {
+    Visit(io, m.signal);
+    Visit(io, m.tx);
+    Visit(io, m.rx);
+    io.Reserved(2);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateWifiFirmware& m)
+  {
+    Visit(io, m.build);
+    io.Reserved(8);
+    Visit(io, m.version);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::SetPower& m)
+  {
+    Visit(io, m.level);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StatePower& m)
+  {
+    Visit(io, m.level);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::SetLabel& m)
+  {
+    Visit(io, m.label);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateLabel& m)
+  {
+    Visit(io, m.label);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateVersion& m)
+  {
+    Visit(io, m.vendor);
+    Visit(io, m.product);
+    Visit(io, m.version);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateInfo& m)
+  {
+    Visit(io, m.time);
+    Visit(io, m.uptime);
+    Visit(io, m.downtime);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateLocation& m)
+  {
+    Visit(io, m.location);
+    Visit(io, m.label);
+    Visit(io, m.updated_at);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::StateGroup& m)
+  {
+    Visit(io, m.group);
+    Visit(io, m.label);
+    Visit(io, m.updated_at);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::EchoRequest& m)
+  {
+    Visit(io, m.payload);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::device::EchoResponse& m)
+  {
+    Visit(io, m.payload);
+  }
+
+  // light
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::SetColor& m)
+  {
+    io.Reserved(1);
+    Visit(io, m.color);
+    Visit(io, m.duration);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::SetWaveform& m)
+  {
+    io.Reserved(1);
+    Visit(io, m.transient);
+    Visit(io, m.color);
+    Visit(io, m.period);
+    Visit(io, m.cycles);
+    Visit(io, m.skew_ratio);
+    Visit(io, m.waveform);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::State& m)
+  {
+    Visit(io, m.color);
+    io.Reserved(2);
+    Visit(io, m.power);
+    Visit(io, m.label);
+    io.Reserved(8);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::SetPower& m)
+  {
+    Visit(io, m.level);
+    Visit(io, m.duration);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::StatePower& m)
+  {
+    Visit(io, m.level);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::light::SetWaveformOptional& m)
+  {
+    io.Reserved(1);
+    Visit(io, m.transient);
+    Visit(io, m.color);
+    Visit(io, m.period);
+    Visit(io, m.cycles);
+    Visit(io, m.skew_ratio);
+    Visit(io, m.waveform);
+    Visit(io, m.set_hue);
+    Visit(io, m.set_saturation);
+    Visit(io, m.set_brightness);
+    Visit(io, m.set_kelvin);
+  }
+
+  // multizone
+
+  template<typename IO> constexpr void Visit(IO& io, message::multizone::SetColorZones& m)
+  {
+    Visit(io, m.start_index);
+    Visit(io, m.end_index);
+    Visit(io, m.color);
+    Visit(io, m.duration);
+    Visit(io, m.apply);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::multizone::GetColorZones& m)
+  {
+    Visit(io, m.start_index);
+    Visit(io, m.end_index);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::multizone::StateZone& m)
+  {
+    Visit(io, m.count);
+    Visit(io, m.index);
+    Visit(io, m.color);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::multizone::StateMultiZone& m)
+  {
+    Visit(io, m.count);
+    Visit(io, m.index);
+    Visit(io, m.color);
+  }
+
+  // tile
+
+  template<typename IO> constexpr void Visit(IO& io, message::tile::StateDeviceChain& m)
+  {
+    Visit(io, m.start_index);
+    Visit(io, m.tile_devices);
+    Visit(io, m.total_count);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::tile::Get64& m)
+  {
+    Visit(io, m.tile_index);
+    Visit(io, m.length);
+    io.Reserved(1);
+    Visit(io, m.x);
+    Visit(io, m.y);
+    Visit(io, m.width);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::tile::State64& m)
+  {
+    Visit(io, m.tile_index);
+    io.Reserved(1);
+    Visit(io, m.x);
+    Visit(io, m.y);
+    Visit(io, m.width);
+    Visit(io, m.colors);
+  }
+
+  template<typename IO> constexpr void Visit(IO& io, message::tile::Set64& m)
+  {
+    Visit(io, m.tile_index);
+    Visit(io, m.length);
+    io.Reserved(1);
+    Visit(io, m.x);
+    Visit(io, m.y);
+    Visit(io, m.width);
+    Visit(io, m.duration);
+    Visit(io, m.colors);
+  }
+
+  //! Gets the number of bytes a message's payload takes up on the wire.
+  //! @tparam T The message type.
+  template<typename T> constexpr size_t Size()
+  {
+    Sizer sizer;
+    T message {};
+    Visit(sizer, message);
+    return sizer.Get();
+  }
+
+  //! Writes a message's payload into a buffer.
+  //! @param[in] message The message to write.
+  //! @param[out] buffer Receives @ref Size bytes.
+  template<typename T> void Encode(const T& message, char* buffer)
+  {
+    Writer writer(buffer);
+    // The writer only ever reads from the message
+    Visit(writer, const_cast<T&>(message));
+  }
+
+  //! Reads a message's payload from a buffer.
+  //! @param[in] buffer Contains @ref Size bytes.
+  //! @param[out] message The message to read into. Reserved fields are
+  //! left untouched.
+  template<typename T> void Decode(const char* buffer, T& message)
+  {
+    Reader reader(buffer);
+    Visit(reader, message);
+  }
+
+  //! Read-only view of a message payload inside a receive buffer. Where the
+  //! packed message structs share the wire layout, the view points straight
+  //! into the buffer; elsewhere it holds a decoded copy. The buffer must hold
+  //! at least @ref Size bytes and outlive the view.
+  template<typename T, bool Native = NATIVE_LAYOUT && !std::is_empty<T>::value>
+  class View;
+
+  template<typename T> class View<T, true>
+  {
+    public:
+      explicit View(const char* payload)
+        : m_message(reinterpret_cast<const T*>(payload)) { }
+      const T& operator*() const { return *m_message; }
+      const T* operator->() const { return m_message; }
+    private:
+      const T* m_message;
+  };
+
+  template<typename T> class View<T, false>
+  {
+    public:
+      explicit View(const char* payload)
+        : m_message()
+      {
+        Decode(payload, m_message);
+      }
+      const T& operator*() const { return m_message; }
+      const T* operator->() const { return &m_message; }
+    private:
+      T m_message;
+  };
+
+  //! Writes a header into a buffer.
+  //! @param[in] h The header to write.
+  //! @param[out] buffer Receives @ref HEADER_SIZE bytes.
+  constexpr void EncodeHeader(const Header& h, char* buffer)
+  {
+    Writer writer(buffer);
+    // Frame
+    writer.Value(static_cast<uint16_t>(h.size));
+    writer.Value(static_cast<uint16_t>(
+      (h.protocol & 0xFFF) |
+      ((h.addressable & 0x1) << 12) |
+      ((h.tagged & 0x1) << 13) |
+      ((h.origin & 0x3) << 14)));
+    writer.Value(static_cast<uint32_t>(h.source));
+    // Frame Address
+    for (size_t i = 0; i < 8; ++i)
+    {
+      writer.Value(static_cast<uint8_t>(h.target[i]));
+    }
+    for (size_t i = 0; i < 6; ++i)
+    {
+      writer.Value(static_cast<uint8_t>(h.site[i]));
+    }
+    writer.Value(static_cast<uint8_t>(
+      (h.res_required & 0x1) |
+      ((h.ack_required & 0x1) << 1)));
+    writer.Value(static_cast<uint8_t>(h.sequence));
+    // Protocol Header
+    writer.Value(static_cast<uint64_t>(h.at_time));
+    writer.Value(static_cast<uint16_t>(h.type));
+    writer.Reserved(2);
+  }
+
+  //! Reads a header from a buffer.
+  //! @param[in] buffer Contains @ref HEADER_SIZE bytes.
+  //! @returns The header that was read.
+  constexpr Header DecodeHeader(const char* buffer)
+  {
+    Header h {};
+    Reader reader(buffer);
+    // Frame
+    uint16_t size = 0;
+    reader.Value(size);
+    h.size = size;
+    uint16_t frame = 0;
+    reader.Value(frame);
+    h.protocol = frame & 0xFFF;
+    h.addressable = (frame >> 12) & 0x1;
+    h.tagged = (frame >> 13) & 0x1;
+    h.origin = (frame >> 14) & 0x3;
+    uint32_t source = 0;
+    reader.Value(source);
+    h.source = source;
+    // Frame Address
+    for (size_t i = 0; i < 8; ++i)
+    {
+      reader.Value(h.target[i]);
+    }
+    for (size_t i = 0; i < 6; ++i)
+    {
+      reader.Value(h.site[i]);
+    }
+    uint8_t flags = 0;
+    reader.Value(flags);
+    h.res_required = flags & 0x1;
+    h.ack_required = (flags >> 1) & 0x1;
+    uint8_t sequence = 0;
+    reader.Value(sequence);
+    h.sequence = sequence;
+    // Protocol Header
+    uint64_t atTime = 0;
+    reader.Value(atTime);
+    h.at_time = atTime;
+    uint16_t type = 0;
+    reader.Value(type);
+    h.type = type;
+    return h;
+  }
+} // namespace wire
+
+} // namespace lifx
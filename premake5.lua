@@ -5,6 +5,12 @@ newoption
 	value = 'path',
 }
 
+newoption
+{
+	trigger = 'io-uring',
+	description = 'build the io_uring transport (Linux 6.0 or newer)',
+}
+
 -- Premake bug on Mac: http://industriousone.com/topic/how-remove-flags-ldflags
 premake.tools.gcc.ldflags.flags._Symbols = nil
 
@@ -23,10 +29,15 @@ end
 function LifxConfig()
 	includedirs { "./include/" }
 	files { "./include/**.h" }
+
+	if _OPTIONS['io-uring'] and os.get() == 'linux' then
+		defines { "LIFX_IO_URING" }
+	end
 	
 	if os.get() ~= "windows" then
 		if os.get() == 'linux' then
-			buildoptions { "-Wno-missing-field-initializers", "-std=c++11" }
+			buildoptions { "-Wno-missing-field-initializers", "-std=c++14" }
+			links { "pthread" }
 		else
 			buildoptions "-std=c++14"
 		end
@@ -94,6 +105,16 @@ solution "lib-lifx"
 		UnitTestConfig()
 		CommonConfig()
 
+	project "lifx-bench"
+		kind "ConsoleApp"
+		targetname "lifx-bench"
+		files { "./bench/*.h", "./bench/*.cpp" }
+		dependson { "lib-lifx" }
+		links { "lib-lifx" }
+
+		LifxConfig()
+		CommonConfig()
+
 	-- gtest project adapted from Jim Garrison's (@garrison) premake4 script
 	-- http://jimgarrison.org/techblog/googletest-premake4.html
 	project "gtest"
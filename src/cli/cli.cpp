@@ -3,14 +3,27 @@
 //! @file CLI tool implementation
 /////
 
+#include "daemon.h"
 #include "lightbulb.h"
 
+#include <lib-lifx/fanout.h>
+#include <lib-lifx/filter.h>
+#include <lib-lifx/groups.h>
+
+#include <chrono>
 #include <iostream>
-#include <regex>
+#include <sstream>
 #include <unordered_map>
 
+#include <signal.h>
 #include <stdio.h>
 
+// Constant definitions
+//! How long the daemon waits for packets before checking for commands
+constexpr long DAEMON_POLL_MILLISECONDS = 5;
+//! How often the daemon looks for new lights & refreshes the known ones
+constexpr auto DAEMON_REFRESH_INTERVAL = std::chrono::seconds(60);
+
 std::unordered_map<std::string, lifx::HSBK> colors =
 {
   { "red", { 62978, 65535, 65535, 3500 }},
@@ -29,14 +42,10 @@ std::unordered_map<std::string, lifx::HSBK> colors =
 
 std::string MacToString(const uint8_t address[8])
 {
-  std::stringstream ss;
-  ss << address[0] << ":"
-    << address[1] << ":"
-    << address[2] << ":"
-    << address[3] << ":"
-    << address[4] << ":"
-    << address[5];
-  return std::move(ss.str());
+  char text[18];
+  snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x",
+    address[0], address[1], address[2], address[3], address[4], address[5]);
+  return text;
 }
 
 uint64_t MacToNum(const uint8_t address[8])
@@ -55,67 +64,72 @@ uint64_t MacToNum(const uint8_t address[8])
 
 std::unordered_map<uint64_t, Lightbulb> g_lightbulbs;
 lifx::LifxClient g_client;
+lifx::FanoutPlanner g_planner;
+lifx::GroupIndex g_groups;
+lifx::GroupIndex g_locations;
+lifx::SelectorIndex g_labels;
 
 template<typename T>
-void HandleCallback(
+void HandleCallback(Lightbulb& bulb,
   std::function<void(Lightbulb& bulb, const T& msg)> func)
 {
-  g_client.RegisterCallback<T>(
-    [func = std::move(func)]
-    (const lifx::Header& header, const T& msg)
+  // Elements of g_lightbulbs keep their address, so each subscription can
+  // hold on to its bulb instead of looking it up on every packet
+  g_client.Subscribe<T>(
+    [&bulb, func = std::move(func)]
+    (const lifx::Header&, const T& msg)
   {
-    auto num = MacToNum(header.target);
-    auto bulb = g_lightbulbs.find(num);
-    if (bulb != g_lightbulbs.end())
-    {
-      func(bulb->second, msg);
-    }
-  });
+    func(bulb, msg);
+  }, bulb.mac_address.data());
 }
 
 bool DoForFilteredLightbulbs(const std::string& filter,
-  std::function<bool(const Lightbulb& bulb)> func)
+  std::function<bool(const Lightbulb& bulb)> func, std::ostream& out)
 {
-  bool ret = false;
-
-  std::regex filterRegex(".*" + filter + ".*");
-  for (auto iter : g_lightbulbs)
+  lifx::DeviceSelector selector(filter);
+  if (!selector.Valid())
   {
-    // If the filter is "all", just run func on every bulb
-    if (filter == "all")
-    {
-      ret = func(iter.second) || ret;
-      continue;
-    }
+    out << "Invalid filter: '" << filter << "'" << std::endl;
+    return false;
+  }
+
+  std::vector<lifx::SelectorIndex::Target> targets;
+  g_labels.Select(selector, g_groups, g_locations, targets);
 
-    // Try to match to various data
-    if (std::regex_match(iter.second.group.label, filterRegex) ||
-      std::regex_match(iter.second.label, filterRegex) ||
-      std::regex_match(iter.second.location.label, filterRegex) ||
-      std::regex_match(MacToString(iter.second.mac_address.data()), filterRegex))
+  bool ret = false;
+  for (const auto& target : targets)
+  {
+    auto bulb = g_lightbulbs.find(MacToNum(target.data()));
+    if (bulb != g_lightbulbs.end())
     {
-      ret = func(iter.second) || ret;
+      ret = func(bulb->second) || ret;
     }
   }
-
   return ret;
 }
 
-void PrintUsage(char** const argv)
+void PrintUsage(char** const argv, std::ostream& out)
 {
-  std::cout << "Usage: " << argv[0] <<
+  out << "Usage: " << argv[0] <<
   " <filter> <command> [arguments, ...]" << std::endl << std::endl;
 }
 
-void PrintHelp(char** const argv)
+void PrintHelp(char** const argv, std::ostream& out)
 {
-  std::cout <<
+  out <<
   "LIFX Command Line Interface tool" << std::endl;
-  PrintUsage(argv);
-  std::cout <<
+  PrintUsage(argv, out);
+  out <<
   "Filter:" << std::endl <<
   "'all' to perform the command on all LAN-discovered lights." << std::endl <<
-  "Alternatively, a full or partial name can be provided." << std::endl << std::endl <<
+  "The name of a group or location selects every light in it." << std::endl <<
+  "Alternatively, a full or partial name or MAC can be provided." << std::endl <<
+  "'kitchen*' selects lights whose name starts with 'kitchen', and" << std::endl <<
+  "'*lamp?' matches the whole name with wildcards." << std::endl <<
+  "'=name' selects lights with exactly that name." << std::endl <<
+  "'group:name', 'location:name' and 'mac:d073d5' only look at one of these." << std::endl <<
+  "'re:expression' selects lights a regular expression matches the name of." << std::endl <<
+  "Filters ignore case." << std::endl << std::endl <<
   "Commands:" << std::endl <<
   "help:   Display usage informaiton." << std::endl <<
   "off:    Turns off a light." << std::endl <<
@@ -125,14 +139,18 @@ void PrintHelp(char** const argv)
   "        1st argument is the name of the color." << std::endl <<
   "        2nd argument is how many miliseconds it should " <<
   "take to tranition to the new color." << std::endl <<
+  "daemon: Keeps running in the foreground, so that later commands are" << std::endl <<
+  "        handed to it instead of discovering the lights again." << std::endl <<
+  "        It listens on $LIFX_CLI_SOCKET, or lifx-cli.sock in" << std::endl <<
+  "        $XDG_RUNTIME_DIR, or /tmp/lifx-cli-<uid>.sock." << std::endl <<
   std::endl;
 }
 
-void RunCommands(int argc, char** argv)
+void RunCommands(int argc, char** argv, std::ostream& out)
 {
   if (argc < 2)
   {
-    PrintUsage(argv);
+    PrintUsage(argv, out);
     return;
   }
 
@@ -159,8 +177,8 @@ void RunCommands(int argc, char** argv)
     // No filter, command only
     command = argv[1];
   }
-  // Convert the filter to all lowercase
-  std::transform(filter.begin(), filter.end(), filter.begin(), ::tolower);
+  // Filters ignore case themselves, lowercasing them would break escapes in
+  // regular expressions
   // Convert the command to all lowercase
   std::transform(command.begin(), command.end(), command.begin(), ::tolower);
   // Convert all arguments to all lowercase
@@ -175,34 +193,30 @@ void RunCommands(int argc, char** argv)
       command == "-help" ||
       command == "--help")
   {
-    PrintHelp(argv);
+    PrintHelp(argv, out);
     return;
   }
 
+  // Commands that send every bulb the same message are collected first,
+  // so that they can go out as a single broadcast when the filter
+  // matches every bulb
+  std::vector<std::array<uint8_t, 8>> targets;
+  lifx::message::light::SetColor colorMsg{};
+  bool colorFound = false;
+
   // Find all the lightbulbs based on the filter
   DoForFilteredLightbulbs(filter,
-    [&command, &arguments, &argv](const Lightbulb& bulb) -> bool
+    [&command, &arguments, &targets, &colorMsg, &colorFound, &out]
+    (const Lightbulb& bulb) -> bool
   {
-    if (command == "off")
+    if (command == "off" || command == "on")
     {
-      g_client.Send<lifx::message::device::SetPower>(bulb.mac_address.data());
-      // unknown or v1 products sometimes have issues setting power, so
-      // we have to send it twice
-      g_client.Send<lifx::message::device::SetPower>(bulb.mac_address.data());
-    }
-
-    if (command == "on")
-    {
-      lifx::message::device::SetPower powerMsg{ 65535 };
-      g_client.Send<lifx::message::device::SetPower>(powerMsg, bulb.mac_address.data());
-      // unknown or v1 products sometimes have issues setting power, so
-      // we have to send it twice
-      g_client.Send<lifx::message::device::SetPower>(powerMsg, bulb.mac_address.data());
+      targets.push_back(bulb.mac_address);
     }
 
     if (command == "status")
     {
-      std::cout << bulb;
+      out << bulb;
     }
 
     if (command == "color")
@@ -214,24 +228,41 @@ void RunCommands(int argc, char** argv)
         auto color = colors.find(arguments[0]);
         if (color == colors.end())
         {
-          std::cerr << "Unknown color specified: '" << arguments[0] << "'" << std::endl;
+          out << "Unknown color specified: '" << arguments[0] << "'" << std::endl;
         } else {
           // By default, immediately set the color
-          lifx::message::light::SetColor colorMsg{color->second, 0};
+          colorMsg = {color->second, 0};
           // Optional second argument is for the number of milliseconds to change the color over
           if (arguments.size() > 1)
           {
             colorMsg.duration = std::stoul(arguments[1]);
           }
-          g_client.Send<lifx::message::light::SetColor>(colorMsg, bulb.mac_address.data());
+          colorFound = true;
+          targets.push_back(bulb.mac_address);
         }
       } else {
-        std::cerr << "You must specify a color." << std::endl;
+        out << "You must specify a color." << std::endl;
       }
     }
 
     return true;
-  });
+  }, out);
+
+  if (!targets.empty())
+  {
+    if (command == "off" || command == "on")
+    {
+      lifx::message::device::SetPower powerMsg{
+        static_cast<uint16_t>(command == "on" ? 65535 : 0) };
+      // unknown or v1 products sometimes have issues setting power, so
+      // we have to send it twice
+      g_client.Apply(g_planner.Plan(targets, powerMsg, 2));
+    }
+    else if (colorFound)
+    {
+      g_client.Apply(g_planner.Plan(targets, colorMsg));
+    }
+  }
 
   while (g_client.WaitingToSend())
   {
@@ -239,66 +270,69 @@ void RunCommands(int argc, char** argv)
   }
 }
 
-int main(int argc, char** argv)
+void StartDiscovery()
 {
-  // Check if we are fast-tracking to the help command
-  if (argc > 1)
-  {
-    if (strcmp(argv[1], "help") == 0 ||
-        strcmp(argv[1], "--help") == 0 ||
-        strcmp(argv[1], "-help") == 0)
-    {
-      PrintHelp(argv);
-      return 0;
-    }
-  } else if (argc == 1) {
-    PrintUsage(argv);
-    return 0;
-  }
-
   g_client.RegisterCallback<lifx::message::device::StateService>(
     [](const lifx::Header& header, const lifx::message::device::StateService& msg)
   {
-    if (msg.service == lifx::SERVICE_UDP)
+    // Bulbs answer every GetService, so only handle each of them once
+    if (msg.service == lifx::SERVICE_UDP &&
+      g_lightbulbs.count(MacToNum(header.target)) == 0)
     {
-      Lightbulb bulb {};
+      auto& bulb = g_lightbulbs[MacToNum(header.target)];
       for (auto i : {0, 1, 2, 3, 4, 5, 6, 7})
       {
         bulb.mac_address[i] = header.target[i];
       }
 
-      g_lightbulbs[MacToNum(header.target)] = bulb;
+      g_planner.AddDevice(header.target);
+      // Selectable by its MAC until its label is known
+      g_labels.Update(header.target, "");
 
-      HandleCallback<lifx::message::device::StateLocation>(
+      HandleCallback<lifx::message::device::StateLocation>(bulb,
         [](Lightbulb& bulb, const lifx::message::device::StateLocation& msg)
       {
         bulb.location = { msg.label, msg.updated_at };
+        g_locations.Update(bulb.mac_address.data(), msg);
       });
 
-      HandleCallback<lifx::message::device::StateVersion>(
+      HandleCallback<lifx::message::device::StateVersion>(bulb,
         [](Lightbulb& bulb, const lifx::message::device::StateVersion& msg)
       {
         bulb.version = { msg.vendor, msg.product, msg.version };
 
-        g_client.Send<lifx::message::device::GetLocation>(bulb.mac_address.data());
+        if (bulb.location.updated_at == 0)
+        {
+          g_client.Send<lifx::message::device::GetLocation>(bulb.mac_address.data());
+        }
       });
 
-      HandleCallback<lifx::message::device::StateGroup>(
+      HandleCallback<lifx::message::device::StateGroup>(bulb,
         [](Lightbulb& bulb, const lifx::message::device::StateGroup& msg)
       {
         bulb.group = { msg.label, msg.updated_at };
+        g_groups.Update(bulb.mac_address.data(), msg);
 
-        g_client.Send<lifx::message::device::GetVersion>(bulb.mac_address.data());
+        if (bulb.version.product == 0)
+        {
+          g_client.Send<lifx::message::device::GetVersion>(bulb.mac_address.data());
+        }
       });
 
-      HandleCallback<lifx::message::light::State>(
+      HandleCallback<lifx::message::light::State>(bulb,
         [](Lightbulb& bulb, const lifx::message::light::State& msg)
       {
         bulb.power = msg.power > 0;
         bulb.label = msg.label;
         bulb.color = msg.color;
+        g_labels.Update(bulb.mac_address.data(), msg.label);
 
-        g_client.Send<lifx::message::device::GetGroup>(bulb.mac_address.data());
+        // Only the first state starts the chain of queries, the daemon's
+        // refreshes would otherwise queue three of them for every light
+        if (bulb.group.updated_at == 0)
+        {
+          g_client.Send<lifx::message::device::GetGroup>(bulb.mac_address.data());
+        }
       });
       
       g_client.Send<lifx::message::light::Get>(bulb.mac_address.data());
@@ -306,6 +340,107 @@ int main(int argc, char** argv)
   });
 
   g_client.Broadcast<lifx::message::device::GetService>({});
+}
+
+volatile sig_atomic_t g_stopDaemon = 0;
+
+//! Runs one forwarded command line.
+std::string RunForwardedCommands(const std::vector<std::string>& arguments)
+{
+  std::vector<char*> argv;
+  for (const auto& argument : arguments)
+  {
+    argv.push_back(const_cast<char*>(argument.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  std::ostringstream out;
+  // A bad argument must only fail its own command, not the daemon
+  try
+  {
+    RunCommands(static_cast<int>(arguments.size()), argv.data(), out);
+  }
+  catch (const std::exception& e)
+  {
+    out << "Invalid arguments: " << e.what() << std::endl;
+  }
+
+  // Lets a following status show what the command changed
+  g_client.Broadcast<lifx::message::light::Get>({});
+  return out.str();
+}
+
+int RunDaemon()
+{
+  auto path = DaemonSocketPath();
+  DaemonServer server;
+  std::string error;
+  if (!server.Listen(path, error))
+  {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+
+  signal(SIGINT, [](int) { g_stopDaemon = 1; });
+  signal(SIGTERM, [](int) { g_stopDaemon = 1; });
+  std::cout << "Listening on " << path << std::endl;
+
+  // Commands are served while discovery goes on, lights that answer late
+  // are picked up the same way as ones that are plugged in later
+  StartDiscovery();
+  auto refreshed = std::chrono::steady_clock::now();
+  while (!g_stopDaemon)
+  {
+    g_client.RunOnce(0, DAEMON_POLL_MILLISECONDS);
+    server.Poll(RunForwardedCommands);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - refreshed >= DAEMON_REFRESH_INTERVAL)
+    {
+      refreshed = now;
+      g_client.Broadcast<lifx::message::device::GetService>({});
+      g_client.Broadcast<lifx::message::light::Get>({});
+      g_client.Broadcast<lifx::message::device::GetGroup>({});
+      g_client.Broadcast<lifx::message::device::GetLocation>({});
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  // Check if we are fast-tracking to the help command
+  if (argc > 1)
+  {
+    if (strcmp(argv[1], "help") == 0 ||
+        strcmp(argv[1], "--help") == 0 ||
+        strcmp(argv[1], "-help") == 0)
+    {
+      PrintHelp(argv, std::cout);
+      return 0;
+    }
+  } else if (argc == 1) {
+    PrintUsage(argv, std::cout);
+    return 0;
+  }
+
+#ifndef _WIN32
+  // A daemon or client that goes away mid-reply is only an error result
+  signal(SIGPIPE, SIG_IGN);
+#endif
+  if (argc == 2 && strcmp(argv[1], "daemon") == 0)
+  {
+    return RunDaemon();
+  }
+
+  // A running daemon already knows every light
+  if (ForwardToDaemon(DaemonSocketPath(),
+    std::vector<std::string>(argv, argv + argc), std::cout))
+  {
+    return 0;
+  }
+
+  StartDiscovery();
   unsigned int num_identified = 0;
   for (;;)
   {
@@ -325,7 +460,7 @@ int main(int argc, char** argv)
 
       if (num_identified == g_lightbulbs.size())
       {
-        RunCommands(argc, argv);
+        RunCommands(argc, argv, std::cout);
         break;
       }
     }
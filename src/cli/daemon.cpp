@@ -0,0 +1,278 @@
+/////
+// daemon.cpp
+//! @file Command channel between lifx-cli and a running daemon
+/////
+
+#include "daemon.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Not every system has it, SIGPIPE is ignored there instead
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace
+{
+  //! Fills in the address of a socket file.
+  //! @returns false if the path is too long for one.
+  bool MakeAddress(const std::string& path, sockaddr_un& address)
+  {
+    address = { };
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+      return false;
+
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+  }
+
+  //! Connects to a socket file.
+  //! @returns The socket, or -1 if nothing listens on it.
+  int Connect(const std::string& path)
+  {
+    sockaddr_un address;
+    if (!MakeAddress(path, address))
+      return -1;
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+      return -1;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+    {
+      close(sock);
+      return -1;
+    }
+    return sock;
+  }
+
+  bool WriteAll(int sock, const char* data, size_t length)
+  {
+    while (length > 0)
+    {
+      auto written = send(sock, data, length, MSG_NOSIGNAL);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        return false;
+      data += written;
+      length -= static_cast<size_t>(written);
+    }
+    return true;
+  }
+
+  //! Reads until the other end shuts down its side.
+  //! @returns false if it sent more than @p limit bytes or failed.
+  bool ReadAll(int sock, std::string& data, size_t limit)
+  {
+    char buffer[4096];
+    for (;;)
+    {
+      auto count = recv(sock, buffer, sizeof(buffer), 0);
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count < 0)
+        return false;
+      if (count == 0)
+        return true;
+      data.append(buffer, static_cast<size_t>(count));
+      if (data.size() > limit)
+        return false;
+    }
+  }
+}
+
+std::string DaemonSocketPath()
+{
+  const char* path = getenv("LIFX_CLI_SOCKET");
+  if (path != nullptr && *path != '\0')
+    return path;
+
+  const char* runtime = getenv("XDG_RUNTIME_DIR");
+  if (runtime != nullptr && *runtime != '\0')
+    return std::string(runtime) + "/lifx-cli.sock";
+
+  return "/tmp/lifx-cli-" + std::to_string(getuid()) + ".sock";
+}
+
+bool ForwardToDaemon(const std::string& path,
+  const std::vector<std::string>& arguments, std::ostream& out)
+{
+  // Anyone can create the socket in /tmp before the daemon does, so only
+  // one this user owns is trusted with commands
+  struct stat existing;
+  if (lstat(path.c_str(), &existing) != 0 || !S_ISSOCK(existing.st_mode) ||
+    existing.st_uid != getuid())
+    return false;
+
+  int sock = Connect(path);
+  if (sock < 0)
+    return false;
+
+  std::string request;
+  for (const auto& argument : arguments)
+  {
+    request.append(argument.c_str(), argument.size() + 1);
+  }
+  std::string reply;
+  bool ok = WriteAll(sock, request.data(), request.size()) &&
+    shutdown(sock, SHUT_WR) == 0 && ReadAll(sock, reply, static_cast<size_t>(-1));
+  close(sock);
+
+  // A daemon that went away mid-command may have run it, so it isn't run
+  // again locally
+  out << reply;
+  if (!ok)
+  {
+    out << "Lost the connection to the daemon at " << path << std::endl;
+  }
+  return true;
+}
+
+DaemonServer::DaemonServer()
+  : m_socket(-1)
+{
+}
+
+DaemonServer::~DaemonServer()
+{
+  if (m_socket >= 0)
+  {
+    close(m_socket);
+    unlink(m_path.c_str());
+  }
+}
+
+bool DaemonServer::Listen(const std::string& path, std::string& error)
+{
+  sockaddr_un address;
+  if (!MakeAddress(path, address))
+  {
+    error = "Socket path is too long: " + path;
+    return false;
+  }
+
+  // A socket nobody listens on is left over from a daemon that was
+  // killed, anything else at the path isn't ours to remove
+  struct stat existing;
+  if (lstat(path.c_str(), &existing) == 0)
+  {
+    if (!S_ISSOCK(existing.st_mode))
+    {
+      error = "Not a socket, refusing to replace it: " + path;
+      return false;
+    }
+    int running = Connect(path);
+    if (running >= 0)
+    {
+      close(running);
+      error = "A daemon is already listening on " + path;
+      return false;
+    }
+    unlink(path.c_str());
+  }
+
+  m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (m_socket < 0)
+  {
+    error = strerror(errno);
+    return false;
+  }
+
+  // Anyone who can connect can switch the lights, so only this user may
+  auto mask = umask(S_IRWXG | S_IRWXO);
+  bool bound = bind(m_socket, reinterpret_cast<sockaddr*>(&address),
+    sizeof(address)) == 0;
+  umask(mask);
+  if (!bound || listen(m_socket, SOMAXCONN) != 0 ||
+    fcntl(m_socket, F_SETFL, fcntl(m_socket, F_GETFL) | O_NONBLOCK) != 0)
+  {
+    error = strerror(errno);
+    close(m_socket);
+    m_socket = -1;
+    return false;
+  }
+
+  m_path = path;
+  return true;
+}
+
+void DaemonServer::Poll(const Handler& handler)
+{
+  for (;;)
+  {
+    int client = accept(m_socket, nullptr, nullptr);
+    if (client < 0)
+      return;
+
+    // Accepted sockets don't inherit O_NONBLOCK everywhere, and a client
+    // that stalls mustn't hold up the lights for long
+    fcntl(client, F_SETFL, fcntl(client, F_GETFL) & ~O_NONBLOCK);
+    timeval timeout = { DAEMON_CLIENT_TIMEOUT_MILLISECONDS / 1000,
+      (DAEMON_CLIENT_TIMEOUT_MILLISECONDS % 1000) * 1000 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    if (ReadAll(client, request, DAEMON_MAX_REQUEST) && !request.empty())
+    {
+      std::vector<std::string> arguments;
+      for (size_t start = 0; start < request.size();)
+      {
+        auto end = request.find('\0', start);
+        if (end == std::string::npos)
+        {
+          end = request.size();
+        }
+        arguments.emplace_back(request, start, end - start);
+        start = end + 1;
+      }
+      auto reply = handler(arguments);
+      WriteAll(client, reply.data(), reply.size());
+    }
+    close(client);
+  }
+}
+
+#else
+
+std::string DaemonSocketPath()
+{
+  return std::string();
+}
+
+bool ForwardToDaemon(const std::string&, const std::vector<std::string>&,
+  std::ostream&)
+{
+  return false;
+}
+
+DaemonServer::DaemonServer()
+  : m_socket(-1)
+{
+}
+
+DaemonServer::~DaemonServer()
+{
+}
+
+bool DaemonServer::Listen(const std::string&, std::string& error)
+{
+  error = "The daemon needs Unix domain sockets, which this build doesn't use";
+  return false;
+}
+
+void DaemonServer::Poll(const Handler&)
+{
+}
+
+#endif
@@ -0,0 +1,57 @@
+/////
+// daemon.h
+//! @file Command channel between lifx-cli and a running daemon
+/////
+
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Constant definitions
+//! Longest command a daemon accepts, in bytes
+constexpr size_t DAEMON_MAX_REQUEST = 4096;
+//! How long a daemon waits on a connected client before giving up on it
+constexpr long DAEMON_CLIENT_TIMEOUT_MILLISECONDS = 1000;
+
+//! Gets the path of the daemon's socket: $LIFX_CLI_SOCKET, or lifx-cli.sock
+//! in $XDG_RUNTIME_DIR, or a per-user file in /tmp.
+std::string DaemonSocketPath();
+
+//! Runs a command in a daemon, if one is listening, and copies its output.
+//! @param[in] path The daemon's socket.
+//! @param[in] arguments The command line, starting with the program name.
+//! @param[out] out Gets the output of the command.
+//! @returns false if no daemon is listening.
+bool ForwardToDaemon(const std::string& path,
+  const std::vector<std::string>& arguments, std::ostream& out);
+
+//! Listens for commands from other lifx-cli processes on a Unix domain
+//! socket. Each connection carries one command line, as NUL-terminated
+//! arguments up to the end of the stream, and gets the output back.
+class DaemonServer
+{
+  public:
+    //! Runs a command line and gets its output.
+    using Handler = std::function<std::string(
+      const std::vector<std::string>& arguments)>;
+
+    DaemonServer();
+    //! Closes the socket and removes its file.
+    ~DaemonServer();
+
+    //! Creates the socket, only accessible to the current user.
+    //! @param[in] path Where to create it.
+    //! @param[out] error Gets why it failed.
+    //! @returns false if it can't be created, or another daemon is
+    //! already listening on it.
+    bool Listen(const std::string& path, std::string& error);
+    //! Runs every command that is waiting, without blocking if there are
+    //! none.
+    void Poll(const Handler& handler);
+  protected:
+    int m_socket;
+    std::string m_path;
+};
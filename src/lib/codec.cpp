@@ -0,0 +1,20 @@
+/////
+// codec.cpp
+//! @file Stateless packet encoding & decoding implementation
+/////
+
+#include <lib-lifx/codec.h>
+
+namespace lifx
+{
+  bool DecodeHeader(const char* data, size_t length, Header& header)
+  {
+    if (data == nullptr || length < LIFX_HEADER_SIZE)
+      return false;
+
+    header = wire::DecodeHeader(data);
+    return header.protocol == LIFX_PROTOCOL && header.addressable == 1 &&
+      header.size >= LIFX_HEADER_SIZE && header.size <= length;
+  }
+
+} // namespace lifx
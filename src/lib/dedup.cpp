@@ -0,0 +1,99 @@
+/////
+// dedup.cpp
+//! @file Fixed-size cache of recently received packets implementation
+/////
+
+#include <lib-lifx/dedup.h>
+#include <lib-lifx/lifx.h>
+
+namespace
+{
+  static_assert((lifx::DUPLICATE_CACHE_SIZE & (lifx::DUPLICATE_CACHE_SIZE - 1)) == 0,
+    "The duplicate cache size must be a power of two");
+  static_assert(lifx::DUPLICATE_CACHE_SIZE > UINT8_MAX,
+    "The duplicate cache must hold every sequence of a device");
+
+  // Fibonacci hashing spreads keys that only differ in a few bits, like
+  // devices from the same vendor range, across the whole table
+  constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+  // FNV-1a, payloads are short and only need telling apart
+  constexpr uint64_t FNV_OFFSET = 0xCBF29CE484222325ull;
+  constexpr uint64_t FNV_PRIME = 0x100000001B3ull;
+}
+
+namespace lifx
+{
+  DuplicateFilter::DuplicateFilter(Clock::duration expiry)
+    : m_entries()
+    , m_expiry(expiry)
+  {
+  }
+
+  bool DuplicateFilter::Contains(const Header& header, Clock::time_point now,
+    uint64_t payload) const
+  {
+    const auto& entry = m_entries[Slot(header)];
+    return Enabled() && Matches(entry, header, payload) &&
+      now - entry.time < m_expiry;
+  }
+
+  void DuplicateFilter::Record(const Header& header, Clock::time_point now,
+    uint64_t payload)
+  {
+    if (!Enabled())
+      return;
+
+    auto& entry = m_entries[Slot(header)];
+    entry.target = TargetKey(header.target);
+    entry.payload = payload;
+    entry.source = header.source;
+    entry.type = header.type;
+    entry.sequence = header.sequence;
+    entry.used = true;
+    entry.time = now;
+  }
+
+  uint64_t DuplicateFilter::PayloadHash(const char* data, size_t length)
+  {
+    uint64_t hash = FNV_OFFSET;
+    for (size_t i = 0; i < length; ++i)
+    {
+      hash = (hash ^ static_cast<uint8_t>(data[i])) * FNV_PRIME;
+    }
+    return hash;
+  }
+
+  void DuplicateFilter::SetExpiry(Clock::duration expiry)
+  {
+    m_expiry = expiry;
+    Clear();
+  }
+
+  void DuplicateFilter::Clear()
+  {
+    m_entries.fill(Entry());
+  }
+
+  size_t DuplicateFilter::Slot(const Header& header)
+  {
+    // The sequence is added after hashing so that the sequences of a
+    // single device & type never collide with each other. The packets of a
+    // reply in several parts share a slot, and as copies of a packet arrive
+    // together, only remembering the latest part is enough
+    auto key = TargetKey(header.target) ^
+      (static_cast<uint64_t>(header.source) << 16) ^ header.type;
+    return static_cast<size_t>(((key * HASH_MULTIPLIER) >> 32) +
+      header.sequence) & (DUPLICATE_CACHE_SIZE - 1);
+  }
+
+  bool DuplicateFilter::Matches(const Entry& entry, const Header& header,
+    uint64_t payload)
+  {
+    return entry.used && entry.target == TargetKey(header.target) &&
+      entry.payload == payload &&
+      entry.source == header.source && entry.type == header.type &&
+      entry.sequence == header.sequence;
+  }
+
+} // namespace lifx
@@ -0,0 +1,174 @@
+/////
+// devices.cpp
+//! @file Registry of known devices implementation
+/////
+
+#include <lib-lifx/devices.h>
+#include <lib-lifx/lifx.h>
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace
+{
+  constexpr unsigned MIN_SLOTS_BITS = 4;
+  constexpr size_t MIN_SLOTS = size_t(1) << MIN_SLOTS_BITS;
+
+  // Fibonacci hashing, MACs from one vendor only differ in a few bytes
+  constexpr uint64_t HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull;
+}
+
+namespace lifx
+{
+  DeviceRegistry::DeviceRegistry(size_t capacity)
+    : m_shift(64)
+  {
+    Reserve(capacity);
+  }
+
+  void DeviceRegistry::Reserve(size_t capacity)
+  {
+    m_macs.reserve(capacity);
+    m_colors.reserve(capacity);
+    m_powers.reserve(capacity);
+    m_labels.reserve(capacity);
+    if (m_slots.empty() || capacity * 2 > m_slots.size())
+    {
+      Rehash(capacity);
+    }
+  }
+
+  DeviceRegistry::Index DeviceRegistry::Add(const uint8_t target[8])
+  {
+    auto mac = TargetKey(target);
+    auto slot = Slot(mac);
+    if (m_slots[slot] != INVALID_DEVICE)
+      return m_slots[slot];
+
+    auto index = static_cast<Index>(m_macs.size());
+    m_macs.push_back(mac);
+    m_colors.push_back({ });
+    m_powers.push_back(0);
+    m_labels.push_back({ });
+    if (m_macs.size() * 2 > m_slots.size())
+    {
+      Rehash(m_macs.size());
+    }
+    else
+    {
+      m_slots[slot] = index;
+    }
+    return index;
+  }
+
+  DeviceRegistry::Index DeviceRegistry::Find(const uint8_t target[8]) const
+  {
+    return Find(TargetKey(target));
+  }
+
+  DeviceRegistry::Index DeviceRegistry::Find(uint64_t mac) const
+  {
+    return m_slots[Slot(mac)];
+  }
+
+  bool DeviceRegistry::Remove(const uint8_t target[8])
+  {
+    auto slot = Slot(TargetKey(target));
+    auto index = m_slots[slot];
+    if (index == INVALID_DEVICE)
+      return false;
+
+    // Shift back the entries that probed past the emptied slot, so every
+    // probe still reaches its device without tombstones
+    auto mask = m_slots.size() - 1;
+    m_slots[slot] = INVALID_DEVICE;
+    for (auto next = (slot + 1) & mask; m_slots[next] != INVALID_DEVICE;
+      next = (next + 1) & mask)
+    {
+      auto home = Home(m_macs[m_slots[next]]);
+      // Moves only if its home isn't cyclically within (slot, next]
+      if (((next - home) & mask) >= ((next - slot) & mask))
+      {
+        m_slots[slot] = m_slots[next];
+        m_slots[next] = INVALID_DEVICE;
+        slot = next;
+      }
+    }
+
+    // Keep the arrays dense by moving the last device into the gap
+    auto last = static_cast<Index>(m_macs.size() - 1);
+    if (index != last)
+    {
+      m_slots[Slot(m_macs[last])] = index;
+      m_macs[index] = m_macs[last];
+      m_colors[index] = m_colors[last];
+      m_powers[index] = m_powers[last];
+      m_labels[index] = m_labels[last];
+    }
+    m_macs.pop_back();
+    m_colors.pop_back();
+    m_powers.pop_back();
+    m_labels.pop_back();
+    return true;
+  }
+
+  void DeviceRegistry::Clear()
+  {
+    m_macs.clear();
+    m_colors.clear();
+    m_powers.clear();
+    m_labels.clear();
+    std::fill(m_slots.begin(), m_slots.end(), INVALID_DEVICE);
+  }
+
+  void DeviceRegistry::Update(Index index, const message::light::State& state)
+  {
+    m_colors[index] = state.color;
+    m_powers[index] = state.power;
+    SetLabel(index, state.label);
+  }
+
+  void DeviceRegistry::SetLabel(Index index, const char label[DEVICE_LABEL_SIZE])
+  {
+    // Anything after a terminator is zeroed, so labels compare as arrays
+    auto& slot = m_labels[index];
+    auto length = strnlen(label, slot.size());
+    memcpy(slot.data(), label, length);
+    memset(slot.data() + length, 0, slot.size() - length);
+  }
+
+  size_t DeviceRegistry::Home(uint64_t mac) const
+  {
+    // Only the top bits of the product depend on every byte of the MAC
+    return static_cast<size_t>((mac * HASH_MULTIPLIER) >> m_shift);
+  }
+
+  size_t DeviceRegistry::Slot(uint64_t mac) const
+  {
+    auto mask = m_slots.size() - 1;
+    auto slot = Home(mac);
+    while (m_slots[slot] != INVALID_DEVICE && m_macs[m_slots[slot]] != mac)
+    {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void DeviceRegistry::Rehash(size_t capacity)
+  {
+    auto slots = MIN_SLOTS;
+    m_shift = 64 - MIN_SLOTS_BITS;
+    while (slots < capacity * 2)
+    {
+      slots *= 2;
+      --m_shift;
+    }
+    m_slots.assign(slots, INVALID_DEVICE);
+    for (Index index = 0; index < m_macs.size(); ++index)
+    {
+      m_slots[Slot(m_macs[index])] = index;
+    }
+  }
+
+} // namespace lifx
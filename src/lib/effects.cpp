@@ -0,0 +1,322 @@
+/////
+// effects.cpp
+//! @file Keyframe effects engine implementation
+/////
+
+#include <lib-lifx/effects.h>
+#include <lib-lifx/waveform.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  bool SameColor(const lifx::HSBK& a, const lifx::HSBK& b)
+  {
+    return memcmp(&a, &b, sizeof(lifx::HSBK)) == 0;
+  }
+
+  float Ease(float t, lifx::Easing easing)
+  {
+    switch (easing)
+    {
+      case lifx::Easing::EASE_IN:
+        return t * t;
+      case lifx::Easing::EASE_OUT:
+        return 1.0f - (1.0f - t) * (1.0f - t);
+      case lifx::Easing::EASE_IN_OUT:
+        return (t < 0.5f) ? (2.0f * t * t) : (1.0f - 2.0f * (1.0f - t) * (1.0f - t));
+      case lifx::Easing::STEP:
+        return (t < 1.0f) ? 0.0f : 1.0f;
+      case lifx::Easing::LINEAR:
+      default:
+        return t;
+    }
+  }
+
+  uint16_t Lerp(uint16_t a, uint16_t b, float t)
+  {
+    return static_cast<uint16_t>(std::lround(a + (static_cast<float>(b) - a) * t));
+  }
+
+  lifx::HSBK Lerp(const lifx::HSBK& a, const lifx::HSBK& b, float t)
+  {
+    // Hue wraps around, so take the shortest way around the color wheel
+    auto hueDelta = static_cast<int16_t>(static_cast<uint16_t>(b.hue - a.hue));
+    lifx::HSBK color = { };
+    color.hue = static_cast<uint16_t>(a.hue + std::lround(hueDelta * t));
+    color.saturation = Lerp(a.saturation, b.saturation, t);
+    color.brightness = Lerp(a.brightness, b.brightness, t);
+    color.kelvin = Lerp(a.kelvin, b.kelvin, t);
+    return color;
+  }
+
+  lifx::EffectStep ColorStep(uint32_t time, const lifx::HSBK& color,
+    uint32_t duration)
+  {
+    lifx::EffectStep step = { };
+    step.time = time;
+    step.waveform = false;
+    step.color.color = color;
+    step.color.duration = duration;
+    return step;
+  }
+
+  lifx::EffectStep WaveStep(uint32_t time,
+    const lifx::message::light::SetWaveform& wave)
+  {
+    lifx::EffectStep step = { };
+    step.time = time;
+    step.waveform = true;
+    step.wave = wave;
+    return step;
+  }
+
+  //! Checks if an effect is a shape the device can play by itself.
+  //! @param[out] wave The waveform message that plays the effect.
+  //! @param[out] delay How long after the start the waveform should be sent.
+  bool MatchWaveform(const lifx::Effect& effect,
+    lifx::message::light::SetWaveform& wave, uint32_t& delay)
+  {
+    const auto& k = effect.keyframes;
+    if (effect.repeat == 0 || k.empty() || k.front().time != 0)
+      return false;
+
+    auto cycles = static_cast<float>(effect.repeat);
+    delay = 0;
+
+    // A single ramp that repeats is a saw tooth
+    if (k.size() == 2 && effect.repeat > 1 &&
+      k[1].easing == lifx::Easing::LINEAR && k[1].time > 0)
+    {
+      wave = lifx::waveform::Make(lifx::Waveform::SAW, k[1].color, k[1].time,
+        cycles);
+      return true;
+    }
+
+    // Everything else goes out to a peak and back to where it started
+    if (k.size() != 3 || !SameColor(k[0].color, k[2].color) ||
+      k[2].time == 0 || k[1].time > k[2].time)
+    {
+      return false;
+    }
+
+    auto period = k[2].time;
+    auto peak = k[1].time;
+    bool symmetric = (2 * peak >= period ? 2 * peak - period : period - 2 * peak) <= 1;
+
+    if (symmetric &&
+      k[1].easing == lifx::Easing::LINEAR &&
+      k[2].easing == lifx::Easing::LINEAR)
+    {
+      wave = lifx::waveform::Make(lifx::Waveform::TRIANGLE, k[1].color, period,
+        cycles);
+      return true;
+    }
+
+    if (symmetric &&
+      k[1].easing == lifx::Easing::EASE_IN_OUT &&
+      k[2].easing == lifx::Easing::EASE_IN_OUT)
+    {
+      wave = lifx::waveform::Breathe(k[1].color, period, cycles);
+      return true;
+    }
+
+    if (symmetric &&
+      k[1].easing == lifx::Easing::EASE_OUT &&
+      k[2].easing == lifx::Easing::EASE_IN)
+    {
+      wave = lifx::waveform::Make(lifx::Waveform::HALF_SINE, k[1].color,
+        period, cycles);
+      return true;
+    }
+
+    if (peak > 0 && peak < period &&
+      k[1].easing == lifx::Easing::STEP &&
+      k[2].easing == lifx::Easing::STEP)
+    {
+      // A device pulse starts on the new color, so start it once the
+      // effect would first jump and use the time spent there as the duty cycle
+      wave = lifx::waveform::Pulse(k[1].color, period, cycles,
+        static_cast<float>(period - peak) / period);
+      delay = peak;
+      return true;
+    }
+
+    return false;
+  }
+}
+
+namespace lifx
+{
+  EffectEngine::EffectEngine(LifxClient& client,
+    std::chrono::milliseconds frameInterval)
+    : m_client(client)
+    , m_frameInterval(std::move(frameInterval))
+  {
+  }
+
+  std::vector<EffectStep> EffectEngine::Plan(const Effect& effect,
+    uint32_t frameInterval)
+  {
+    std::vector<EffectStep> steps;
+    const auto& k = effect.keyframes;
+    if (k.empty() || effect.repeat == 0)
+      return steps;
+
+    // Cheapest: the device runs the whole effect on its own
+    message::light::SetWaveform wave;
+    uint32_t delay = 0;
+    if (MatchWaveform(effect, wave, delay))
+    {
+      steps.push_back(ColorStep(0, k.front().color, 0));
+      steps.push_back(WaveStep(delay, wave));
+      return steps;
+    }
+
+    frameInterval = std::max<uint32_t>(frameInterval, 1);
+    uint32_t period = k.back().time;
+    for (uint32_t r = 0; r < effect.repeat; ++r)
+    {
+      uint32_t base = r * period;
+      if (r == 0 || !SameColor(k.back().color, k.front().color))
+      {
+        steps.push_back(ColorStep(base + k.front().time, k.front().color, 0));
+      }
+
+      for (size_t i = 1; i < k.size(); ++i)
+      {
+        const auto& from = k[i - 1];
+        const auto& to = k[i];
+        if (SameColor(from.color, to.color))
+          continue;
+
+        uint32_t start = base + from.time;
+        uint32_t length = (to.time > from.time) ? (to.time - from.time) : 0;
+
+        switch (to.easing)
+        {
+          case Easing::LINEAR:
+            // The device interpolates linearly by itself
+            steps.push_back(ColorStep(start, to.color, length));
+            break;
+          case Easing::STEP:
+            steps.push_back(ColorStep(base + to.time, to.color, 0));
+            break;
+          default:
+          {
+            // Approximate the curve with linear pieces
+            uint32_t frames = std::max<uint32_t>(1,
+              (length + frameInterval - 1) / frameInterval);
+            for (uint32_t f = 1; f <= frames; ++f)
+            {
+              uint32_t t0 = static_cast<uint32_t>(
+                static_cast<uint64_t>(length) * (f - 1) / frames);
+              uint32_t t1 = static_cast<uint32_t>(
+                static_cast<uint64_t>(length) * f / frames);
+              auto color = Lerp(from.color, to.color,
+                Ease(static_cast<float>(f) / frames, to.easing));
+              steps.push_back(ColorStep(start + t0, color, t1 - t0));
+            }
+            break;
+          }
+        }
+      }
+    }
+
+    return steps;
+  }
+
+  void EffectEngine::Play(const Effect& effect, const uint8_t target[8],
+    std::chrono::milliseconds offset)
+  {
+    std::array<uint8_t, 8> mac;
+    memcpy(mac.data(), target, mac.size());
+    Play(effect, { mac }, std::chrono::milliseconds(0));
+    m_playbacks.back().start += offset;
+  }
+
+  void EffectEngine::Play(const Effect& effect,
+    const std::vector<std::array<uint8_t, 8>>& targets,
+    std::chrono::milliseconds phaseStep)
+  {
+    // Every device plays the same plan, only the start differs
+    auto steps = std::make_shared<const std::vector<EffectStep>>(
+      Plan(effect, static_cast<uint32_t>(m_frameInterval.count())));
+    auto now = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < targets.size(); ++i)
+    {
+      Stop(targets[i].data());
+      m_playbacks.push_back({ steps, targets[i],
+        now + phaseStep * static_cast<long>(i), 0 });
+    }
+  }
+
+  void EffectEngine::Stop(const uint8_t target[8])
+  {
+    m_playbacks.erase(std::remove_if(m_playbacks.begin(), m_playbacks.end(),
+      [target](const Playback& playback)
+      {
+        return memcmp(playback.target.data(), target, playback.target.size()) == 0;
+      }), m_playbacks.end());
+  }
+
+  void EffectEngine::StopAll()
+  {
+    m_playbacks.clear();
+  }
+
+  size_t EffectEngine::Update()
+  {
+    size_t queued = 0;
+    auto now = std::chrono::steady_clock::now();
+    auto blocked = m_playbacks.end();
+
+    for (auto iter = m_playbacks.begin(); iter != m_playbacks.end() &&
+      blocked == m_playbacks.end(); ++iter)
+    {
+      auto& playback = *iter;
+      const auto& steps = *playback.steps;
+      while (playback.next < steps.size() &&
+        playback.start + std::chrono::milliseconds(steps[playback.next].time) <= now)
+      {
+        if (m_client.PendingSendCount() >= EFFECT_QUEUE_LIMIT)
+        {
+          blocked = iter;
+          break;
+        }
+
+        const auto& step = steps[playback.next];
+        if (step.waveform)
+        {
+          m_client.Send(step.wave, playback.target.data());
+        }
+        else
+        {
+          m_client.Send(step.color, playback.target.data());
+        }
+        ++playback.next;
+        ++queued;
+      }
+    }
+
+    // The device that ran out of room goes first next time, so the same
+    // devices aren't always the ones left waiting
+    std::rotate(m_playbacks.begin(), blocked, m_playbacks.end());
+
+    m_playbacks.erase(std::remove_if(m_playbacks.begin(), m_playbacks.end(),
+      [](const Playback& playback)
+      {
+        return playback.next >= playback.steps->size();
+      }), m_playbacks.end());
+
+    return queued;
+  }
+
+  bool EffectEngine::Playing() const
+  {
+    return !m_playbacks.empty();
+  }
+
+} // namespace lifx
@@ -0,0 +1,49 @@
+/////
+// fanout.cpp
+//! @file Fan-out planning for commands to many devices implementation
+/////
+
+#include <lib-lifx/fanout.h>
+
+namespace lifx
+{
+  FanoutPlanner::FanoutPlanner(uint32_t sourceId)
+    : m_sourceId(std::move(sourceId))
+  {
+  }
+
+  void FanoutPlanner::AddDevice(const uint8_t target[8])
+  {
+    m_devices.insert(TargetKey(target));
+  }
+
+  void FanoutPlanner::RemoveDevice(const uint8_t target[8])
+  {
+    m_devices.erase(TargetKey(target));
+  }
+
+  size_t FanoutPlanner::DeviceCount() const
+  {
+    return m_devices.size();
+  }
+
+  bool FanoutPlanner::CoversAllDevices(
+    const std::vector<std::array<uint8_t, 8>>& targets) const
+  {
+    if (m_devices.empty() || targets.size() < m_devices.size())
+      return false;
+
+    // Targets may repeat, so count each known device only once
+    std::unordered_set<uint64_t> covered;
+    for (const auto& target : targets)
+    {
+      auto key = TargetKey(target.data());
+      if (m_devices.count(key) > 0)
+      {
+        covered.insert(key);
+      }
+    }
+    return covered.size() == m_devices.size();
+  }
+
+} // namespace lifx
@@ -0,0 +1,330 @@
+/////
+// filter.cpp
+//! @file Selecting devices implementation
+/////
+
+#include <lib-lifx/filter.h>
+#include <lib-lifx/lifx.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include <ctype.h>
+#include <string.h>
+
+namespace
+{
+  std::string Fold(const char* text, size_t length)
+  {
+    std::string folded(text, length);
+    std::transform(folded.begin(), folded.end(), folded.begin(),
+      [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return folded;
+  }
+
+  bool StartsWith(const std::string& text, const std::string& prefix)
+  {
+    return text.compare(0, prefix.size(), prefix) == 0;
+  }
+
+  //! Turns a MAC as it is typed into the digits of @ref
+  //! lifx::SelectorIndex::HexMac, or an empty string if it isn't one.
+  std::string ToHex(const std::string& text)
+  {
+    std::string hex;
+    for (char c : text)
+    {
+      if (c == ':' || c == '-')
+        continue;
+      if (!isxdigit(static_cast<unsigned char>(c)))
+        return std::string();
+      hex.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+    }
+    return hex;
+  }
+
+  //! Matches a whole string against a pattern where `*` is any run of
+  //! characters and `?` any single one.
+  bool Glob(const char* pattern, const char* text)
+  {
+    const char* star = nullptr;
+    const char* resume = nullptr;
+    while (*text != '\0')
+    {
+      if (*pattern == '?' || (*pattern != '*' && *pattern == *text))
+      {
+        ++pattern;
+        ++text;
+      }
+      else if (*pattern == '*')
+      {
+        // Let the star match nothing for now, and more if that fails
+        star = pattern++;
+        resume = text;
+      }
+      else if (star != nullptr)
+      {
+        pattern = star + 1;
+        text = ++resume;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    while (*pattern == '*')
+    {
+      ++pattern;
+    }
+    return *pattern == '\0';
+  }
+}
+
+namespace lifx
+{
+  DeviceSelector::DeviceSelector(const std::string& selector)
+    : m_kind(Kind::NAME)
+    , m_valid(true)
+  {
+    static const struct { const char* prefix; Kind kind; } prefixes[] =
+    {
+      { "group:", Kind::GROUP },
+      { "location:", Kind::LOCATION },
+      { "mac:", Kind::MAC },
+      { "re:", Kind::REGEX },
+      { "=", Kind::EXACT },
+    };
+
+    auto folded = Fold(selector.data(), selector.size());
+    m_pattern = folded;
+    for (const auto& prefix : prefixes)
+    {
+      if (StartsWith(folded, prefix.prefix))
+      {
+        m_kind = prefix.kind;
+        m_pattern = folded.substr(strlen(prefix.prefix));
+        break;
+      }
+    }
+
+    if (m_kind == Kind::REGEX)
+    {
+      // Folding would change escapes like \S, so the case is ignored instead
+      try
+      {
+        m_regex = std::make_shared<std::regex>(
+          selector.substr(strlen("re:")),
+          std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+      }
+      catch (const std::regex_error&)
+      {
+        m_valid = false;
+      }
+    }
+    else if (m_kind == Kind::NAME)
+    {
+      auto wildcard = m_pattern.find_first_of("*?");
+      if (m_pattern.empty())
+      {
+        // Most likely an unset variable in a script, which shouldn't mean
+        // every light
+        m_valid = false;
+      }
+      else if (m_pattern == "all")
+      {
+        m_kind = Kind::ALL;
+      }
+      else if (wildcard == m_pattern.size() - 1 && m_pattern.back() == '*')
+      {
+        m_kind = Kind::PREFIX;
+        m_pattern.pop_back();
+      }
+      else if (wildcard != std::string::npos)
+      {
+        m_kind = Kind::GLOB;
+      }
+    }
+
+    if (m_kind == Kind::NAME || m_kind == Kind::MAC)
+    {
+      m_hex = ToHex(m_pattern);
+    }
+  }
+
+  bool DeviceSelector::Matches(const std::string& label,
+    const std::string& mac) const
+  {
+    switch (m_kind)
+    {
+    case Kind::ALL:
+      return true;
+    case Kind::NAME:
+      return label.find(m_pattern) != std::string::npos ||
+        (!m_hex.empty() && mac.find(m_hex) != std::string::npos);
+    case Kind::EXACT:
+      return label == m_pattern;
+    case Kind::PREFIX:
+      return StartsWith(label, m_pattern);
+    case Kind::GLOB:
+      return Glob(m_pattern.c_str(), label.c_str());
+    case Kind::REGEX:
+      return m_regex != nullptr && std::regex_search(label, *m_regex);
+    case Kind::MAC:
+      return !m_hex.empty() && StartsWith(mac, m_hex);
+    case Kind::GROUP:
+    case Kind::LOCATION:
+      break;
+    }
+    return false;
+  }
+
+  void SelectorIndex::Update(const uint8_t target[8], const char label[32])
+  {
+    auto folded = Fold(label, strnlen(label, 32));
+    auto key = TargetKey(target);
+    auto index = m_indexes.find(key);
+    if (index == m_indexes.end())
+    {
+      m_indexes.emplace(key, static_cast<uint32_t>(m_targets.size()));
+      Target copy;
+      std::copy(target, target + copy.size(), copy.begin());
+      m_targets.push_back(copy);
+      m_labels.push_back(std::move(folded));
+      m_macs.push_back(HexMac(target));
+      m_dirty = true;
+    }
+    else if (m_labels[index->second] != folded)
+    {
+      m_labels[index->second] = std::move(folded);
+      m_dirty = true;
+    }
+  }
+
+  bool SelectorIndex::Remove(const uint8_t target[8])
+  {
+    auto index = m_indexes.find(TargetKey(target));
+    if (index == m_indexes.end())
+      return false;
+
+    // Move the last device into the gap
+    auto removed = index->second;
+    m_indexes.erase(index);
+    auto last = static_cast<uint32_t>(m_targets.size() - 1);
+    if (removed != last)
+    {
+      m_targets[removed] = m_targets[last];
+      m_labels[removed] = std::move(m_labels[last]);
+      m_macs[removed] = std::move(m_macs[last]);
+      m_indexes[TargetKey(m_targets[removed].data())] = removed;
+    }
+    m_targets.pop_back();
+    m_labels.pop_back();
+    m_macs.pop_back();
+    m_dirty = true;
+    return true;
+  }
+
+  void SelectorIndex::Select(const DeviceSelector& selector,
+    const GroupIndex& groups, const GroupIndex& locations,
+    std::vector<Target>& targets) const
+  {
+    using Kind = DeviceSelector::Kind;
+
+    auto kind = selector.GetKind();
+    const GroupIndex::Members* members = nullptr;
+    if (kind == Kind::GROUP || kind == Kind::NAME)
+    {
+      members = groups.Find(selector.Pattern());
+    }
+    if ((kind == Kind::LOCATION || kind == Kind::NAME) && members == nullptr)
+    {
+      members = locations.Find(selector.Pattern());
+    }
+    if (members != nullptr)
+    {
+      targets.insert(targets.end(), members->begin(), members->end());
+      return;
+    }
+    if (kind == Kind::GROUP || kind == Kind::LOCATION || !selector.Valid())
+      return;
+
+    auto add = [this, &selector, &targets](uint32_t index)
+    {
+      if (selector.Matches(m_labels[index], m_macs[index]))
+      {
+        targets.push_back(m_targets[index]);
+      }
+    };
+
+    // Whatever must start with a known prefix is searched for in sorted
+    // order, only a text anywhere in a label needs a scan
+    const std::vector<uint32_t>* order = nullptr;
+    const std::vector<std::string>* keys = nullptr;
+    std::string prefix;
+    if (kind == Kind::EXACT || kind == Kind::PREFIX || kind == Kind::GLOB)
+    {
+      order = &m_byLabel;
+      keys = &m_labels;
+      prefix = selector.Pattern().substr(0,
+        selector.Pattern().find_first_of("*?"));
+    }
+    else if (kind == Kind::MAC)
+    {
+      order = &m_byMac;
+      keys = &m_macs;
+      prefix = ToHex(selector.Pattern());
+    }
+
+    if (order == nullptr)
+    {
+      for (uint32_t i = 0; i < m_targets.size(); ++i)
+      {
+        add(i);
+      }
+      return;
+    }
+
+    Sort();
+    auto first = std::lower_bound(order->begin(), order->end(), prefix,
+      [keys](uint32_t index, const std::string& prefix)
+    {
+      return (*keys)[index] < prefix;
+    });
+    for (auto iter = first;
+      iter != order->end() && StartsWith((*keys)[*iter], prefix); ++iter)
+    {
+      add(*iter);
+    }
+  }
+
+  std::string SelectorIndex::HexMac(const uint8_t target[8])
+  {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(12, '0');
+    for (size_t i = 0; i < 6; ++i)
+    {
+      hex[i * 2] = digits[target[i] >> 4];
+      hex[i * 2 + 1] = digits[target[i] & 0xF];
+    }
+    return hex;
+  }
+
+  void SelectorIndex::Sort() const
+  {
+    if (!m_dirty)
+      return;
+
+    auto sort = [this](std::vector<uint32_t>& order,
+      const std::vector<std::string>& keys)
+    {
+      order.resize(m_targets.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(),
+        [&keys](uint32_t a, uint32_t b) { return keys[a] < keys[b]; });
+    };
+    sort(m_byLabel, m_labels);
+    sort(m_byMac, m_macs);
+    m_dirty = false;
+  }
+
+} // namespace lifx
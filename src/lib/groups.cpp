@@ -0,0 +1,196 @@
+/////
+// groups.cpp
+//! @file Index of devices by group or location implementation
+/////
+
+#include <lib-lifx/groups.h>
+#include <lib-lifx/lifx.h>
+
+#include <algorithm>
+
+#include <ctype.h>
+#include <string.h>
+
+namespace lifx
+{
+  void GroupIndex::Update(const uint8_t target[8], const uint8_t uuid[UUID_SIZE],
+    const char label[32], uint64_t updatedAt)
+  {
+    Uuid id;
+    std::copy(uuid, uuid + UUID_SIZE, id.begin());
+
+    auto key = TargetKey(target);
+    auto device = m_devices.find(key);
+    if (device == m_devices.end() || device->second != id)
+    {
+      if (device != m_devices.end())
+      {
+        RemoveMember(device->second, target);
+      }
+      m_devices[key] = id;
+
+      auto inserted = m_groups.emplace(id, Group { std::string(), 0, Members() });
+      Target member;
+      std::copy(target, target + member.size(), member.begin());
+      inserted.first->second.members.push_back(member);
+    }
+
+    // Devices may still report a label that was changed since
+    auto& group = m_groups[id];
+    std::string current(label, strnlen(label, 32));
+    if (updatedAt < group.updatedAt ||
+      (updatedAt == group.updatedAt && current == group.label))
+    {
+      return;
+    }
+
+    auto previous = Fold(group.label.data(), group.label.size());
+    group.label = std::move(current);
+    group.updatedAt = updatedAt;
+    auto folded = Fold(group.label.data(), group.label.size());
+    if (folded != previous && !previous.empty())
+    {
+      ResolveLabel(previous);
+    }
+    ResolveLabel(folded);
+  }
+
+  void GroupIndex::Update(const uint8_t target[8],
+    const message::device::StateGroup& group)
+  {
+    Update(target, group.group, group.label, group.updated_at);
+  }
+
+  void GroupIndex::Update(const uint8_t target[8],
+    const message::device::StateLocation& location)
+  {
+    Update(target, location.location, location.label, location.updated_at);
+  }
+
+  bool GroupIndex::Remove(const uint8_t target[8])
+  {
+    auto device = m_devices.find(TargetKey(target));
+    if (device == m_devices.end())
+      return false;
+
+    auto uuid = device->second;
+    m_devices.erase(device);
+    RemoveMember(uuid, target);
+    return true;
+  }
+
+  void GroupIndex::Clear()
+  {
+    m_groups.clear();
+    m_devices.clear();
+    m_labels.clear();
+  }
+
+  const GroupIndex::Members* GroupIndex::Find(const Uuid& uuid) const
+  {
+    auto group = m_groups.find(uuid);
+    return group == m_groups.end() ? nullptr : &group->second.members;
+  }
+
+  const GroupIndex::Members* GroupIndex::Find(const std::string& label) const
+  {
+    Uuid uuid;
+    return Resolve(label, uuid) ? Find(uuid) : nullptr;
+  }
+
+  bool GroupIndex::Resolve(const std::string& label, Uuid& uuid) const
+  {
+    auto group = m_labels.find(Fold(label.data(), label.size()));
+    if (group == m_labels.end())
+      return false;
+
+    uuid = group->second;
+    return true;
+  }
+
+  bool GroupIndex::GroupOf(const uint8_t target[8], Uuid& uuid) const
+  {
+    auto device = m_devices.find(TargetKey(target));
+    if (device == m_devices.end())
+      return false;
+
+    uuid = device->second;
+    return true;
+  }
+
+  std::string GroupIndex::Label(const Uuid& uuid) const
+  {
+    auto group = m_groups.find(uuid);
+    return group == m_groups.end() ? std::string() : group->second.label;
+  }
+
+  size_t GroupIndex::UuidHash::operator()(const Uuid& uuid) const
+  {
+    // UUIDs are random already, folding the halves together is enough
+    uint64_t halves[2];
+    memcpy(halves, uuid.data(), sizeof(halves));
+    return static_cast<size_t>(halves[0] ^ halves[1]);
+  }
+
+  std::string GroupIndex::Fold(const char* label, size_t length)
+  {
+    std::string folded(label, length);
+    std::transform(folded.begin(), folded.end(), folded.begin(),
+      [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+    return folded;
+  }
+
+  void GroupIndex::RemoveMember(const Uuid& uuid, const uint8_t target[8])
+  {
+    auto group = m_groups.find(uuid);
+    if (group == m_groups.end())
+      return;
+
+    auto& members = group->second.members;
+    auto member = std::find_if(members.begin(), members.end(),
+      [target](const Target& member)
+    {
+      return memcmp(member.data(), target, member.size()) == 0;
+    });
+    if (member != members.end())
+    {
+      *member = members.back();
+      members.pop_back();
+    }
+
+    // A group is gone once no known device is in it
+    if (members.empty())
+    {
+      auto folded = Fold(group->second.label.data(), group->second.label.size());
+      m_groups.erase(group);
+      ResolveLabel(folded);
+    }
+  }
+
+  void GroupIndex::ResolveLabel(const std::string& folded)
+  {
+    // Labels change rarely, so a scan of the groups is fine here
+    const Uuid* latest = nullptr;
+    uint64_t latestTime = 0;
+    for (const auto& group : m_groups)
+    {
+      if (!group.second.label.empty() && (latest == nullptr ||
+        group.second.updatedAt > latestTime) &&
+        Fold(group.second.label.data(), group.second.label.size()) == folded)
+      {
+        latest = &group.first;
+        latestTime = group.second.updatedAt;
+      }
+    }
+
+    if (latest == nullptr)
+    {
+      m_labels.erase(folded);
+    }
+    else
+    {
+      m_labels[folded] = *latest;
+    }
+  }
+
+} // namespace lifx
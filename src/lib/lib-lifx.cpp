@@ -3,194 +3,314 @@
 //! @file Library implementation
 /////
 
+#include <lib-lifx/codec.h>
 #include <lib-lifx/lifx.h>
+#include <lib-lifx/registry.h>
+#include <lib-lifx/scene.h>
+#include <lib-lifx/transport.h>
 
-#include <array>
+#include <algorithm>
 #include <chrono>
-#include <thread>
-
-#ifdef _WIN32
-#include <WinSock2.h>
-#include <ws2tcpip.h>
-#else
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <unistd.h>
-#endif
+#include <random>
 
 namespace
 {
-  constexpr int sockAddrLen = sizeof(sockaddr_in);
-  struct sockaddr_in listen_addr = { };
-  struct sockaddr_in send_direct_addr = { };
-  struct sockaddr_in broadcast_addr = { };
-#ifdef _WIN32
-  SOCKET sock;
-#else
-  int sock;
-#endif
+  //! Picks where a client starts handing out sequences, so that replies
+  //! meant for an earlier run of the program aren't taken for its own.
+  uint8_t FirstSequence()
+  {
+    std::random_device randomDevice;
+    return static_cast<uint8_t>(
+      std::uniform_int_distribution<int>{ 1, UCHAR_MAX }(randomDevice));
+  }
+
+  //! Gets the time on the clock the kernel stamps packets with.
+  uint64_t WallClock()
+  {
+    return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+  }
 }
 
 namespace lifx
 {
-  LifxClient::LifxClient(uint32_t sourceId)
-    : m_sourceId(std::move(sourceId))
+  LifxClient::LifxClient(uint32_t sourceId, uint16_t port)
+    : LifxClient(std::unique_ptr<Transport>(new SocketTransport(port)),
+      sourceId)
   {
-    // TODO: Error checking
+  }
 
-#ifdef _WIN32
-    // Start WinSock
-    WSADATA wsa;
-    WSAStartup(MAKEWORD(2, 2), &wsa);
-#endif
+  LifxClient::LifxClient(std::unique_ptr<Transport> transport,
+    uint32_t sourceId)
+    : m_nextSubscription(1)
+    , m_notifyDepth(0)
+    , m_removedSubscribers(false)
+    , m_nextSequence(FirstSequence())
+    , m_sendTimes()
+    , m_receiveTime(0)
+    , m_nextSceneId(1)
+    , m_rateLimiter(MAX_MESSAGES_PER_SECOND, MAX_MESSAGES_PER_SECOND)
+    , m_perSecond(MAX_MESSAGES_PER_SECOND)
+    , m_devicePerSecond(MAX_MESSAGES_PER_SECOND)
+    , m_sourceId(std::move(sourceId))
+    , m_rejectedCount(0)
+    , m_dispatch(&DispatchMessages<DefaultMessages>)
+    , m_filterSources(false)
+    , m_allowDeviceInitiated(true)
+    , m_filteredCount(0)
+    , m_duplicateCount(0)
+    , m_transport(std::move(transport))
+  {
+  }
 
-    // Setup addresses
-    listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    listen_addr.sin_port = htons(56700);
-    listen_addr.sin_family = AF_INET;
+  LifxClient::~LifxClient()
+  {
+  }
 
-    //send_direct_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-    send_direct_addr.sin_port = htons(56700);
-    send_direct_addr.sin_family = AF_INET;
+  int LifxClient::SendBuffer(const std::vector<char>& buffer)
+  {
+    if (buffer.empty())
+      return 0;
 
-    broadcast_addr.sin_addr.s_addr = htonl(INADDR_BROADCAST);
-    broadcast_addr.sin_port = htons(56700);
-    broadcast_addr.sin_family = AF_INET;
+    return m_transport->Send(buffer.data(), buffer.size());
+  }
 
-    // Create our actual socket
-    sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  bool LifxClient::Unsubscribe(Subscription subscription)
+  {
+    auto iter = m_subscriptions.find(subscription);
+    if (iter == m_subscriptions.end())
+      return false;
 
-    // Allow this socket to broadcast
-    int yes = 1;
-    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(int));
+    auto key = iter->second;
+    m_subscriptions.erase(iter);
 
-    // Allow this socket to reuse addresses
-    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(int));
+    auto pending = std::find_if(m_newSubscribers.begin(), m_newSubscribers.end(),
+      [subscription](const std::pair<TargetTypeKey, Subscriber>& entry)
+    {
+      return entry.second.id == subscription;
+    });
+    if (pending != m_newSubscribers.end())
+    {
+      m_newSubscribers.erase(pending);
+      return true;
+    }
 
-    // Bind the socket to our listening address
-    bind(sock, (struct sockaddr*)&listen_addr, sockAddrLen);
+    // Callbacks may be iterating the index, so it must not be rehashed here
+    auto& subscribers = m_subscribers.find(key)->second;
+    auto subscriber = std::find_if(subscribers.begin(), subscribers.end(),
+      [subscription](const Subscriber& entry)
+    {
+      return entry.id == subscription;
+    });
+    if (m_notifyDepth > 0)
+    {
+      // The callback may be running, so only deactivate it for now
+      subscriber->active = false;
+      m_removedSubscribers = true;
+      return true;
+    }
+
+    subscribers.erase(subscriber);
+    if (subscribers.empty())
+    {
+      m_subscribers.erase(key);
+    }
+    return true;
   }
 
-  LifxClient::~LifxClient()
+  LifxClient::Subscription LifxClient::AddSubscriber(const TargetTypeKey& key,
+    LifxInternalCallback callback)
   {
-#ifdef _WIN32
-    // Close the socket
-    closesocket(sock);
-    // Stop WinSock
-    WSACleanup();
-#else
-    // Close the socket
-    close(sock);
-#endif
+    auto id = m_nextSubscription++;
+    m_subscriptions[id] = key;
+    if (m_notifyDepth > 0)
+    {
+      // Growing a list of callbacks while one of them runs would move it
+      m_newSubscribers.emplace_back(key,
+        Subscriber { id, std::move(callback), true });
+    }
+    else
+    {
+      m_subscribers[key].push_back({ id, std::move(callback), true });
+    }
+    return id;
   }
 
-  int LifxClient::SendBuffer(const std::vector<char>& buffer)
+  void LifxClient::Notify(const Header& header, const void* msg)
   {
-    if (buffer.empty())
-      return 0;
+    auto notify = [this, &header, msg](const TargetTypeKey& key)
+    {
+      auto subscribers = m_subscribers.find(key);
+      if (subscribers == m_subscribers.end())
+        return;
+
+      for (const auto& subscriber : subscribers->second)
+      {
+        if (subscriber.active)
+        {
+          subscriber.callback(header, msg);
+        }
+      }
+    };
 
-    int ret = sendto(sock, buffer.data(), static_cast<int>(buffer.size()), 0,
-      (struct sockaddr*)&broadcast_addr, sockAddrLen);
-    return std::move(ret);
+    ++m_notifyDepth;
+    notify({ 0, header.type });
+    auto target = TargetKey(header.target);
+    if (target != 0)
+    {
+      notify({ target, header.type });
+    }
+    if (--m_notifyDepth == 0)
+    {
+      FlushSubscribers();
+    }
   }
 
-  template<typename ... T> void LifxClient::ReceiveMessageTypes(const Header& header, const char* buffer)
+  void LifxClient::FlushSubscribers()
   {
-    // Fancy hack in a way:
-    // Abuse initialize lists so that we call @ref TryReceiveMessage
-    // for each of the provided types in the variadic template
-    // Thanks to Casey; ref: http://stackoverflow.com/a/21194071
-    int _[] = {0, ( TryReceiveMessage<T>(header, buffer), 0)...};
-    (void)_;
+    if (m_removedSubscribers)
+    {
+      for (auto iter = m_subscribers.begin(); iter != m_subscribers.end();)
+      {
+        auto& subscribers = iter->second;
+        subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(),
+          [](const Subscriber& entry) { return !entry.active; }),
+          subscribers.end());
+        iter = subscribers.empty() ? m_subscribers.erase(iter) : std::next(iter);
+      }
+      m_removedSubscribers = false;
+    }
+
+    for (auto& entry : m_newSubscribers)
+    {
+      m_subscribers[entry.first].push_back(std::move(entry.second));
+    }
+    m_newSubscribers.clear();
   }
 
-  LifxClient::RunResult LifxClient::RunOnce(long seconds, long milliseconds)
+  bool LifxClient::ProcessDatagram(const char* data, size_t length,
+    uint64_t timestamp)
   {
-    struct timeval timeout;
-    timeout.tv_sec = std::move(seconds);
-    timeout.tv_usec = std::move(milliseconds);
+    // Only the source of the raw header is needed to filter, which is far
+    // cheaper than decoding packets that are thrown away
+    if (m_filterSources && length >= LIFX_HEADER_SIZE)
+    {
+      uint32_t source = 0;
+      wire::Reader(data + HEADER_SOURCE_OFFSET).Value(source);
+      if (source != m_sourceId && !(m_allowDeviceInitiated && source == 0))
+      {
+        ++m_filteredCount;
+        return false;
+      }
+    }
 
-    fd_set rfds;
-    FD_ZERO(&rfds);
-    FD_SET(static_cast<uint32_t>(sock), &rfds);
+    // Validate the frame once so each message type only checks its payload
+    Header header;
+    if (length > MAX_LIFX_PACKET_SIZE || !DecodeHeader(data, length, header))
+    {
+      ++m_rejectedCount;
+      return false;
+    }
 
-    int ret = select(static_cast<int>(sock)+1, &rfds, nullptr, nullptr, &timeout);
-    if (ret == -1)
+    DuplicateFilter::Clock::time_point now;
+    uint64_t payload = 0;
+    if (m_duplicates.Enabled())
     {
-      return RunResult::RUN_ERROR;
+      now = DuplicateFilter::Clock::now();
+      payload = DuplicateFilter::PayloadHash(data + LIFX_HEADER_SIZE,
+        header.size - LIFX_HEADER_SIZE);
+      if (m_duplicates.Contains(header, now, payload))
+      {
+        ++m_duplicateCount;
+        return false;
+      }
     }
-    else if (ret && FD_ISSET(sock, &rfds))
+
+    m_receiveTime = timestamp != 0 ? timestamp : WallClock();
+    bool dispatched = m_dispatch(*this, header, data);
+    m_receiveTime = 0;
+    if (!dispatched)
     {
-      std::array<char, MAX_LIFX_PACKET_SIZE> buffer;
-      recv(sock, buffer.data(), MAX_LIFX_PACKET_SIZE, 0);
-
-      NetworkHeader nh = { };
-      memcpy(&nh, buffer.data(), LIFX_HEADER_SIZE);
-      auto header = FromNetwork(nh);
-
-      ReceiveMessageTypes<
-        message::device::GetService,
-        message::device::StateService,
-        message::device::GetHostInfo,
-        message::device::StateHostInfo,
-        message::device::GetHostFirmware,
-        message::device::StateHostFirmware,
-        message::device::GetWifiInfo,
-        message::device::StateWifiInfo,
-        message::device::GetWifiFirmware,
-        message::device::StateWifiFirmware,
-        message::device::GetPower,
-        message::device::SetPower,
-        message::device::StatePower,
-        message::device::GetLabel,
-        message::device::SetLabel,
-        message::device::StateLabel,
-        message::device::GetVersion,
-        message::device::StateVersion,
-        message::device::GetInfo,
-        message::device::StateInfo,
-        message::device::Acknowledgement,
-        message::device::GetLocation,
-        message::device::StateLocation,
-        message::device::GetGroup,
-        message::device::StateGroup,
-        message::device::EchoRequest,
-        message::device::EchoResponse,
-        message::light::Get,
-        message::light::SetColor,
-        message::light::State,
-        message::light::GetPower,
-        message::light::SetPower,
-        message::light::StatePower
-      >(header, buffer.data());
+      ++m_rejectedCount;
+      return false;
+    }
+
+    // Only packets that were handled are remembered, so a mangled copy
+    // can't hide the intact one
+    m_duplicates.Record(header, now, payload);
+    return true;
+  }
 
+  LifxClient::RunResult LifxClient::RunOnce(long seconds, long milliseconds)
+  {
+    std::chrono::microseconds timeout = std::chrono::seconds(seconds) +
+      std::chrono::milliseconds(milliseconds);
+    // Don't wait for packets past the moment a send can go out
+    if (WaitingToSend())
+    {
+      auto delay = SendDelay(RateLimiter::Clock::now());
+      if (delay < timeout)
+      {
+        timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+          delay + std::chrono::microseconds(1) - RateLimiter::Clock::duration(1));
+      }
+    }
+    int received = m_transport->Receive(timeout,
+      [this](const Datagram& datagram)
+    {
+      // Broadcasts are looped back to the socket that sent them. Without
+      // filtering, that can't be told apart from a device on this host
+      // that answers from the same port, like an emulator
+      if (datagram.loopback && m_filterSources)
+      {
+        ++m_filteredCount;
+        return;
+      }
+      ProcessDatagram(datagram.data, datagram.length, datagram.timestamp);
+    });
+    if (received < 0)
+    {
+      return RunResult::RUN_ERROR;
+    }
+    else if (received > 0)
+    {
       return RunResult::RUN_RECEIVED_DATA;
     }
 
-    if (!m_pendingSends.empty())
+    if (WaitingToSend())
     {
-      static auto start_time = std::chrono::steady_clock::now();
-      static uint32_t messages_sent = 0;
-
       // Check if we have exceeded the number of messages per second
-      auto seconds_since_start =
-        std::chrono::duration_cast<std::chrono::seconds>(
-          std::chrono::steady_clock::now() - start_time);
-      if (seconds_since_start.count() > 0)
+      auto now = RateLimiter::Clock::now();
+      if (!m_rateLimiter.Ready(now))
       {
-        auto messages_per_second = (messages_sent / seconds_since_start.count());
-        if (messages_per_second >= MAX_MESSAGES_PER_SECOND)
-        {
-          // hold off sending until we are under the limit
-          return RunResult::RUN_SENT_LIMIT;
-        }
+        // hold off sending until we are under the limit
+        return RunResult::RUN_SENT_LIMIT;
       }
 
-      auto tosend = m_pendingSends.begin();
-      SendBuffer(tosend->second);
-      m_pendingSends.erase(tosend);
-      ++messages_sent;
+      if (!m_pendingSends.empty())
+      {
+        // Send in the order that messages were queued
+        auto tosend = m_pendingSends.find(m_sendOrder.front());
+        m_sendOrder.pop_front();
+        SendBuffer(tosend->second);
+        // Taken as soon as the transport has the packet, on the clock the
+        // kernel stamps replies with, so a round trip only counts the
+        // network and the device
+        m_sendTimes[tosend->first] = WallClock();
+        m_pendingSends.erase(tosend);
+      }
+      else if (!SendSceneMessage(now))
+      {
+        return RunResult::RUN_SENT_LIMIT;
+      }
+      m_rateLimiter.Acquire(now);
+
+      // Transports may batch sends, hand them over once the queue is empty
+      if (!WaitingToSend())
+      {
+        m_transport->Flush();
+      }
 
       return RunResult::RUN_SENT_DATA;
     }
@@ -200,94 +320,175 @@ namespace lifx
 
   bool LifxClient::WaitingToSend() const
   {
-    return ! m_pendingSends.empty();
+    return ! m_pendingSends.empty() || ! m_activeScenes.empty();
+  }
+
+  uint32_t LifxClient::Apply(std::shared_ptr<const Scene> scene,
+    SceneCallback callback)
+  {
+    auto id = m_nextSceneId++;
+    if (scene == nullptr || scene->Size() == 0)
+    {
+      if (callback)
+      {
+        callback(id);
+      }
+      return id;
+    }
+
+    m_activeScenes.push_back({ id, std::move(scene), 0, std::move(callback) });
+    return id;
+  }
+
+  bool LifxClient::Applying(uint32_t id) const
+  {
+    for (const auto& active : m_activeScenes)
+    {
+      if (active.id == id)
+        return true;
+    }
+    return false;
+  }
+
+  void LifxClient::SetRateLimits(uint32_t perSecond, uint32_t devicePerSecond)
+  {
+    m_rateLimiter.SetRate(perSecond, perSecond);
+    m_perSecond = perSecond;
+    m_devicePerSecond = devicePerSecond;
+    for (auto& limiter : m_deviceLimiters)
+    {
+      limiter.second.SetRate(devicePerSecond, devicePerSecond);
+    }
+  }
+
+  uint32_t LifxClient::RateLimit() const
+  {
+    return m_perSecond;
+  }
+
+  bool LifxClient::SendSceneMessage(RateLimiter::Clock::time_point now)
+  {
+    // Scenes are interleaved across devices when built, so a device that
+    // is at its limit is only ever briefly in the way of its own scene;
+    // the scenes applied after it go on meanwhile
+    for (auto active = m_activeScenes.begin(); active != m_activeScenes.end();
+      ++active)
+    {
+      const auto& entry = active->scene->GetEntry(active->next);
+      auto limiter = m_deviceLimiters.find(entry.device);
+      if (limiter == m_deviceLimiters.end())
+      {
+        limiter = m_deviceLimiters.emplace(entry.device,
+          RateLimiter(m_devicePerSecond, m_devicePerSecond)).first;
+      }
+      if (!limiter->second.Acquire(now))
+        continue;
+
+      SendBuffer(entry.packet);
+      m_sendTimes[static_cast<uint8_t>(entry.packet[HEADER_SEQUENCE_OFFSET])] =
+        WallClock();
+      if (++active->next >= active->scene->Size())
+      {
+        auto finished = std::move(*active);
+        m_activeScenes.erase(active);
+        if (finished.callback)
+        {
+          finished.callback(finished.id);
+        }
+      }
+      return true;
+    }
+    return false;
+  }
+
+  RateLimiter::Clock::duration LifxClient::SendDelay(
+    RateLimiter::Clock::time_point now)
+  {
+    auto delay = m_rateLimiter.Delay(now);
+    if (!m_pendingSends.empty())
+      return delay;
+
+    // Scenes only send once the device of one of their next messages is
+    // under its limit
+    auto device = RateLimiter::Clock::duration::max();
+    for (const auto& active : m_activeScenes)
+    {
+      const auto& entry = active.scene->GetEntry(active.next);
+      auto limiter = m_deviceLimiters.find(entry.device);
+      if (limiter == m_deviceLimiters.end())
+        return delay;
+
+      device = std::min(device, limiter->second.Delay(now));
+    }
+    return std::max(delay, device);
+  }
+
+  size_t LifxClient::PendingSendCount() const
+  {
+    return m_pendingSends.size();
+  }
+
+  size_t LifxClient::PendingSceneCount() const
+  {
+    size_t count = 0;
+    for (const auto& active : m_activeScenes)
+    {
+      count += active.scene->Size() - active.next;
+    }
+    return count;
+  }
+
+  uint32_t LifxClient::SourceId() const
+  {
+    return m_sourceId;
+  }
+
+  uint64_t LifxClient::SendTime(uint8_t sequence) const
+  {
+    return m_sendTimes[sequence];
+  }
+
+  uint64_t LifxClient::ReceiveTime() const
+  {
+    return m_receiveTime;
+  }
+
+  void LifxClient::FilterSources(bool enabled, bool allowDeviceInitiated)
+  {
+    m_filterSources = enabled;
+    m_allowDeviceInitiated = allowDeviceInitiated;
+  }
+
+  uint64_t LifxClient::FilteredCount() const
+  {
+    return m_filteredCount;
+  }
+
+  void LifxClient::SetDuplicateExpiry(DuplicateFilter::Clock::duration expiry)
+  {
+    m_duplicates.SetExpiry(expiry);
+  }
+
+  uint64_t LifxClient::DuplicateCount() const
+  {
+    return m_duplicateCount;
+  }
+
+  uint64_t LifxClient::RejectedCount() const
+  {
+    return m_rejectedCount;
   }
 
   NetworkHeader LifxClient::ToNetwork(const Header& h)
   {
-#ifdef _WIN32
     NetworkHeader nh = { };
-    nh.frame = h.size;
-    nh.frame |= h.protocol << 16;
-    nh.frame |= h.addressable << 28;
-    nh.frame |= h.tagged << 29;
-    nh.frame |= h.origin << 30;
-    nh.frame |= static_cast<uint64_t>(h.source) << 32;
-
-    nh.target = h.target[0];
-    nh.target |= h.target[1] << 8;
-    nh.target |= h.target[2] << 16;
-    nh.target |= h.target[3] << 24;
-    nh.target |= static_cast<uint64_t>(h.target[4]) << 32;
-    nh.target |= static_cast<uint64_t>(h.target[5]) << 40;
-    nh.target |= static_cast<uint64_t>(h.target[6]) << 48;
-    nh.target |= static_cast<uint64_t>(h.target[7]) << 56;
-
-    nh.frame_address = h.site[0];
-    nh.frame_address |= h.site[1] << 8;
-    nh.frame_address |= h.site[2] << 16;
-    nh.frame_address |= h.site[3] << 24;
-    nh.frame_address |= static_cast<uint64_t>(h.site[4]) << 32;
-    nh.frame_address |= static_cast<uint64_t>(h.site[5]) << 40;
-    nh.frame_address |= static_cast<uint64_t>(h.ack_required) << 48;
-    nh.frame_address |= static_cast<uint64_t>(h.res_required) << 49;
-    //nh.frame_address |= static_cast<uint64_t>(h.reserved) << 50;
-    nh.frame_address |= static_cast<uint64_t>(h.sequence) << 56;
-
-    nh.time = h.at_time;
-
-    nh.type = h.type;
-
-    //nh.reserved = h.reserved;
-
-    return std::move(nh);
-#else
-    return h;
-#endif
+    wire::EncodeHeader(h, reinterpret_cast<char*>(&nh));
+    return nh;
   }
 
   Header LifxClient::FromNetwork(const NetworkHeader& nh)
   {
-#ifdef _WIN32
-    Header h = { };
-
-    // reserved = nh.reserved; // 16
-
-    h.type = nh.type; // 16
-
-    h.at_time = nh.time; // 64
-
-    h.target[0] = nh.target & 0xFF; // 8
-    h.target[1] = (nh.target >> 8) & 0xFF; // 8
-    h.target[2] = (nh.target >> 16) & 0xFF; // 8
-    h.target[3] = (nh.target >> 24) & 0xFF; // 8
-    h.target[4] = (nh.target >> 32) & 0xFF; // 8
-    h.target[5] = (nh.target >> 40) & 0xFF; // 8
-    h.target[6] = (nh.target >> 48) & 0xFF; // 8
-    h.target[7] = (nh.target >> 56) & 0xFF; // 8
-
-    h.site[0] = nh.frame_address & 0xFF; // 8
-    h.site[1] = (nh.frame_address >> 8) & 0xFF; // 8
-    h.site[2] = (nh.frame_address >> 16) & 0xFF; // 8
-    h.site[3] = (nh.frame_address >> 24) & 0xFF; // 8
-    h.site[4] = (nh.frame_address >> 32) & 0xFF; // 8
-    h.site[5] = (nh.frame_address >> 40) & 0xFF; // 8
-    h.ack_required = (nh.frame_address >> 48) & 0x1; // 1
-    h.res_required = (nh.frame_address >> 49) & 0x1; // 1
-                                                     //h.reserved = (nh.frame_address >> 50) & 0x3f; // 6
-    h.sequence = (nh.frame_address >> 56) & 0xFF; // 8
-
-    h.size = nh.frame & 0xFFFF; // 16
-    h.protocol = (nh.frame >> 16) & 0xFFF; // 12
-    h.addressable = (nh.frame >> 28) & 0x1; // 1
-    h.tagged = (nh.frame >> 29) & 0x1; //1
-    h.origin = (nh.frame >> 30) & 0x3; // 2
-    h.source = (nh.frame >> 32) & 0xFFFFFFFF; //32
-
-    return std::move(h);
-#else
-    return nh;
-#endif
+    return wire::DecodeHeader(reinterpret_cast<const char*>(&nh));
   }
 
 } // namespace lifx
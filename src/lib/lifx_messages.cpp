@@ -105,6 +105,9 @@ namespace message
     constexpr uint16_t SetColor::type;
     constexpr bool SetColor::has_response;
 
+    constexpr uint16_t SetWaveform::type;
+    constexpr bool SetWaveform::has_response;
+
     constexpr uint16_t State::type;
     constexpr bool State::has_response;
 
@@ -116,8 +119,44 @@ namespace message
 
     constexpr uint16_t StatePower::type;
     constexpr bool StatePower::has_response;
+
+    constexpr uint16_t SetWaveformOptional::type;
+    constexpr bool SetWaveformOptional::has_response;
   } // namespace light
 
+  namespace multizone
+  {
+    constexpr uint16_t SetColorZones::type;
+    constexpr bool SetColorZones::has_response;
+
+    constexpr uint16_t GetColorZones::type;
+    constexpr bool GetColorZones::has_response;
+
+    constexpr uint16_t StateZone::type;
+    constexpr bool StateZone::has_response;
+
+    constexpr uint16_t StateMultiZone::type;
+    constexpr bool StateMultiZone::has_response;
+  } // namespace multizone
+
+  namespace tile
+  {
+    constexpr uint16_t GetDeviceChain::type;
+    constexpr bool GetDeviceChain::has_response;
+
+    constexpr uint16_t StateDeviceChain::type;
+    constexpr bool StateDeviceChain::has_response;
+
+    constexpr uint16_t Get64::type;
+    constexpr bool Get64::has_response;
+
+    constexpr uint16_t State64::type;
+    constexpr bool State64::has_response;
+
+    constexpr uint16_t Set64::type;
+    constexpr bool Set64::has_response;
+  } // namespace tile
+
 } // namespace message
 
 } // namespace lifx
@@ -0,0 +1,232 @@
+/////
+// loopback.cpp
+//! @file In-process network with fault injection implementation
+/////
+
+#include <lib-lifx/loopback.h>
+
+#include <algorithm>
+
+namespace lifx
+{
+  LoopbackNetwork::LoopbackNetwork(uint32_t seed)
+    : m_stats()
+    , m_random(seed)
+    , m_now(0)
+  {
+  }
+
+  uint32_t LoopbackNetwork::Attach()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_endpoints.push_back({ { }, true });
+    return static_cast<uint32_t>(m_endpoints.size() - 1);
+  }
+
+  void LoopbackNetwork::Detach(uint32_t address)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (address >= m_endpoints.size())
+      return;
+
+    m_endpoints[address].attached = false;
+    m_endpoints[address].queue.clear();
+  }
+
+  void LoopbackNetwork::Send(uint32_t from, uint32_t to, const char* data,
+    size_t length)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (to != LOOPBACK_BROADCAST)
+    {
+      if (to < m_endpoints.size() && m_endpoints[to].attached)
+      {
+        Enqueue(m_endpoints[to], from, data, length);
+      }
+      return;
+    }
+
+    for (uint32_t address = 0; address < m_endpoints.size(); ++address)
+    {
+      if (address != from && m_endpoints[address].attached)
+      {
+        Enqueue(m_endpoints[address], from, data, length);
+      }
+    }
+  }
+
+  size_t LoopbackNetwork::Deliver(uint32_t address, const Handler& handler)
+  {
+    // Handlers may send, so they run once the network is unlocked
+    std::vector<Packet> arrived;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (address >= m_endpoints.size())
+        return 0;
+
+      auto& queue = m_endpoints[address].queue;
+      while (!queue.empty() && queue.front().due <= m_now)
+      {
+        arrived.push_back(std::move(queue.front()));
+        queue.pop_front();
+      }
+      m_stats.delivered += arrived.size();
+    }
+
+    for (const auto& packet : arrived)
+    {
+      handler(packet.from, packet.data.data(), packet.data.size());
+    }
+    return arrived.size();
+  }
+
+  void LoopbackNetwork::Advance(std::chrono::nanoseconds time)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_now += time;
+  }
+
+  std::chrono::nanoseconds LoopbackNetwork::Now() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_now;
+  }
+
+  void LoopbackNetwork::SetFaults(const LoopbackFaults& faults)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_faults = faults;
+  }
+
+  LoopbackStats LoopbackNetwork::Stats() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+  }
+
+  size_t LoopbackNetwork::InFlight() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t inFlight = 0;
+    for (const auto& endpoint : m_endpoints)
+    {
+      inFlight += endpoint.queue.size();
+    }
+    return inFlight;
+  }
+
+  void LoopbackNetwork::Enqueue(Endpoint& endpoint, uint32_t from,
+    const char* data, size_t length)
+  {
+    ++m_stats.sent;
+    if (Chance() < m_faults.loss)
+    {
+      ++m_stats.lost;
+      return;
+    }
+
+    int copies = 1;
+    if (Chance() < m_faults.duplicate)
+    {
+      ++m_stats.duplicated;
+      ++copies;
+    }
+
+    auto& queue = endpoint.queue;
+    for (int copy = 0; copy < copies; ++copy)
+    {
+      Packet packet = { m_now + m_faults.delay, from,
+        std::vector<char>(data, data + length) };
+      if (m_faults.jitter.count() > 0)
+      {
+        packet.due += std::chrono::microseconds(
+          m_random() % (m_faults.jitter.count() + 1));
+      }
+
+      // Queues stay sorted by arrival, earlier sends first on a tie
+      auto position = std::upper_bound(queue.begin(), queue.end(), packet.due,
+        [](std::chrono::nanoseconds due, const Packet& queued)
+      {
+        return due < queued.due;
+      });
+      if (position != queue.begin() && Chance() < m_faults.reorder)
+      {
+        --position;
+        packet.due = std::min(packet.due, position->due);
+        ++m_stats.reordered;
+      }
+      queue.insert(position, std::move(packet));
+    }
+  }
+
+  double LoopbackNetwork::Chance()
+  {
+    // Scaled by hand, distributions differ between standard libraries
+    return static_cast<double>(m_random()) / 4294967296.0;
+  }
+
+  LoopbackTransport::LoopbackTransport(LoopbackNetwork& network,
+    uint32_t destination)
+    : m_network(network)
+    , m_address(network.Attach())
+    , m_destination(destination)
+    , m_routing(false)
+  {
+  }
+
+  LoopbackTransport::~LoopbackTransport()
+  {
+    m_network.Detach(m_address);
+  }
+
+  int LoopbackTransport::Send(const char* data, size_t length)
+  {
+    if (length == 0)
+      return 0;
+
+    auto destination = m_destination;
+    if (m_routing && length >= LIFX_HEADER_SIZE)
+    {
+      auto route = m_routes.find(TargetKey(
+        reinterpret_cast<const uint8_t*>(data + HEADER_TARGET_OFFSET)));
+      if (route != m_routes.end())
+      {
+        destination = route->second;
+      }
+    }
+    m_network.Send(m_address, destination, data, length);
+    return static_cast<int>(length);
+  }
+
+  int LoopbackTransport::Receive(std::chrono::microseconds,
+    const ReceiveHandler& handler)
+  {
+    return static_cast<int>(m_network.Deliver(m_address,
+      [this, &handler](uint32_t from, const char* data, size_t length)
+    {
+      // Devices put their own MAC in the target of what they send
+      if (m_routing && length >= LIFX_HEADER_SIZE)
+      {
+        auto target = TargetKey(
+          reinterpret_cast<const uint8_t*>(data + HEADER_TARGET_OFFSET));
+        if (target != 0)
+        {
+          m_routes[target] = from;
+        }
+      }
+      handler({ data, length, false, 0 });
+    }));
+  }
+
+  uint32_t LoopbackTransport::Address() const
+  {
+    return m_address;
+  }
+
+  void LoopbackTransport::SetRouting(bool enabled)
+  {
+    m_routing = enabled;
+    m_routes.clear();
+  }
+
+} // namespace lifx
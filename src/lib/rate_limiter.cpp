@@ -0,0 +1,74 @@
+/////
+// rate_limiter.cpp
+//! @file Token bucket rate limiter implementation
+/////
+
+#include <lib-lifx/rate_limiter.h>
+
+#include <algorithm>
+
+namespace
+{
+  // Tokens are counted in units of 1/perSecond nanoseconds so refilling
+  // never loses fractions of a token
+  constexpr uint64_t TOKEN_SCALE = 1000000000ull;
+}
+
+namespace lifx
+{
+  RateLimiter::RateLimiter(uint32_t perSecond, uint32_t burst)
+    : m_perSecond(std::max<uint32_t>(perSecond, 1))
+    , m_burst(std::max<uint32_t>(burst, 1))
+    , m_tokens(static_cast<uint64_t>(m_burst) * TOKEN_SCALE)
+    , m_lastRefill(Clock::now())
+  {
+  }
+
+  bool RateLimiter::Ready(Clock::time_point now)
+  {
+    Refill(now);
+    return m_tokens >= TOKEN_SCALE;
+  }
+
+  bool RateLimiter::Acquire(Clock::time_point now)
+  {
+    if (!Ready(now))
+      return false;
+
+    m_tokens -= TOKEN_SCALE;
+    return true;
+  }
+
+  RateLimiter::Clock::duration RateLimiter::Delay(Clock::time_point now)
+  {
+    if (Ready(now))
+      return Clock::duration::zero();
+
+    // Rounded up, so waiting this long always leaves a whole token
+    auto missing = TOKEN_SCALE - m_tokens;
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(
+      (missing + m_perSecond - 1) / m_perSecond));
+  }
+
+  void RateLimiter::SetRate(uint32_t perSecond, uint32_t burst)
+  {
+    m_perSecond = std::max<uint32_t>(perSecond, 1);
+    m_burst = std::max<uint32_t>(burst, 1);
+    m_tokens = std::min(m_tokens, static_cast<uint64_t>(m_burst) * TOKEN_SCALE);
+  }
+
+  void RateLimiter::Refill(Clock::time_point now)
+  {
+    if (now <= m_lastRefill)
+      return;
+
+    // Anything longer than it takes to fill the bucket doesn't matter
+    auto elapsed = std::min(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now - m_lastRefill).count()), m_burst * TOKEN_SCALE / m_perSecond + 1);
+    m_tokens = std::min(m_tokens + elapsed * m_perSecond,
+      static_cast<uint64_t>(m_burst) * TOKEN_SCALE);
+    m_lastRefill = now;
+  }
+
+} // namespace lifx
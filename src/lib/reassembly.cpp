@@ -0,0 +1,216 @@
+/////
+// reassembly.cpp
+//! @file Multi-packet response reassembly implementation
+/////
+
+#include <lib-lifx/reassembly.h>
+
+#include <algorithm>
+
+namespace lifx
+{
+  Reassembler::Reassembler(LifxClient& client,
+    std::chrono::milliseconds timeout)
+    : m_client(client)
+    , m_timeout(std::move(timeout))
+    , m_assemblies()
+    , m_subscriptions()
+  {
+    m_subscriptions[0] = m_client.Subscribe<message::multizone::StateZone>(
+      [this](const Header& header, const message::multizone::StateZone& msg)
+    {
+      auto assembly = Find(header, message::multizone::StateMultiZone::type);
+      if (assembly == nullptr)
+        return;
+
+      if (msg.count > assembly->first &&
+        msg.count - assembly->first < assembly->count)
+      {
+        assembly->count = msg.count - assembly->first;
+      }
+      Store(*assembly, msg.index, &msg.color, 1);
+    });
+
+    m_subscriptions[1] = m_client.Subscribe<message::multizone::StateMultiZone>(
+      [this](const Header& header,
+        const message::multizone::StateMultiZone& msg)
+    {
+      auto assembly = Find(header, message::multizone::StateMultiZone::type);
+      if (assembly == nullptr)
+        return;
+
+      // Devices report fewer zones than requested when the range runs
+      // past the end of the strip
+      if (msg.count > assembly->first &&
+        msg.count - assembly->first < assembly->count)
+      {
+        assembly->count = msg.count - assembly->first;
+      }
+      Store(*assembly, msg.index, msg.color, 8);
+    });
+
+    m_subscriptions[2] = m_client.Subscribe<message::tile::State64>(
+      [this](const Header& header, const message::tile::State64& msg)
+    {
+      auto assembly = Find(header, message::tile::State64::type);
+      if (assembly == nullptr)
+        return;
+
+      Store(*assembly, msg.tile_index * 64, msg.colors, 64);
+    });
+  }
+
+  Reassembler::~Reassembler()
+  {
+    for (auto subscription : m_subscriptions)
+    {
+      m_client.Unsubscribe(subscription);
+    }
+  }
+
+  uint8_t Reassembler::GetColorZones(const uint8_t target[8],
+    uint8_t startIndex, uint8_t endIndex, HSBK* buffer, size_t capacity,
+    ReassemblyCallback callback)
+  {
+    uint16_t count = (endIndex >= startIndex) ? (endIndex - startIndex + 1) : 0;
+    auto assembly = Allocate();
+    if (assembly == nullptr || count == 0 || capacity < count)
+      return 0;
+
+    message::multizone::GetColorZones request = { startIndex, endIndex };
+    auto sequence = m_client.Send(request, target);
+    Track(*assembly, target, sequence, message::multizone::StateMultiZone::type,
+      startIndex, count, buffer, std::move(callback));
+    return sequence;
+  }
+
+  uint8_t Reassembler::Get64(const uint8_t target[8], uint8_t tileIndex,
+    uint8_t length, HSBK* buffer, size_t capacity, ReassemblyCallback callback)
+  {
+    uint16_t count = length * 64;
+    auto assembly = Allocate();
+    if (assembly == nullptr || count == 0 || capacity < count ||
+      count > MAX_REASSEMBLY_COLORS)
+    {
+      return 0;
+    }
+
+    message::tile::Get64 request = { };
+    request.tile_index = tileIndex;
+    request.length = length;
+    request.width = 8;
+    auto sequence = m_client.Send(request, target);
+    Track(*assembly, target, sequence, message::tile::State64::type,
+      tileIndex * 64, count, buffer, std::move(callback));
+    return sequence;
+  }
+
+  void Reassembler::Update()
+  {
+    auto now = std::chrono::steady_clock::now();
+    for (auto& assembly : m_assemblies)
+    {
+      if (assembly.active && now >= assembly.deadline)
+      {
+        Finish(assembly, false);
+      }
+    }
+  }
+
+  size_t Reassembler::Pending() const
+  {
+    size_t pending = 0;
+    for (const auto& assembly : m_assemblies)
+    {
+      pending += assembly.active ? 1 : 0;
+    }
+    return pending;
+  }
+
+  Reassembler::Assembly* Reassembler::Allocate()
+  {
+    for (auto& assembly : m_assemblies)
+    {
+      if (!assembly.active)
+        return &assembly;
+    }
+    return nullptr;
+  }
+
+  void Reassembler::Track(Assembly& assembly, const uint8_t target[8],
+    uint8_t sequence, uint16_t type, uint16_t first, uint16_t count,
+    HSBK* buffer, ReassemblyCallback callback)
+  {
+    assembly.active = true;
+    memcpy(assembly.target, target, sizeof(assembly.target));
+    assembly.sequence = sequence;
+    assembly.type = type;
+    assembly.first = first;
+    assembly.count = count;
+    assembly.buffer = buffer;
+    assembly.received.reset();
+    assembly.receivedCount = 0;
+    assembly.deadline = std::chrono::steady_clock::now() + m_timeout;
+    assembly.callback = std::move(callback);
+  }
+
+  Reassembler::Assembly* Reassembler::Find(const Header& header, uint16_t type)
+  {
+    for (auto& assembly : m_assemblies)
+    {
+      if (assembly.active &&
+        assembly.type == type &&
+        assembly.sequence == header.sequence &&
+        memcmp(assembly.target, header.target, sizeof(assembly.target)) == 0)
+      {
+        return &assembly;
+      }
+    }
+    return nullptr;
+  }
+
+  void Reassembler::Store(Assembly& assembly, uint16_t index,
+    const HSBK* colors, uint16_t count)
+  {
+    for (uint16_t i = 0; i < count; ++i)
+    {
+      uint16_t position = index + i;
+      if (position < assembly.first ||
+        position - assembly.first >= assembly.count)
+      {
+        continue;
+      }
+
+      position -= assembly.first;
+      assembly.buffer[position] = colors[i];
+      if (!assembly.received.test(position))
+      {
+        assembly.received.set(position);
+        ++assembly.receivedCount;
+      }
+    }
+
+    if (assembly.receivedCount >= assembly.count)
+    {
+      Finish(assembly, true);
+    }
+  }
+
+  void Reassembler::Finish(Assembly& assembly, bool complete)
+  {
+    // The callback may start another request, which can take over the slot
+    // while the callback still reads what it was given
+    uint8_t target[8];
+    std::copy(assembly.target, assembly.target + 8, target);
+    auto* buffer = assembly.buffer;
+    auto count = assembly.count;
+    auto callback = std::move(assembly.callback);
+    assembly.callback = nullptr;
+    assembly.active = false;
+    if (callback)
+    {
+      callback(target, buffer, count, complete);
+    }
+  }
+
+} // namespace lifx
@@ -0,0 +1,59 @@
+/////
+// scene.cpp
+//! @file Prebuilt scenes of messages implementation
+/////
+
+#include <lib-lifx/scene.h>
+
+#include <unordered_map>
+
+namespace lifx
+{
+  size_t Scene::Size() const
+  {
+    return m_entries.size();
+  }
+
+  const Scene::Entry& Scene::GetEntry(size_t index) const
+  {
+    return m_entries[index];
+  }
+
+  SceneBuilder::SceneBuilder(uint32_t sourceId)
+    : m_sourceId(std::move(sourceId))
+  {
+  }
+
+  std::shared_ptr<const Scene> SceneBuilder::Build() const
+  {
+    // Group the messages by device, keeping the order devices first appear in
+    std::vector<std::vector<size_t>> devices;
+    std::unordered_map<uint64_t, size_t> deviceIndex;
+    for (size_t i = 0; i < m_entries.size(); ++i)
+    {
+      auto inserted = deviceIndex.emplace(m_entries[i].device, devices.size());
+      if (inserted.second)
+      {
+        devices.emplace_back();
+      }
+      devices[inserted.first->second].push_back(i);
+    }
+
+    // Take one message per device per round
+    auto scene = std::make_shared<Scene>();
+    scene->m_entries.reserve(m_entries.size());
+    for (size_t round = 0; scene->m_entries.size() < m_entries.size(); ++round)
+    {
+      for (const auto& device : devices)
+      {
+        if (round < device.size())
+        {
+          scene->m_entries.push_back(m_entries[device[round]]);
+        }
+      }
+    }
+
+    return scene;
+  }
+
+} // namespace lifx
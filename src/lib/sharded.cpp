@@ -0,0 +1,145 @@
+/////
+// sharded.cpp
+//! @file Controller that spreads devices over several client threads
+/////
+
+#include <lib-lifx/sharded.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace lifx
+{
+  ShardedController::ShardedController(size_t shards,
+    const TransportFactory& factory, uint32_t sourceId)
+    : m_sourceId(sourceId)
+    , m_running(true)
+  {
+    shards = std::max<size_t>(shards, 1);
+    for (size_t i = 0; i < shards; ++i)
+    {
+      std::unique_ptr<Shard> shard(new Shard());
+      shard->client.reset(new LifxClient(factory(i), SourceOf(i)));
+      // Another shard's broadcasts are answered to it, not to this one
+      shard->client->FilterSources(true);
+      m_shards.push_back(std::move(shard));
+    }
+
+    // Threads start once every shard exists, tasks may post to the others
+    for (auto& shard : m_shards)
+    {
+      auto* current = shard.get();
+      shard->thread = std::thread([this, current]() { Run(*current); });
+    }
+  }
+
+  ShardedController::ShardedController(size_t shards, TransportType type,
+    uint32_t sourceId, const char* destination, uint16_t destinationPort)
+    : ShardedController(shards, [type, destination, destinationPort](size_t)
+      {
+        return CreateTransport(type, EPHEMERAL_PORT, destination,
+          destinationPort);
+      }, sourceId)
+  {
+  }
+
+  ShardedController::~ShardedController()
+  {
+    Stop();
+  }
+
+  size_t ShardedController::ShardCount() const
+  {
+    return m_shards.size();
+  }
+
+  size_t ShardedController::ShardOf(const uint8_t target[8]) const
+  {
+    // MACs share their vendor prefix and differ in their high bytes, which
+    // the multiply only mixes into the top of the product
+    auto hash = (TargetKey(target) * 0x9E3779B97F4A7C15ull) >> 32;
+    return static_cast<size_t>((hash * m_shards.size()) >> 32);
+  }
+
+  uint32_t ShardedController::SourceOf(size_t shard) const
+  {
+    return m_sourceId + static_cast<uint32_t>(shard);
+  }
+
+  void ShardedController::Post(size_t shard, Task task)
+  {
+    auto& target = *m_shards[shard];
+    std::lock_guard<std::mutex> lock(target.mutex);
+    target.tasks.push_back(std::move(task));
+  }
+
+  void ShardedController::Post(const uint8_t target[8], Task task)
+  {
+    Post(ShardOf(target), std::move(task));
+  }
+
+  void ShardedController::PostAll(const Task& task)
+  {
+    for (size_t shard = 0; shard < m_shards.size(); ++shard)
+    {
+      Post(shard, task);
+    }
+  }
+
+  void ShardedController::SetRateLimits(uint32_t perSecond,
+    uint32_t devicePerSecond)
+  {
+    auto shares = static_cast<uint64_t>(m_shards.size());
+    auto share = static_cast<uint32_t>(std::max<uint64_t>(
+      (perSecond + shares - 1) / shares, 1));
+    PostAll([share, devicePerSecond](LifxClient& client)
+    {
+      client.SetRateLimits(share, devicePerSecond);
+    });
+  }
+
+  void ShardedController::Stop()
+  {
+    m_running.store(false, std::memory_order_release);
+    for (auto& shard : m_shards)
+    {
+      if (shard->thread.joinable())
+      {
+        shard->thread.join();
+      }
+    }
+  }
+
+  void ShardedController::Run(Shard& shard)
+  {
+    std::vector<Task> posted;
+    std::deque<Task> tasks;
+    auto& client = *shard.client;
+    while (m_running.load(std::memory_order_acquire))
+    {
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        posted.swap(shard.tasks);
+      }
+      std::move(posted.begin(), posted.end(), std::back_inserter(tasks));
+      posted.clear();
+
+      bool ran = false;
+      while (!tasks.empty() && client.PendingSendCount() < SHARD_QUEUE_LIMIT)
+      {
+        tasks.front()(client);
+        tasks.pop_front();
+        ran = true;
+      }
+
+      // Only wait for packets when there is nothing else to do
+      auto result = client.RunOnce(0, ran ? 0 : SHARD_POLL_MILLISECONDS);
+      if (result == LifxClient::RunResult::RUN_WAITING && !ran)
+      {
+        // Transports that never wait would otherwise hog the CPU
+        std::this_thread::yield();
+      }
+    }
+  }
+
+} // namespace lifx
@@ -0,0 +1,179 @@
+/////
+// simulator.cpp
+//! @file Simulated LIFX devices implementation
+/////
+
+#include <lib-lifx/simulator.h>
+
+#include <lib-lifx/codec.h>
+#include <lib-lifx/registry.h>
+
+#include <array>
+
+#include <string.h>
+
+namespace lifx
+{
+  using namespace message;
+
+  SimulatedDevice::SimulatedDevice(LoopbackNetwork& network,
+    const uint8_t target[8], const char* label)
+    : m_network(network)
+    , m_address(network.Attach())
+    , m_replyTo(0)
+    , m_light()
+    , m_group()
+    , m_location()
+    , m_handled(0)
+  {
+    memcpy(m_target, target, sizeof(m_target));
+    // Labels fill the field without a terminator when they are 32 long
+    memcpy(m_light.label, label, strnlen(label, sizeof(m_light.label)));
+  }
+
+  SimulatedDevice::~SimulatedDevice()
+  {
+    m_network.Detach(m_address);
+  }
+
+  template<typename T>
+  void SimulatedDevice::Reply(const Header& request, const T& message)
+  {
+    std::array<char, MAX_LIFX_PACKET_SIZE> buffer;
+    HeaderOptions options;
+    options.target = m_target;
+    options.source = request.source;
+    options.sequence = request.sequence;
+    options.resRequired = false;
+    auto length = EncodeInto(buffer.data(), buffer.size(), message, options);
+    m_network.Send(m_address, m_replyTo, buffer.data(), length);
+  }
+
+  template<typename T>
+  void SimulatedDevice::Handle(const Header&, const T&)
+  {
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetService&)
+  {
+    Reply(header, device::StateService { SERVICE_UDP, LIFX_PORT });
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetPower&)
+  {
+    Reply(header, device::StatePower { m_light.power });
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::SetPower& msg)
+  {
+    m_light.power = msg.level;
+    if (header.res_required)
+    {
+      Reply(header, device::StatePower { m_light.power });
+    }
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetLabel&)
+  {
+    device::StateLabel label;
+    memcpy(label.label, m_light.label, sizeof(label.label));
+    Reply(header, label);
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::SetLabel& msg)
+  {
+    memcpy(m_light.label, msg.label, sizeof(m_light.label));
+    if (header.res_required)
+    {
+      Handle(header, device::GetLabel());
+    }
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetInfo&)
+  {
+    auto now = static_cast<uint64_t>(m_network.Now().count());
+    Reply(header, device::StateInfo { now, now, 0 });
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetLocation&)
+  {
+    Reply(header, m_location);
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const device::GetGroup&)
+  {
+    Reply(header, m_group);
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header,
+    const device::EchoRequest& msg)
+  {
+    Reply(header, device::EchoResponse { msg.payload });
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const light::Get&)
+  {
+    Reply(header, m_light);
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const light::SetColor& msg)
+  {
+    m_light.color = msg.color;
+    if (header.res_required)
+    {
+      Reply(header, m_light);
+    }
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const light::GetPower&)
+  {
+    Reply(header, light::StatePower { m_light.power });
+  }
+
+  template<>
+  void SimulatedDevice::Handle(const Header& header, const light::SetPower& msg)
+  {
+    m_light.power = msg.level;
+    if (header.res_required)
+    {
+      Reply(header, light::StatePower { m_light.power });
+    }
+  }
+
+  size_t SimulatedDevice::Poll()
+  {
+    return m_network.Deliver(m_address,
+      [this](uint32_t from, const char* data, size_t length)
+    {
+      Dispatcher<DefaultMessages>::Decode(data, length,
+        [this, from](const Header& header, const auto& msg)
+      {
+        // Devices act on broadcasts and on packets for their own MAC
+        auto target = TargetKey(header.target);
+        if (target != 0 && target != TargetKey(m_target))
+          return;
+
+        ++m_handled;
+        m_replyTo = from;
+        if (header.ack_required)
+        {
+          Reply(header, device::Acknowledgement());
+        }
+        Handle(header, msg);
+      });
+    });
+  }
+
+} // namespace lifx
@@ -0,0 +1,113 @@
+/////
+// sync.cpp
+//! @file Device clock synchronization implementation
+/////
+
+#include <lib-lifx/sync.h>
+
+namespace lifx
+{
+  ClockSync::ClockSync(LifxClient& client)
+    : m_client(client)
+    , m_estimates()
+    , m_samples()
+    , m_subscription(0)
+  {
+    m_subscription = m_client.Subscribe<message::device::StateInfo>(
+      [this](const Header& header, const message::device::StateInfo& msg)
+    {
+      // Other controllers and other requests reuse the same sequences, so
+      // only the latest sample sent to this device under it counts
+      if (header.source != m_client.SourceId())
+        return;
+      auto outstanding = m_samples.find(header.sequence);
+      if (outstanding == m_samples.end() ||
+        outstanding->second != TargetKey(header.target))
+        return;
+      m_samples.erase(outstanding);
+
+      auto received = m_client.ReceiveTime();
+      if (received == 0)
+      {
+        received = Now();
+      }
+      auto sent = m_client.SendTime(header.sequence);
+      if (sent == 0 || sent > received)
+        return;
+
+      // Assume the device read its clock halfway through the round trip
+      Estimate sample = { };
+      sample.rtt = received - sent;
+      sample.offset = static_cast<int64_t>(msg.time - (sent + sample.rtt / 2));
+
+      auto key = TargetKey(header.target);
+      auto estimate = m_estimates.find(key);
+      if (estimate == m_estimates.end() || sample.rtt <= estimate->second.rtt)
+      {
+        m_estimates[key] = sample;
+      }
+    });
+  }
+
+  ClockSync::~ClockSync()
+  {
+    m_client.Unsubscribe(m_subscription);
+  }
+
+  uint64_t ClockSync::Now()
+  {
+    return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+  }
+
+  uint8_t ClockSync::Sample(const uint8_t target[8])
+  {
+    auto sequence = m_client.Send<message::device::GetInfo>(target);
+    m_samples[sequence] = TargetKey(target);
+    return sequence;
+  }
+
+  bool ClockSync::GetEstimate(const uint8_t target[8],
+    Estimate& estimate) const
+  {
+    auto iter = m_estimates.find(TargetKey(target));
+    if (iter == m_estimates.end())
+      return false;
+
+    estimate = iter->second;
+    return true;
+  }
+
+  uint64_t ClockSync::ToDeviceTime(const uint8_t target[8],
+    uint64_t localTime) const
+  {
+    Estimate estimate;
+    if (!GetEstimate(target, estimate))
+      return localTime;
+
+    return static_cast<uint64_t>(static_cast<int64_t>(localTime) + estimate.offset);
+  }
+
+  uint64_t ClockSync::LeadTime(size_t count,
+    std::chrono::milliseconds margin) const
+  {
+    // Everything queued, including these messages and what is left of
+    // applied scenes, shares the client's rate limit; counting all of it
+    // keeps the last device from hearing about its message too late
+    uint64_t queued = m_client.PendingSendCount() +
+      m_client.PendingSceneCount() + count;
+    uint64_t drain = queued * 1000000000ull /
+      std::max<uint32_t>(m_client.RateLimit(), 1);
+
+    uint64_t rtt = 0;
+    for (const auto& estimate : m_estimates)
+    {
+      rtt = std::max(rtt, estimate.second.rtt);
+    }
+
+    return drain + rtt / 2 + static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(margin).count());
+  }
+
+} // namespace lifx
@@ -0,0 +1,98 @@
+/////
+// tile.cpp
+//! @file Tile frame buffer implementation
+/////
+
+#include <lib-lifx/tile.h>
+
+#include <algorithm>
+
+namespace lifx
+{
+  TileFrameBuffer::TileFrameBuffer(LifxClient& client, const uint8_t target[8],
+    uint8_t tileCount)
+    : m_client(client)
+    , m_frame(tileCount)
+    , m_committed(tileCount)
+    , m_committedValid(tileCount, false)
+    , m_sequences(tileCount, 0)
+  {
+    memcpy(m_target.data(), target, m_target.size());
+    Fill({ 0, 0, 0, 0 });
+  }
+
+  uint8_t TileFrameBuffer::TileCount() const
+  {
+    return static_cast<uint8_t>(m_frame.size());
+  }
+
+  void TileFrameBuffer::SetPixel(uint8_t tile, uint8_t x, uint8_t y,
+    const HSBK& color)
+  {
+    m_frame[tile][y * TILE_WIDTH + x] = color;
+  }
+
+  const HSBK& TileFrameBuffer::GetPixel(uint8_t tile, uint8_t x,
+    uint8_t y) const
+  {
+    return m_frame[tile][y * TILE_WIDTH + x];
+  }
+
+  TileFrameBuffer::TileColors& TileFrameBuffer::GetTile(uint8_t tile)
+  {
+    return m_frame[tile];
+  }
+
+  void TileFrameBuffer::Fill(const HSBK& color)
+  {
+    for (auto& tile : m_frame)
+    {
+      tile.fill(color);
+    }
+  }
+
+  size_t TileFrameBuffer::Commit(uint32_t duration)
+  {
+    size_t queued = 0;
+
+    for (uint8_t i = 0; i < TileCount(); ++i)
+    {
+      if (m_committedValid[i] &&
+        memcmp(m_frame[i].data(), m_committed[i].data(),
+          sizeof(TileColors)) == 0)
+      {
+        continue;
+      }
+
+      message::tile::Set64 set = { };
+      set.tile_index = i;
+      set.length = 1;
+      set.x = 0;
+      set.y = 0;
+      set.width = TILE_WIDTH;
+      set.duration = duration;
+      memcpy(set.colors, m_frame[i].data(), sizeof(set.colors));
+
+      // A frame that hasn't gone out yet is stale now, so overwrite it in
+      // the queue rather than queueing the newer one behind it. Once it has
+      // gone out, its sequence may carry another tile's frame
+      if (m_sequences[i] == 0 ||
+        !m_client.Replace(m_sequences[i], set, m_target.data(),
+          [i](const message::tile::Set64& queued) { return queued.tile_index == i; }))
+      {
+        m_sequences[i] = m_client.Send(set, m_target.data());
+      }
+      m_committed[i] = m_frame[i];
+      m_committedValid[i] = true;
+      ++queued;
+    }
+
+    return queued;
+  }
+
+  void TileFrameBuffer::Invalidate()
+  {
+    std::fill(m_committedValid.begin(), m_committedValid.end(), false);
+  }
+
+} // namespace lifx
@@ -0,0 +1,362 @@
+/////
+// transport.cpp
+//! @file UDP socket transport implementation
+/////
+
+#include <lib-lifx/transport.h>
+
+#include <algorithm>
+#include <array>
+#include <thread>
+
+#ifdef _WIN32
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include <string.h>
+
+namespace
+{
+  constexpr int sockAddrLen = sizeof(sockaddr_in);
+#ifdef _WIN32
+  using socklen_t = int;
+#endif
+
+  //! Finds the addresses our own broadcasts come back from.
+  std::vector<uint32_t> FindLocalAddresses()
+  {
+    std::vector<uint32_t> local_addrs;
+    local_addrs.push_back(htonl(INADDR_LOOPBACK));
+#ifdef _WIN32
+    char hostname[256] = { };
+    struct addrinfo hints = { };
+    struct addrinfo* addrs = nullptr;
+    hints.ai_family = AF_INET;
+    if (gethostname(hostname, sizeof(hostname)) != 0 ||
+      getaddrinfo(hostname, nullptr, &hints, &addrs) != 0)
+      return local_addrs;
+
+    for (auto addr = addrs; addr != nullptr; addr = addr->ai_next)
+    {
+      local_addrs.push_back(
+        reinterpret_cast<sockaddr_in*>(addr->ai_addr)->sin_addr.s_addr);
+    }
+    freeaddrinfo(addrs);
+#else
+    struct ifaddrs* addrs = nullptr;
+    if (getifaddrs(&addrs) != 0)
+      return local_addrs;
+
+    for (auto addr = addrs; addr != nullptr; addr = addr->ifa_next)
+    {
+      if (addr->ifa_addr != nullptr && addr->ifa_addr->sa_family == AF_INET)
+      {
+        local_addrs.push_back(
+          reinterpret_cast<sockaddr_in*>(addr->ifa_addr)->sin_addr.s_addr);
+      }
+    }
+    freeifaddrs(addrs);
+#endif
+    return local_addrs;
+  }
+
+  //! Pins the calling thread to a CPU.
+  bool PinThread(int cpu)
+  {
+#if defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(),
+      static_cast<DWORD_PTR>(1) << cpu) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+  }
+
+  //! Reads a datagram and the time the kernel received it.
+  //! @param[out] timestamp Nanoseconds since the epoch, or 0 if unknown.
+  int ReceiveFrom(lifx::SocketHandle socket, char* buffer, size_t size,
+    sockaddr_in& sender, uint64_t& timestamp)
+  {
+    timestamp = 0;
+#ifdef _WIN32
+    socklen_t senderLen = sockAddrLen;
+    return recvfrom(socket, buffer, static_cast<int>(size), 0,
+      (struct sockaddr*)&sender, &senderLen);
+#else
+    struct iovec iov = { buffer, size };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(timespec))];
+    struct msghdr msg = { };
+    msg.msg_name = &sender;
+    msg.msg_namelen = sockAddrLen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto received = recvmsg(socket, &msg, 0);
+    if (received < 0)
+      return -1;
+
+#ifdef SO_TIMESTAMPNS
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+      {
+        struct timespec time;
+        memcpy(&time, CMSG_DATA(cmsg), sizeof(time));
+        timestamp = static_cast<uint64_t>(time.tv_sec) * 1000000000 +
+          static_cast<uint64_t>(time.tv_nsec);
+      }
+    }
+#endif
+    return static_cast<int>(received);
+#endif
+  }
+
+  //! Checks if a receive failed only because nothing was waiting.
+  bool WouldBlock()
+  {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+  }
+}
+
+namespace lifx
+{
+  SocketTransport::SocketTransport(uint16_t port, const char* destination,
+    uint16_t destinationPort)
+    : m_destinationAddress(htonl(INADDR_BROADCAST))
+    , m_destinationPort(htons(destinationPort))
+    , m_localPort(0)
+    , m_spin(false)
+    , m_yield(false)
+    , m_pinCpu(-1)
+  {
+    // TODO: Error checking
+
+#ifdef _WIN32
+    // Start WinSock
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+
+    if (destination != nullptr)
+    {
+      inet_pton(AF_INET, destination, &m_destinationAddress);
+    }
+
+    // Setup addresses
+    struct sockaddr_in listen_addr = { };
+    listen_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listen_addr.sin_port = htons(port);
+    listen_addr.sin_family = AF_INET;
+
+    // Create our actual socket
+    m_socket = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    // Allow this socket to broadcast
+    int yes = 1;
+    setsockopt(m_socket, SOL_SOCKET, SO_BROADCAST, (const char*)&yes, sizeof(int));
+
+    // Allow this socket to reuse addresses
+    setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(int));
+
+#ifdef SO_TIMESTAMPNS
+    // Have the kernel stamp datagrams as they arrive, so latencies don't
+    // include the time they waited for us
+    setsockopt(m_socket, SOL_SOCKET, SO_TIMESTAMPNS, (const char*)&yes, sizeof(int));
+#endif
+
+    // Bind the socket to our listening address
+    bind(m_socket, (struct sockaddr*)&listen_addr, sockAddrLen);
+
+    // Remember where our own packets come from, the port may have been
+    // picked by the OS
+    struct sockaddr_in bound_addr = { };
+    socklen_t boundLen = sockAddrLen;
+    getsockname(m_socket, (struct sockaddr*)&bound_addr, &boundLen);
+    m_localPort = bound_addr.sin_port;
+    m_localAddresses = FindLocalAddresses();
+  }
+
+  SocketTransport::~SocketTransport()
+  {
+#ifdef _WIN32
+    // Close the socket
+    closesocket(m_socket);
+    // Stop WinSock
+    WSACleanup();
+#else
+    // Close the socket
+    close(m_socket);
+#endif
+  }
+
+  int SocketTransport::Send(const char* data, size_t length)
+  {
+    if (length == 0)
+      return 0;
+
+    struct sockaddr_in send_addr = { };
+    send_addr.sin_addr.s_addr = m_destinationAddress;
+    send_addr.sin_port = m_destinationPort;
+    send_addr.sin_family = AF_INET;
+    return static_cast<int>(sendto(m_socket, data, static_cast<int>(length), 0,
+      (struct sockaddr*)&send_addr, sockAddrLen));
+  }
+
+  int SocketTransport::Receive(std::chrono::microseconds timeout,
+    const ReceiveHandler& handler)
+  {
+    if (m_pinCpu >= 0)
+    {
+      PinThread(m_pinCpu);
+      m_pinCpu = -1;
+    }
+
+    if (!m_spin)
+    {
+      auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      struct timeval tv;
+      tv.tv_sec = static_cast<long>(seconds.count());
+      tv.tv_usec = static_cast<long>((timeout - seconds).count());
+
+      fd_set rfds;
+      FD_ZERO(&rfds);
+      FD_SET(m_socket, &rfds);
+
+      int ret = select(static_cast<int>(m_socket) + 1, &rfds, nullptr, nullptr, &tv);
+      if (ret == -1)
+        return -1;
+      if (ret == 0 || !FD_ISSET(m_socket, &rfds))
+        return 0;
+    }
+
+    // One spare byte tells datagrams that were too big for the buffer
+    std::array<char, MAX_LIFX_PACKET_SIZE + 1> buffer;
+    struct sockaddr_in sender = { };
+    uint64_t timestamp = 0;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto received = ReceiveFrom(m_socket, buffer.data(), buffer.size(), sender,
+      timestamp);
+    // The socket is non-blocking when spinning, poll it until the timeout
+    while (received < 0 && m_spin && WouldBlock())
+    {
+      if (m_yield)
+      {
+        std::this_thread::yield();
+      }
+      if (std::chrono::steady_clock::now() >= deadline)
+        return 0;
+      received = ReceiveFrom(m_socket, buffer.data(), buffer.size(), sender,
+        timestamp);
+    }
+    if (received < 0)
+      return -1;
+
+    handler({ buffer.data(), static_cast<size_t>(received),
+      IsOwnAddress(sender.sin_addr.s_addr, sender.sin_port), timestamp });
+    return 1;
+  }
+
+  uint16_t SocketTransport::LocalPort() const
+  {
+    return ntohs(m_localPort);
+  }
+
+  bool SocketTransport::EnableLowLatency(const LowLatencyOptions& options)
+  {
+    bool supported = true;
+
+    // Spinning needs a socket that returns at once when nothing is waiting
+#ifdef _WIN32
+    u_long nonBlocking = options.spin ? 1 : 0;
+    supported &= ioctlsocket(m_socket, FIONBIO, &nonBlocking) == 0;
+#else
+    auto flags = fcntl(m_socket, F_GETFL, 0);
+    flags = options.spin ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    supported &= fcntl(m_socket, F_SETFL, flags) == 0;
+#endif
+    m_spin = options.spin;
+    m_yield = options.yield;
+    m_pinCpu = options.cpu;
+
+    if (options.busyPoll.count() > 0)
+    {
+#ifdef SO_BUSY_POLL
+      int busyPoll = static_cast<int>(options.busyPoll.count());
+      supported &= setsockopt(m_socket, SOL_SOCKET, SO_BUSY_POLL,
+        (const char*)&busyPoll, sizeof(int)) == 0;
+#else
+      supported = false;
+#endif
+    }
+
+    if (options.priority >= 0)
+    {
+#ifdef SO_PRIORITY
+      supported &= setsockopt(m_socket, SOL_SOCKET, SO_PRIORITY,
+        (const char*)&options.priority, sizeof(int)) == 0;
+#else
+      supported = false;
+#endif
+    }
+
+    if (options.dscp >= 0)
+    {
+      // DSCP is the top six bits of the type of service byte
+      int tos = (options.dscp & 0x3F) << 2;
+      supported &= setsockopt(m_socket, IPPROTO_IP, IP_TOS,
+        (const char*)&tos, sizeof(int)) == 0;
+    }
+
+    return supported;
+  }
+
+  bool SocketTransport::IsOwnAddress(uint32_t address, uint16_t port) const
+  {
+    return port == m_localPort &&
+      std::find(m_localAddresses.begin(), m_localAddresses.end(),
+        address) != m_localAddresses.end();
+  }
+
+  std::unique_ptr<Transport> CreateTransport(TransportType type, uint16_t port,
+    const char* destination, uint16_t destinationPort)
+  {
+#ifdef LIFX_IO_URING
+    if (type == TransportType::IO_URING)
+    {
+      auto uring = new UringTransport(port, destination, destinationPort);
+      std::unique_ptr<Transport> transport(uring);
+      if (uring->Valid())
+        return transport;
+    }
+#else
+    (void)type;
+#endif
+    return std::unique_ptr<Transport>(
+      new SocketTransport(port, destination, destinationPort));
+  }
+
+} // namespace lifx
@@ -0,0 +1,522 @@
+/////
+// uring_transport.cpp
+//! @file io_uring transport implementation
+/////
+
+#include <lib-lifx/transport.h>
+
+#ifdef LIFX_IO_URING
+
+#include <algorithm>
+#include <array>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <string.h>
+
+namespace
+{
+  // Constant definitions
+  constexpr unsigned RING_ENTRIES = 256;
+  constexpr unsigned RECEIVE_BUFFERS = 64;
+  constexpr unsigned SEND_SLOTS = 128;
+  constexpr uint16_t BUFFER_GROUP = 0;
+  constexpr uint64_t RECEIVE_TAG = UINT64_MAX;
+  constexpr uint64_t CANCEL_TAG = UINT64_MAX - 1;
+  constexpr int TEARDOWN_WAITS = 100;
+  constexpr auto TEARDOWN_WAIT = std::chrono::milliseconds(10);
+
+  constexpr size_t CONTROL_SIZE = CMSG_SPACE(sizeof(timespec));
+
+  // Multishot receives write a header, the sender's address & the receive
+  // timestamp ahead of the payload, which keeps a spare byte to tell
+  // datagrams that were too big. Buffers stay aligned for the timestamp.
+  constexpr size_t RECEIVE_BUFFER_SIZE = (sizeof(io_uring_recvmsg_out) +
+    sizeof(sockaddr_in) + CONTROL_SIZE + lifx::MAX_LIFX_PACKET_SIZE + 1 +
+    alignof(cmsghdr) - 1) / alignof(cmsghdr) * alignof(cmsghdr);
+
+  static_assert((RECEIVE_BUFFERS & (RECEIVE_BUFFERS - 1)) == 0,
+    "The receive buffer ring size must be a power of two");
+  static_assert(SEND_SLOTS + 2 <= RING_ENTRIES,
+    "Every send, the receive & its cancellation must fit in the ring");
+
+  template<typename T> T LoadAcquire(const T* value)
+  {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+  }
+
+  template<typename T> void StoreRelease(T* value, T desired)
+  {
+    __atomic_store_n(value, desired, __ATOMIC_RELEASE);
+  }
+
+  template<typename T> T* Offset(void* base, uint32_t offset)
+  {
+    return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+  }
+}
+
+namespace lifx
+{
+  //! Memory shared with the kernel, which must outlive every operation
+  //! that was submitted.
+  struct UringTransport::Ring
+  {
+    //! A packet being sent
+    struct SendSlot
+    {
+      std::array<char, MAX_LIFX_PACKET_SIZE> data;
+      struct iovec iov;
+      struct msghdr msg;
+    };
+
+    ~Ring();
+
+    //! Maps the rings of an io_uring and registers the receive buffers.
+    bool Setup(const UringTransport& owner);
+    //! Gets a zeroed submission, or nullptr if the queue is full.
+    io_uring_sqe* NextSubmission();
+    //! Submits queued operations, optionally waiting for a completion.
+    //! @returns false on error; timeouts & interruptions aren't errors.
+    bool Enter(bool wait, std::chrono::microseconds timeout);
+    //! Queues the multishot receive if it isn't armed.
+    void ArmReceive();
+    //! Gives a receive buffer back to the kernel.
+    void ProvideBuffer(uint16_t id);
+    //! Handles every completion. Receives are put aside for later when
+    //! there is no handler.
+    //! @returns The number of datagrams handed to the handler.
+    int Reap(const ReceiveHandler* handler);
+    //! Hands a received datagram to a handler and returns its buffer.
+    void Deliver(const io_uring_cqe& cqe, const ReceiveHandler& handler);
+
+    const UringTransport* owner = nullptr;
+    int fd = -1;
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    //! Tail of the submissions written so far, published on @ref Enter.
+    unsigned sqLocalTail = 0;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    //! Ring of receive buffers registered with the kernel. Used as a plain
+    //! array, C++ lays out the flexible array of io_uring_buf_ring after an
+    //! empty member that takes a byte.
+    io_uring_buf* buffers = static_cast<io_uring_buf*>(MAP_FAILED);
+    size_t buffersSize = 0;
+    uint16_t bufferTail = 0;
+    std::vector<char> receiveData;
+    //! Describes the layout of each receive buffer to the kernel.
+    struct msghdr receiveMsg = { };
+    //! Whether the multishot receive is armed.
+    bool receiving = false;
+    //! Receives that completed while waiting for a send slot.
+    std::vector<io_uring_cqe> deferred;
+
+    struct sockaddr_in destination = { };
+    std::vector<SendSlot> sends;
+    std::vector<uint32_t> freeSends;
+  };
+
+  UringTransport::Ring::~Ring()
+  {
+    if (buffers != MAP_FAILED)
+      munmap(buffers, buffersSize);
+    if (sqes != MAP_FAILED)
+      munmap(sqes, sqesSize);
+    if (cqRing != MAP_FAILED && cqRing != sqRing)
+      munmap(cqRing, cqRingSize);
+    if (sqRing != MAP_FAILED)
+      munmap(sqRing, sqRingSize);
+    if (fd >= 0)
+      close(fd);
+  }
+
+  bool UringTransport::Ring::Setup(const UringTransport& transport)
+  {
+    owner = &transport;
+
+    io_uring_params params = { };
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    // Waiting with a timeout needs the extended arguments of 5.11
+    if (fd < 0 || (params.features & IORING_FEAT_EXT_ARG) == 0)
+      return false;
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single)
+    {
+      sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    }
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+      return false;
+    cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED)
+      return false;
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize,
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED)
+      return false;
+
+    sqHead = Offset<unsigned>(sqRing, params.sq_off.head);
+    sqTail = Offset<unsigned>(sqRing, params.sq_off.tail);
+    sqArray = Offset<unsigned>(sqRing, params.sq_off.array);
+    sqMask = *Offset<unsigned>(sqRing, params.sq_off.ring_mask);
+    sqEntries = *Offset<unsigned>(sqRing, params.sq_off.ring_entries);
+    sqLocalTail = *sqTail;
+    cqHead = Offset<unsigned>(cqRing, params.cq_off.head);
+    cqTail = Offset<unsigned>(cqRing, params.cq_off.tail);
+    cqMask = *Offset<unsigned>(cqRing, params.cq_off.ring_mask);
+    cqes = Offset<io_uring_cqe>(cqRing, params.cq_off.cqes);
+
+    // Register the receive buffers, multishot receives pick from them
+    buffersSize = RECEIVE_BUFFERS * sizeof(io_uring_buf);
+    buffers = static_cast<io_uring_buf*>(mmap(nullptr, buffersSize,
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (buffers == MAP_FAILED)
+      return false;
+    io_uring_buf_reg reg = { };
+    reg.ring_addr = reinterpret_cast<uintptr_t>(buffers);
+    reg.ring_entries = RECEIVE_BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+      return false;
+
+    receiveData.resize(RECEIVE_BUFFERS * RECEIVE_BUFFER_SIZE);
+    for (uint16_t id = 0; id < RECEIVE_BUFFERS; ++id)
+    {
+      ProvideBuffer(id);
+    }
+    StoreRelease(&buffers[0].resv, bufferTail);
+    receiveMsg.msg_namelen = sizeof(sockaddr_in);
+    receiveMsg.msg_controllen = CONTROL_SIZE;
+
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = transport.m_destinationAddress;
+    destination.sin_port = transport.m_destinationPort;
+    sends.resize(SEND_SLOTS);
+    for (uint32_t slot = SEND_SLOTS; slot > 0; --slot)
+    {
+      freeSends.push_back(slot - 1);
+    }
+
+    ArmReceive();
+    if (!Enter(false, std::chrono::microseconds(0)))
+      return false;
+
+    // Multishot receives need 6.0; older kernels fail them as soon as they
+    // are submitted, where a working one only completes once data arrives
+    Reap(nullptr);
+    return receiving;
+  }
+
+  io_uring_sqe* UringTransport::Ring::NextSubmission()
+  {
+    if (sqLocalTail - LoadAcquire(sqHead) >= sqEntries)
+      return nullptr;
+
+    auto index = sqLocalTail & sqMask;
+    auto sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+    ++sqLocalTail;
+    return sqe;
+  }
+
+  bool UringTransport::Ring::Enter(bool wait, std::chrono::microseconds timeout)
+  {
+    StoreRelease(sqTail, sqLocalTail);
+    unsigned submit = sqLocalTail - LoadAcquire(sqHead);
+    if (submit == 0 && !wait)
+      return true;
+
+    unsigned flags = 0;
+    io_uring_getevents_arg arg = { };
+    __kernel_timespec ts = { };
+    if (wait)
+    {
+      auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+      ts.tv_sec = seconds.count();
+      ts.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        timeout - seconds).count();
+      arg.ts = reinterpret_cast<uintptr_t>(&ts);
+      flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+
+    auto ret = syscall(__NR_io_uring_enter, fd, submit, wait ? 1 : 0, flags,
+      wait ? &arg : nullptr, wait ? sizeof(arg) : 0);
+    return ret >= 0 || errno == ETIME || errno == EINTR || errno == EAGAIN ||
+      errno == EBUSY;
+  }
+
+  void UringTransport::Ring::ArmReceive()
+  {
+    if (receiving)
+      return;
+
+    auto sqe = NextSubmission();
+    if (sqe == nullptr)
+      return;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = owner->m_socket;
+    sqe->addr = reinterpret_cast<uintptr_t>(&receiveMsg);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = RECEIVE_TAG;
+    receiving = true;
+  }
+
+  void UringTransport::Ring::ProvideBuffer(uint16_t id)
+  {
+    // Only the address, length & ID are written; the reserved field of the
+    // first entry is the tail of the ring
+    auto& buffer = buffers[bufferTail & (RECEIVE_BUFFERS - 1)];
+    buffer.addr = reinterpret_cast<uintptr_t>(
+      receiveData.data() + id * RECEIVE_BUFFER_SIZE);
+    buffer.len = RECEIVE_BUFFER_SIZE;
+    buffer.bid = id;
+    ++bufferTail;
+  }
+
+  int UringTransport::Ring::Reap(const ReceiveHandler* handler)
+  {
+    int received = 0;
+    // Each completion is consumed before it is handled, a handler that
+    // sends may reap the ones after it
+    for (auto head = *cqHead; head != LoadAcquire(cqTail); head = *cqHead)
+    {
+      auto cqe = cqes[head & cqMask];
+      StoreRelease(cqHead, head + 1);
+      if (cqe.user_data == RECEIVE_TAG)
+      {
+        if ((cqe.flags & IORING_CQE_F_MORE) == 0)
+        {
+          // Out of buffers or cancelled, it is armed again by Receive
+          receiving = false;
+        }
+        if (cqe.res < 0 || (cqe.flags & IORING_CQE_F_BUFFER) == 0)
+          continue;
+
+        if (handler == nullptr)
+        {
+          deferred.push_back(cqe);
+        }
+        else
+        {
+          Deliver(cqe, *handler);
+          ++received;
+        }
+      }
+      else if (cqe.user_data < SEND_SLOTS)
+      {
+        freeSends.push_back(static_cast<uint32_t>(cqe.user_data));
+      }
+    }
+    StoreRelease(&buffers[0].resv, bufferTail);
+    return received;
+  }
+
+  void UringTransport::Ring::Deliver(const io_uring_cqe& cqe,
+    const ReceiveHandler& handler)
+  {
+    auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    const char* buffer = receiveData.data() + id * RECEIVE_BUFFER_SIZE;
+
+    io_uring_recvmsg_out out;
+    memcpy(&out, buffer, sizeof(out));
+    struct sockaddr_in sender = { };
+    memcpy(&sender, buffer + sizeof(out),
+      std::min<size_t>(out.namelen, sizeof(sender)));
+    const char* payload = buffer + sizeof(out) + receiveMsg.msg_namelen +
+      receiveMsg.msg_controllen;
+    size_t length = (out.flags & MSG_TRUNC) != 0 ?
+      MAX_LIFX_PACKET_SIZE + 1 : out.payloadlen;
+
+    // The control messages follow the address, as recvmsg would lay them out
+    struct msghdr control = { };
+    control.msg_control = const_cast<char*>(buffer) + sizeof(out) +
+      receiveMsg.msg_namelen;
+    control.msg_controllen = out.controllen;
+    uint64_t timestamp = 0;
+    for (auto cmsg = CMSG_FIRSTHDR(&control); cmsg != nullptr;
+      cmsg = CMSG_NXTHDR(&control, cmsg))
+    {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+      {
+        struct timespec time;
+        memcpy(&time, CMSG_DATA(cmsg), sizeof(time));
+        timestamp = static_cast<uint64_t>(time.tv_sec) * 1000000000 +
+          static_cast<uint64_t>(time.tv_nsec);
+      }
+    }
+
+    handler({ payload, length,
+      owner->IsOwnAddress(sender.sin_addr.s_addr, sender.sin_port), timestamp });
+    ProvideBuffer(id);
+  }
+
+  UringTransport::UringTransport(uint16_t port, const char* destination,
+    uint16_t destinationPort)
+    : SocketTransport(port, destination, destinationPort)
+    , m_ring(new Ring())
+  {
+    if (!m_ring->Setup(*this))
+    {
+      m_ring.reset();
+    }
+  }
+
+  UringTransport::~UringTransport()
+  {
+    if (!Valid())
+      return;
+
+    Flush();
+    if (m_ring->receiving)
+    {
+      auto sqe = m_ring->NextSubmission();
+      if (sqe != nullptr)
+      {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = RECEIVE_TAG;
+        sqe->user_data = CANCEL_TAG;
+      }
+    }
+
+    // The kernel may still be writing to the buffers or reading the sends
+    for (int i = 0; i < TEARDOWN_WAITS &&
+      (m_ring->receiving || m_ring->freeSends.size() < SEND_SLOTS); ++i)
+    {
+      if (!m_ring->Enter(true, TEARDOWN_WAIT))
+        break;
+      m_ring->Reap(nullptr);
+    }
+  }
+
+  int UringTransport::Send(const char* data, size_t length)
+  {
+    if (!Valid())
+      return SocketTransport::Send(data, length);
+    if (length == 0)
+      return 0;
+    if (length > MAX_LIFX_PACKET_SIZE)
+      return -1;
+
+    // Wait for an earlier send to complete if every slot is in flight
+    auto& ring = *m_ring;
+    if (ring.freeSends.empty())
+    {
+      ring.Reap(nullptr);
+      while (ring.freeSends.empty())
+      {
+        if (!ring.Enter(true, TEARDOWN_WAIT))
+          return -1;
+        ring.Reap(nullptr);
+      }
+    }
+
+    auto sqe = ring.NextSubmission();
+    if (sqe == nullptr)
+    {
+      if (!ring.Enter(false, std::chrono::microseconds(0)))
+        return -1;
+      sqe = ring.NextSubmission();
+      if (sqe == nullptr)
+        return -1;
+    }
+
+    auto slot = ring.freeSends.back();
+    ring.freeSends.pop_back();
+    auto& send = ring.sends[slot];
+    memcpy(send.data.data(), data, length);
+    send.iov.iov_base = send.data.data();
+    send.iov.iov_len = length;
+    send.msg = { };
+    send.msg.msg_name = &ring.destination;
+    send.msg.msg_namelen = sizeof(ring.destination);
+    send.msg.msg_iov = &send.iov;
+    send.msg.msg_iovlen = 1;
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = m_socket;
+    sqe->addr = reinterpret_cast<uintptr_t>(&send.msg);
+    sqe->len = 1;
+    sqe->user_data = slot;
+    return static_cast<int>(length);
+  }
+
+  void UringTransport::Flush()
+  {
+    if (!Valid())
+      return;
+
+    m_ring->Enter(false, std::chrono::microseconds(0));
+    m_ring->Reap(nullptr);
+  }
+
+  int UringTransport::Receive(std::chrono::microseconds timeout,
+    const ReceiveHandler& handler)
+  {
+    if (!Valid())
+      return SocketTransport::Receive(timeout, handler);
+
+    auto& ring = *m_ring;
+    ring.ArmReceive();
+
+    // Datagrams that arrived while a send waited for a slot come first
+    int received = 0;
+    std::vector<io_uring_cqe> deferred;
+    deferred.swap(ring.deferred);
+    for (const auto& cqe : deferred)
+    {
+      ring.Deliver(cqe, handler);
+      ++received;
+    }
+
+    // Queued sends are submitted with the same call that waits
+    bool wait = received == 0 && timeout.count() > 0 &&
+      LoadAcquire(ring.cqTail) == *ring.cqHead;
+    if (!ring.Enter(wait, timeout))
+      return -1;
+    received += ring.Reap(&handler);
+
+    ring.ArmReceive();
+    return received;
+  }
+
+  bool UringTransport::Valid() const
+  {
+    return m_ring != nullptr;
+  }
+
+} // namespace lifx
+
+#endif
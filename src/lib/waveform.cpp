@@ -0,0 +1,85 @@
+/////
+// waveform.cpp
+//! @file Helpers for device-side waveform effects implementation
+/////
+
+#include <lib-lifx/waveform.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  //! Duty cycle used for a strobe flash
+  constexpr float STROBE_DUTY = 0.1f;
+}
+
+namespace lifx
+{
+
+namespace waveform
+{
+  int16_t SkewRatio(float ratio)
+  {
+    ratio = std::min(std::max(ratio, 0.0f), 1.0f);
+    return static_cast<int16_t>(std::lround(ratio * 65535.0f - 32768.0f));
+  }
+
+  message::light::SetWaveform Make(Waveform shape, const HSBK& color,
+    uint32_t period, float cycles, float skew, bool transient)
+  {
+    message::light::SetWaveform wave = { };
+    wave.transient = transient ? 1 : 0;
+    wave.color = color;
+    wave.period = period;
+    wave.cycles = cycles;
+    wave.skew_ratio = SkewRatio(skew);
+    wave.waveform = static_cast<uint8_t>(shape);
+    return wave;
+  }
+
+  message::light::SetWaveform Breathe(const HSBK& color, uint32_t period,
+    float cycles)
+  {
+    return Make(Waveform::SINE, color, period, cycles);
+  }
+
+  message::light::SetWaveform Pulse(const HSBK& color, uint32_t period,
+    float cycles, float duty)
+  {
+    return Make(Waveform::PULSE, color, period, cycles, duty);
+  }
+
+  message::light::SetWaveform Strobe(const HSBK& color, uint32_t period,
+    float cycles)
+  {
+    return Make(Waveform::PULSE, color, period, cycles, STROBE_DUTY);
+  }
+
+  message::light::SetWaveformOptional Optional(
+    const message::light::SetWaveform& wave, bool setHue, bool setSaturation,
+    bool setBrightness, bool setKelvin)
+  {
+    message::light::SetWaveformOptional optional = { };
+    optional.transient = wave.transient;
+    optional.color = wave.color;
+    optional.period = wave.period;
+    optional.cycles = wave.cycles;
+    optional.skew_ratio = wave.skew_ratio;
+    optional.waveform = wave.waveform;
+    optional.set_hue = setHue ? 1 : 0;
+    optional.set_saturation = setSaturation ? 1 : 0;
+    optional.set_brightness = setBrightness ? 1 : 0;
+    optional.set_kelvin = setKelvin ? 1 : 0;
+    return optional;
+  }
+
+  message::light::SetWaveformOptional BreatheBrightness(uint16_t brightness,
+    uint32_t period, float cycles)
+  {
+    HSBK color = { 0, 0, brightness, 0 };
+    return Optional(Breathe(color, period, cycles), false, false, true, false);
+  }
+} // namespace waveform
+
+} // namespace lifx
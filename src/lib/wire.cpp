@@ -0,0 +1,82 @@
+/////
+// wire.cpp
+//! @file Compile-time checks of the LIFX wire format
+/////
+
+#include <lib-lifx/wire.h>
+
+#include <type_traits>
+
+namespace lifx
+{
+
+namespace wire
+{
+namespace
+{
+  //! Checks that a message has the size given in the LIFX protocol and that
+  //! its packed struct is laid out the same as its wire format.
+  template<typename T> constexpr bool Check(size_t protocolSize)
+  {
+    return Size<T>() == protocolSize &&
+      (std::is_empty<T>::value ? protocolSize == 0 : sizeof(T) == protocolSize);
+  }
+
+  static_assert(Check<HSBK>(8), "HSBK");
+  static_assert(Check<Tile>(55), "Tile");
+
+  // device
+  static_assert(Check<message::device::GetService>(0), "GetService");
+  static_assert(Check<message::device::StateService>(5), "StateService");
+  static_assert(Check<message::device::GetHostInfo>(0), "GetHostInfo");
+  static_assert(Check<message::device::StateHostInfo>(14), "StateHostInfo");
+  static_assert(Check<message::device::GetHostFirmware>(0), "GetHostFirmware");
+  static_assert(Check<message::device::StateHostFirmware>(20), "StateHostFirmware");
+  static_assert(Check<message::device::GetWifiInfo>(0), "GetWifiInfo");
+  static_assert(Check<message::device::StateWifiInfo>(14), "StateWifiInfo");
+  static_assert(Check<message::device::GetWifiFirmware>(0), "GetWifiFirmware");
+  static_assert(Check<message::device::StateWifiFirmware>(20), "StateWifiFirmware");
+  static_assert(Check<message::device::GetPower>(0), "device::GetPower");
+  static_assert(Check<message::device::SetPower>(2), "device::SetPower");
+  static_assert(Check<message::device::StatePower>(2), "device::StatePower");
+  static_assert(Check<message::device::GetLabel>(0), "GetLabel");
+  static_assert(Check<message::device::SetLabel>(32), "SetLabel");
+  static_assert(Check<message::device::StateLabel>(32), "StateLabel");
+  static_assert(Check<message::device::GetVersion>(0), "GetVersion");
+  static_assert(Check<message::device::StateVersion>(12), "StateVersion");
+  static_assert(Check<message::device::GetInfo>(0), "GetInfo");
+  static_assert(Check<message::device::StateInfo>(24), "StateInfo");
+  static_assert(Check<message::device::Acknowledgement>(0), "Acknowledgement");
+  static_assert(Check<message::device::GetLocation>(0), "GetLocation");
+  static_assert(Check<message::device::StateLocation>(56), "StateLocation");
+  static_assert(Check<message::device::GetGroup>(0), "GetGroup");
+  static_assert(Check<message::device::StateGroup>(56), "StateGroup");
+  static_assert(Check<message::device::EchoRequest>(8), "EchoRequest");
+  static_assert(Check<message::device::EchoResponse>(8), "EchoResponse");
+
+  // light
+  static_assert(Check<message::light::Get>(0), "Get");
+  static_assert(Check<message::light::SetColor>(13), "SetColor");
+  static_assert(Check<message::light::SetWaveform>(21), "SetWaveform");
+  static_assert(Check<message::light::State>(52), "State");
+  static_assert(Check<message::light::GetPower>(0), "light::GetPower");
+  static_assert(Check<message::light::SetPower>(6), "light::SetPower");
+  static_assert(Check<message::light::StatePower>(2), "light::StatePower");
+  static_assert(Check<message::light::SetWaveformOptional>(25), "SetWaveformOptional");
+
+  // multizone
+  static_assert(Check<message::multizone::SetColorZones>(15), "SetColorZones");
+  static_assert(Check<message::multizone::GetColorZones>(2), "GetColorZones");
+  static_assert(Check<message::multizone::StateZone>(10), "StateZone");
+  static_assert(Check<message::multizone::StateMultiZone>(66), "StateMultiZone");
+
+  // tile
+  static_assert(Check<message::tile::GetDeviceChain>(0), "GetDeviceChain");
+  static_assert(Check<message::tile::StateDeviceChain>(882), "StateDeviceChain");
+  static_assert(Check<message::tile::Get64>(6), "Get64");
+  static_assert(Check<message::tile::State64>(517), "State64");
+  static_assert(Check<message::tile::Set64>(522), "Set64");
+} // namespace
+} // namespace wire
+
+} // namespace lifx
@@ -3,14 +3,42 @@
 //! @file LIFX Unit Tests
 /////
 
+#include <lib-lifx/codec.h>
+#include <lib-lifx/devices.h>
+#include <lib-lifx/effects.h>
+#include <lib-lifx/fanout.h>
+#include <lib-lifx/filter.h>
+#include <lib-lifx/groups.h>
 #include <lib-lifx/lifx.h>
+#include <lib-lifx/loopback.h>
+#include <lib-lifx/reassembly.h>
+#include <lib-lifx/registry.h>
+#include <lib-lifx/scene.h>
+#include <lib-lifx/sharded.h>
+#include <lib-lifx/simulator.h>
+#include <lib-lifx/sync.h>
+#include <lib-lifx/tile.h>
+#include <lib-lifx/transport.h>
+#include <lib-lifx/waveform.h>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <functional>
 
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 namespace
 {
 
@@ -30,6 +58,22 @@ class TestLifxClient : public lifx::LifxClient
       return m_sourceId;
     }
 
+    // Queues a placeholder under a sequence, so sends can't draw it
+    void OccupySequence(uint8_t gn)
+    {
+      m_pendingSends[gn] = Encode(
+        lifx::MakeHeader<lifx::message::device::GetPower>(nullptr, 0, gn),
+        lifx::message::device::GetPower { });
+      m_sendOrder.push_back(gn);
+    }
+
+    void ReleaseSequence(uint8_t gn)
+    {
+      m_pendingSends.erase(gn);
+      m_sendOrder.erase(std::remove(m_sendOrder.begin(), m_sendOrder.end(), gn),
+        m_sendOrder.end());
+    }
+
     lifx::Header GetPendingSendHeader(uint8_t gn)
     {
       lifx::Header header {};
@@ -37,10 +81,7 @@ class TestLifxClient : public lifx::LifxClient
       if (iter == m_pendingSends.end())
         return header;
 
-      lifx::NetworkHeader nh;
-      memcpy(&nh, iter->second.data(), lifx::LIFX_HEADER_SIZE);
-
-      header = FromNetwork(nh);
+      header = lifx::wire::DecodeHeader(iter->second.data());
 
       EXPECT_EQ(header.sequence, gn);
 
@@ -57,11 +98,31 @@ class TestLifxClient : public lifx::LifxClient
       if (iter == m_pendingSends.end())
         return message;
 
-      memcpy(&message, (iter->second.data() + lifx::LIFX_HEADER_SIZE), sizeof(T));
+      lifx::wire::Decode(iter->second.data() + lifx::LIFX_HEADER_SIZE, message);
 
       return message;
     }
 
+    template<typename T> std::vector<char> MakePacket(const uint8_t target[8],
+      uint8_t sequence, const T& message, uint32_t source = 0)
+    {
+      lifx::Header header {};
+      header.size = static_cast<uint16_t>(lifx::LIFX_HEADER_SIZE + lifx::wire::Size<T>());
+      header.protocol = lifx::LIFX_PROTOCOL;
+      header.addressable = 1;
+      header.source = source;
+      memcpy(header.target, target, sizeof(header.target));
+      header.sequence = sequence;
+      header.type = T::type;
+
+      return Encode(header, message);
+    }
+
+    template<typename T> void ReceivePacket(const std::vector<char>& buffer)
+    {
+      TryReceiveMessage<T>(lifx::wire::DecodeHeader(buffer.data()), buffer.data());
+    }
+
     const char* GetPendingSendBuffer(uint8_t gn)
     {
       auto iter = m_pendingSends.find(gn);
@@ -100,13 +161,15 @@ class TestLifxClient : public lifx::LifxClient
     int SendBuffer(const std::vector<char>& buffer) override
     {
       // Don't actually send anything
+      ++m_sentCount;
+      m_lastSent = buffer;
       return static_cast<int>(buffer.size());
     }
 
-    template<typename ... T> void ReceiveMessageTypes(const lifx::Header& header,
-      const char* buffer)
+    bool ProcessDatagram(const char* data, size_t length,
+      uint64_t timestamp = 0)
     {
-      LifxClient::ReceiveMessageTypes<T...>(header, buffer);
+      return LifxClient::ProcessDatagram(data, length, timestamp);
     }
 
     template<typename T> void TryReceiveMessage(const lifx::Header& header,
@@ -118,6 +181,8 @@ class TestLifxClient : public lifx::LifxClient
     bool m_errorState;
     bool m_sendsLimited;
     bool m_pretendReceive;
+    size_t m_sentCount;
+    std::vector<char> m_lastSent;
 };
 
 class TestClient
@@ -315,6 +380,2162 @@ TEST_F(TestClient, TryReceiveMessageFailure)
     (header, buffer);
 }
 
+TEST_F(TestClient, ReceiveRejectsTruncatedDatagrams)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  size_t received = 0;
+  m_client->RegisterCallback<lifx::message::device::StateInfo>(
+    [&received](const lifx::Header&, const lifx::message::device::StateInfo& info)
+    {
+      ++received;
+      ASSERT_EQ(42u, info.time);
+    });
+
+  lifx::message::device::StateInfo info = { 42, 1, 2 };
+  auto packet = m_client->MakePacket(target, 1, info);
+
+  // Every prefix of the datagram is short of what its header promises
+  for (size_t length = 0; length < packet.size(); ++length)
+  {
+    auto truncated = std::vector<char>(packet.begin(), packet.begin() + length);
+    ASSERT_FALSE(m_client->ProcessDatagram(truncated.data(), truncated.size()));
+  }
+  ASSERT_EQ(packet.size(), m_client->RejectedCount());
+
+  // A header that agrees with the truncation still lacks the payload
+  auto rejected = m_client->RejectedCount();
+  for (size_t length = lifx::LIFX_HEADER_SIZE; length < packet.size(); ++length)
+  {
+    auto truncated = std::vector<char>(packet.begin(), packet.begin() + length);
+    truncated[0] = static_cast<char>(length);
+    m_client->ProcessDatagram(truncated.data(), truncated.size());
+  }
+  ASSERT_EQ(rejected + packet.size() - lifx::LIFX_HEADER_SIZE,
+    m_client->RejectedCount());
+  ASSERT_EQ(0u, received);
+
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_EQ(1u, received);
+}
+
+TEST_F(TestClient, ReceiveRejectsOversizedDatagrams)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  size_t received = 0;
+  m_client->RegisterCallback<lifx::message::device::StatePower>(
+    [&received](const lifx::Header&, const lifx::message::device::StatePower& power)
+    {
+      ++received;
+      ASSERT_EQ(65535u, power.level);
+    });
+
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::device::StatePower { 65535 });
+
+  // Bytes past the header's size are ignored
+  auto padded = packet;
+  padded.resize(packet.size() + 16, 0x7F);
+  ASSERT_TRUE(m_client->ProcessDatagram(padded.data(), padded.size()));
+  ASSERT_EQ(1u, received);
+
+  // Anything the receive buffer can't hold was cut short by the socket
+  padded.resize(lifx::MAX_LIFX_PACKET_SIZE + 1, 0x7F);
+  ASSERT_FALSE(m_client->ProcessDatagram(padded.data(), padded.size()));
+
+  // Sizes beyond the datagram & frames that aren't LIFX
+  auto bad = packet;
+  bad[0] = static_cast<char>(packet.size() + 1);
+  ASSERT_FALSE(m_client->ProcessDatagram(bad.data(), bad.size()));
+  bad = packet;
+  bad[3] = 0;
+  ASSERT_FALSE(m_client->ProcessDatagram(bad.data(), bad.size()));
+  ASSERT_EQ(1u, received);
+  ASSERT_EQ(3u, m_client->RejectedCount());
+}
+
+TEST_F(TestClient, ReceiveSurvivesRandomDatagrams)
+{
+  size_t received = 0;
+  m_client->RegisterCallback<lifx::message::tile::State64>(
+    [&received](const lifx::Header& header, const lifx::message::tile::State64&)
+    {
+      ++received;
+      ASSERT_GE(header.size, lifx::LIFX_HEADER_SIZE +
+        lifx::wire::Size<lifx::message::tile::State64>());
+    });
+
+  std::mt19937 random(1234);
+  std::vector<char> datagram(lifx::MAX_LIFX_PACKET_SIZE + 1);
+  size_t accepted = 0;
+  for (size_t i = 0; i < 10000; ++i)
+  {
+    auto length = random() % datagram.size();
+    for (auto& byte : datagram)
+    {
+      byte = static_cast<char>(random());
+    }
+    // Keep most frames plausible so the payload checks get exercised
+    lifx::Header header = { };
+    header.size = static_cast<uint16_t>(random() % (length + 64));
+    header.protocol = lifx::LIFX_PROTOCOL;
+    header.addressable = 1;
+    header.type = lifx::message::tile::State64::type;
+    if (length >= lifx::LIFX_HEADER_SIZE && i % 4 != 0)
+    {
+      lifx::wire::EncodeHeader(header, datagram.data());
+    }
+    accepted += m_client->ProcessDatagram(datagram.data(), length) ? 1 : 0;
+  }
+  ASSERT_GT(received, 0u);
+  ASSERT_LE(received, accepted);
+  ASSERT_LE(10000u - accepted,
+    m_client->RejectedCount() + m_client->DuplicateCount());
+}
+
+TEST_F(TestClient, MultipleSubscribers)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::device::StatePower { 1 });
+
+  int registered = 0;
+  int first = 0;
+  int second = 0;
+  m_client->RegisterCallback<lifx::message::device::StatePower>(
+    [&registered](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++registered; });
+  auto a = m_client->Subscribe<lifx::message::device::StatePower>(
+    [&first](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++first; });
+  auto b = m_client->Subscribe<lifx::message::device::StatePower>(
+    [&second](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++second; });
+  ASSERT_NE(a, b);
+
+  m_client->ReceivePacket<lifx::message::device::StatePower>(packet);
+  ASSERT_EQ(1, registered);
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(1, second);
+
+  // Registering again only replaces the registered callback
+  m_client->RegisterCallback<lifx::message::device::StatePower>(
+    [](const lifx::Header&, const lifx::message::device::StatePower&) { });
+  ASSERT_TRUE(m_client->Unsubscribe(a));
+  ASSERT_FALSE(m_client->Unsubscribe(a));
+  m_client->ReceivePacket<lifx::message::device::StatePower>(packet);
+  ASSERT_EQ(1, registered);
+  ASSERT_EQ(1, first);
+  ASSERT_EQ(2, second);
+}
+
+TEST_F(TestClient, TargetedSubscribers)
+{
+  constexpr uint8_t bulbA[8] = { 0xD0, 0x73, 0xD5, 0, 0, 0xA, 0, 0 };
+  constexpr uint8_t bulbB[8] = { 0xD0, 0x73, 0xD5, 0, 0, 0xB, 0, 0 };
+
+  int any = 0;
+  int onlyA = 0;
+  m_client->Subscribe<lifx::message::light::StatePower>(
+    [&any](const lifx::Header&, const lifx::message::light::StatePower&)
+    { ++any; });
+  m_client->Subscribe<lifx::message::light::StatePower>(
+    [&onlyA](const lifx::Header& header, const lifx::message::light::StatePower&)
+    {
+      ++onlyA;
+      ASSERT_EQ(0xA, header.target[5]);
+    }, bulbA);
+
+  m_client->ReceivePacket<lifx::message::light::StatePower>(
+    m_client->MakePacket(bulbB, 1, lifx::message::light::StatePower { 0 }));
+  m_client->ReceivePacket<lifx::message::light::StatePower>(
+    m_client->MakePacket(bulbA, 2, lifx::message::light::StatePower { 0 }));
+  m_client->ReceivePacket<lifx::message::light::StatePower>(
+    m_client->MakePacket(bulbB, 3, lifx::message::light::StatePower { 0 }));
+  ASSERT_EQ(3, any);
+  ASSERT_EQ(1, onlyA);
+}
+
+TEST_F(TestClient, SubscribeFromCallback)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::device::StateLabel {});
+
+  // A callback that replaces itself the first time it runs
+  int once = 0;
+  int added = 0;
+  lifx::LifxClient::Subscription self = 0;
+  self = m_client->Subscribe<lifx::message::device::StateLabel>(
+    [&](const lifx::Header&, const lifx::message::device::StateLabel&)
+    {
+      ++once;
+      ASSERT_TRUE(m_client->Unsubscribe(self));
+      m_client->Subscribe<lifx::message::device::StateLabel>(
+        [&added](const lifx::Header&, const lifx::message::device::StateLabel&)
+        { ++added; }, target);
+    });
+
+  m_client->ReceivePacket<lifx::message::device::StateLabel>(packet);
+  ASSERT_EQ(1, once);
+  ASSERT_EQ(0, added);
+  m_client->ReceivePacket<lifx::message::device::StateLabel>(packet);
+  ASSERT_EQ(1, once);
+  ASSERT_EQ(1, added);
+}
+
+TEST_F(TestClient, ReassemblerLeavesCallbacksAlone)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  int user = 0;
+  m_client->RegisterCallback<lifx::message::multizone::StateZone>(
+    [&user](const lifx::Header&, const lifx::message::multizone::StateZone&)
+    { ++user; });
+
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::multizone::StateZone {});
+  {
+    lifx::Reassembler reassembler(*m_client);
+    m_client->ReceivePacket<lifx::message::multizone::StateZone>(packet);
+  }
+  m_client->ReceivePacket<lifx::message::multizone::StateZone>(packet);
+  ASSERT_EQ(2, user);
+}
+
+TEST_F(TestClient, FilterSources)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  int received = 0;
+  m_client->Subscribe<lifx::message::device::StatePower>(
+    [&received](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++received; });
+
+  auto packetFrom = [&target](uint32_t source)
+  {
+    std::vector<char> packet(lifx::MAX_LIFX_PACKET_SIZE);
+    lifx::HeaderOptions options;
+    options.target = target;
+    options.source = source;
+    packet.resize(lifx::EncodeInto(packet.data(), packet.size(),
+      lifx::message::device::StatePower { 1 }, options));
+    return packet;
+  };
+  auto ours = packetFrom(77);
+  auto foreign = packetFrom(99);
+  auto device = packetFrom(0);
+
+  // Everything is dispatched until filtering is turned on
+  m_client->SetSourceId(77);
+  ASSERT_TRUE(m_client->ProcessDatagram(foreign.data(), foreign.size()));
+  ASSERT_EQ(1, received);
+
+  m_client->FilterSources(true);
+  ASSERT_TRUE(m_client->ProcessDatagram(ours.data(), ours.size()));
+  ASSERT_FALSE(m_client->ProcessDatagram(foreign.data(), foreign.size()));
+  ASSERT_TRUE(m_client->ProcessDatagram(device.data(), device.size()));
+  ASSERT_EQ(3, received);
+
+  m_client->FilterSources(true, false);
+  ASSERT_FALSE(m_client->ProcessDatagram(device.data(), device.size()));
+  ASSERT_EQ(3, received);
+  ASSERT_EQ(2u, m_client->FilteredCount());
+  ASSERT_EQ(0u, m_client->RejectedCount());
+}
+
+// Hands out queued datagrams, as if they came back from this host
+class EchoTransport : public lifx::Transport
+{
+  public:
+    int Send(const char* data, size_t length) override
+    {
+      m_queue.emplace_back(data, data + length);
+      return static_cast<int>(length);
+    }
+
+    int Receive(std::chrono::microseconds, const ReceiveHandler& handler) override
+    {
+      int count = 0;
+      for (const auto& packet : m_queue)
+      {
+        handler(lifx::Datagram { packet.data(), packet.size(), true, 0 });
+        ++count;
+      }
+      m_queue.clear();
+      return count;
+    }
+
+    std::vector<std::vector<char>> m_queue;
+};
+
+TEST(TestOwnAddress, DropsOwnDatagramsOnlyWhenFiltering)
+{
+  auto* transport = new EchoTransport();
+  lifx::LifxClient client(std::unique_ptr<lifx::Transport>(transport), 77);
+  int received = 0;
+  client.Subscribe<lifx::message::device::StatePower>(
+    [&received](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++received; });
+  auto reply = lifx::LifxClient::Encode(
+    lifx::MakeHeader<lifx::message::device::StatePower>(nullptr, 77, 1),
+    lifx::message::device::StatePower { 1 });
+
+  // An emulator on this host answers from the port the client is bound to
+  transport->Send(reply.data(), reply.size());
+  client.RunOnce(0, 0);
+  ASSERT_EQ(1, received);
+  ASSERT_EQ(0u, client.FilteredCount());
+
+  client.FilterSources(true);
+  transport->Send(reply.data(), reply.size());
+  client.RunOnce(0, 0);
+  ASSERT_EQ(1, received);
+  ASSERT_EQ(1u, client.FilteredCount());
+}
+
+TEST_F(TestClient, RepeatedRequestsGetDistinctSequences)
+{
+  int received = 0;
+  m_client->Subscribe<lifx::message::device::StatePower>(
+    [&received](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++received; });
+
+  // Back-to-back requests to one device get the same reply each time, which
+  // is only told apart from a copy of the last one by its sequence
+  std::vector<uint8_t> sequences;
+  for (int i = 0; i < UCHAR_MAX; ++i)
+  {
+    auto gn = m_client->Send<lifx::message::device::GetPower>(m_sendTarget.data());
+    while (m_client->WaitingToSend())
+    {
+      m_client->RunOnce();
+    }
+    sequences.push_back(gn);
+    auto reply = m_client->MakePacket(m_sendTarget.data(), gn,
+      lifx::message::device::StatePower { 65535 });
+    ASSERT_TRUE(m_client->ProcessDatagram(reply.data(), reply.size()));
+  }
+  ASSERT_EQ(UCHAR_MAX, received);
+  ASSERT_EQ(0u, m_client->DuplicateCount());
+  std::sort(sequences.begin(), sequences.end());
+  ASSERT_EQ(sequences.end(), std::unique(sequences.begin(), sequences.end()));
+}
+
+TEST_F(TestClient, DropsDuplicates)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  constexpr uint8_t other[8] = { 0xD0, 0x73, 0xD5, 4, 5, 6, 0, 0 };
+  int received = 0;
+  m_client->Subscribe<lifx::message::device::StatePower>(
+    [&received](const lifx::Header&, const lifx::message::device::StatePower&)
+    { ++received; });
+
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::device::StatePower { 1 });
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_FALSE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_EQ(1, received);
+  ASSERT_EQ(1u, m_client->DuplicateCount());
+
+  // Any part of the key telling packets apart lets them through
+  auto sequence = m_client->MakePacket(target, 2,
+    lifx::message::device::StatePower { 1 });
+  auto device = m_client->MakePacket(other, 1,
+    lifx::message::device::StatePower { 1 });
+  auto type = m_client->MakePacket(target, 1,
+    lifx::message::light::StatePower { 1 });
+  auto source = packet;
+  source[lifx::HEADER_SOURCE_OFFSET] = 1;
+  for (const auto* p : { &sequence, &device, &type, &source })
+  {
+    ASSERT_TRUE(m_client->ProcessDatagram(p->data(), p->size()));
+  }
+  ASSERT_EQ(4, received);
+
+  // A truncated copy doesn't hide the packet it was cut from
+  auto truncated = m_client->MakePacket(target, 3,
+    lifx::message::device::StatePower { 1 });
+  auto intact = truncated;
+  truncated[0] = static_cast<char>(lifx::LIFX_HEADER_SIZE);
+  truncated.resize(lifx::LIFX_HEADER_SIZE);
+  ASSERT_FALSE(m_client->ProcessDatagram(truncated.data(), truncated.size()));
+  ASSERT_TRUE(m_client->ProcessDatagram(intact.data(), intact.size()));
+  ASSERT_EQ(5, received);
+
+  m_client->SetDuplicateExpiry(std::chrono::seconds(0));
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_EQ(7, received);
+  ASSERT_EQ(1u, m_client->DuplicateCount());
+}
+
+TEST_F(TestClient, ReceiveTimeDuringCallbacks)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  uint64_t received = 0;
+  m_client->Subscribe<lifx::message::device::StatePower>(
+    [this, &received](const lifx::Header&, const lifx::message::device::StatePower&)
+    { received = m_client->ReceiveTime(); });
+
+  auto packet = m_client->MakePacket(target, 1,
+    lifx::message::device::StatePower { 1 });
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size(), 12345));
+  ASSERT_EQ(12345u, received);
+  ASSERT_EQ(0u, m_client->ReceiveTime());
+
+  // Without a kernel timestamp the packet is stamped as it is handled
+  auto before = lifx::ClockSync::Now();
+  auto next = m_client->MakePacket(target, 2,
+    lifx::message::device::StatePower { 1 });
+  ASSERT_TRUE(m_client->ProcessDatagram(next.data(), next.size()));
+  ASSERT_GE(received, before);
+  ASSERT_LE(received, lifx::ClockSync::Now());
+}
+
+TEST(TestDeviceRegistry, AddsFindsAndRemoves)
+{
+  constexpr size_t DEVICES = 1000;
+  lifx::DeviceRegistry registry;
+  auto target = [](size_t i)
+  {
+    return std::array<uint8_t, 8> { { 0xD0, 0x73, 0xD5, 0,
+      static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i) } };
+  };
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    auto index = registry.Add(target(i).data());
+    ASSERT_EQ(i, index);
+    ASSERT_EQ(index, registry.Add(target(i).data()));
+    registry.SetPower(index, static_cast<uint16_t>(i));
+  }
+  ASSERT_EQ(DEVICES, registry.Size());
+  ASSERT_EQ(lifx::INVALID_DEVICE, registry.Find(target(DEVICES).data()));
+
+  // Removing every other device keeps the rest reachable and dense
+  for (size_t i = 0; i < DEVICES; i += 2)
+  {
+    ASSERT_TRUE(registry.Remove(target(i).data()));
+  }
+  ASSERT_FALSE(registry.Remove(target(0).data()));
+  ASSERT_EQ(DEVICES / 2, registry.Size());
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    auto index = registry.Find(target(i).data());
+    if (i % 2 == 0)
+    {
+      ASSERT_EQ(lifx::INVALID_DEVICE, index);
+      continue;
+    }
+    ASSERT_LT(index, registry.Size());
+    ASSERT_EQ(lifx::TargetKey(target(i).data()), registry.Mac(index));
+    ASSERT_EQ(static_cast<uint16_t>(i), registry.Power(index));
+  }
+
+  lifx::message::light::State state = { };
+  state.color = { 1, 2, 3, 4 };
+  state.power = 65535;
+  memcpy(state.label, "Kitchen\0junk", 12);
+  auto index = registry.Find(target(1).data());
+  registry.Update(index, state);
+  ASSERT_EQ(3, registry.Colors()[index].brightness);
+  ASSERT_EQ(65535, registry.Powers()[index]);
+  ASSERT_STREQ("Kitchen", registry.GetLabel(index).data());
+  ASSERT_EQ(0, registry.GetLabel(index)[8]);
+
+  registry.Clear();
+  ASSERT_EQ(0u, registry.Size());
+  ASSERT_EQ(lifx::INVALID_DEVICE, registry.Find(target(1).data()));
+}
+
+TEST(TestGroupIndex, ResolvesLabelsByLatestUpdate)
+{
+  auto target = [](uint8_t i)
+  {
+    return std::array<uint8_t, 8> { { 0xD0, 0x73, 0xD5, 0, 0, i } };
+  };
+  lifx::message::device::StateGroup kitchen = { { 1 }, "Kitchen", 100 };
+  lifx::message::device::StateGroup bedroom = { { 2 }, "Bedroom", 100 };
+  lifx::GroupIndex groups;
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    groups.Update(target(i).data(), kitchen);
+  }
+  groups.Update(target(3).data(), bedroom);
+  groups.Update(target(4).data(), bedroom);
+  ASSERT_EQ(2u, groups.Size());
+
+  const auto* members = groups.Find("KITCHEN");
+  ASSERT_NE(nullptr, members);
+  ASSERT_EQ(3u, members->size());
+  ASSERT_EQ(nullptr, groups.Find("Garage"));
+
+  // A device that missed the rename doesn't undo it
+  lifx::message::device::StateGroup renamed = kitchen;
+  strcpy(renamed.label, "Cooking");
+  renamed.updated_at = 200;
+  groups.Update(target(0).data(), renamed);
+  groups.Update(target(1).data(), kitchen);
+  ASSERT_EQ("Cooking", groups.Label(lifx::GroupIndex::Uuid { { 1 } }));
+  ASSERT_EQ(nullptr, groups.Find("Kitchen"));
+  ASSERT_EQ(3u, groups.Find("Cooking")->size());
+
+  // Of two groups with one label, the one named last wins
+  lifx::message::device::StateGroup other = { { 3 }, "Bedroom", 300 };
+  groups.Update(target(5).data(), other);
+  lifx::GroupIndex::Uuid uuid;
+  ASSERT_TRUE(groups.Resolve("bedroom", uuid));
+  ASSERT_EQ(3, uuid[0]);
+
+  // Devices move between groups, and empty groups are dropped
+  groups.Update(target(5).data(), kitchen);
+  ASSERT_TRUE(groups.Resolve("bedroom", uuid));
+  ASSERT_EQ(2, uuid[0]);
+  ASSERT_EQ(4u, groups.Find("Cooking")->size());
+  ASSERT_TRUE(groups.GroupOf(target(5).data(), uuid));
+  ASSERT_EQ(1, uuid[0]);
+  ASSERT_TRUE(groups.Remove(target(3).data()));
+  ASSERT_TRUE(groups.Remove(target(4).data()));
+  ASSERT_FALSE(groups.Remove(target(4).data()));
+  ASSERT_EQ(nullptr, groups.Find("Bedroom"));
+  ASSERT_EQ(1u, groups.Size());
+
+  // A group goes out as one planned fan-out to just its members
+  lifx::FanoutPlanner planner;
+  for (uint8_t i = 0; i < 8; ++i)
+  {
+    planner.AddDevice(target(i).data());
+  }
+  auto scene = planner.Plan(*groups.Find("cooking"),
+    lifx::message::device::SetPower { 65535 });
+  ASSERT_EQ(4u, scene->Size());
+}
+
+TEST(TestDeviceSelector, SelectsByLabelMacAndGroup)
+{
+  auto target = [](uint8_t i)
+  {
+    return std::array<uint8_t, 8> { { 0xD0, 0x73, 0xD5, 0x12, 0xAB, i } };
+  };
+  const char* labels[] = { "Kitchen Left", "Kitchen Right", "Desk Lamp",
+    "Floor Lamp", "Porch" };
+  lifx::SelectorIndex index;
+  for (uint8_t i = 0; i < 5; ++i)
+  {
+    char label[32] = { };
+    strcpy(label, labels[i]);
+    index.Update(target(i).data(), label);
+  }
+  lifx::GroupIndex groups;
+  lifx::GroupIndex locations;
+  groups.Update(target(4).data(),
+    lifx::message::device::StateGroup { { 1 }, "Outside", 100 });
+  locations.Update(target(2).data(),
+    lifx::message::device::StateLocation { { 2 }, "Office", 100 });
+  ASSERT_EQ("d073d512ab04", lifx::SelectorIndex::HexMac(target(4).data()));
+
+  auto select = [&](const std::string& text)
+  {
+    lifx::DeviceSelector selector(text);
+    std::vector<lifx::SelectorIndex::Target> selected;
+    index.Select(selector, groups, locations, selected);
+    std::vector<uint8_t> last;
+    for (const auto& target : selected)
+    {
+      last.push_back(target[5]);
+    }
+    std::sort(last.begin(), last.end());
+    return last;
+  };
+  using Selected = std::vector<uint8_t>;
+
+  ASSERT_EQ(lifx::DeviceSelector::Kind::ALL, lifx::DeviceSelector("ALL").GetKind());
+  ASSERT_EQ((Selected { 0, 1, 2, 3, 4 }), select("all"));
+  ASSERT_EQ((Selected { 2, 3 }), select("lamp"));
+  ASSERT_EQ((Selected { 0, 1 }), select("KITCHEN*"));
+  ASSERT_EQ((Selected { 1 }), select("kitchen r*"));
+  ASSERT_EQ((Selected { 2, 3 }), select("*l?mp"));
+  ASSERT_EQ((Selected { }), select("*l?m"));
+  ASSERT_EQ((Selected { 4 }), select("=porch"));
+  ASSERT_EQ((Selected { }), select("=porc"));
+  ASSERT_EQ((Selected { 0, 1 }), select("re:^kitchen (left|right)$"));
+  ASSERT_EQ((Selected { 2, 3 }), select("re:^\\S+ LAMP$"));
+  ASSERT_FALSE(lifx::DeviceSelector("re:(").Valid());
+  ASSERT_EQ((Selected { }), select("re:("));
+  ASSERT_FALSE(lifx::DeviceSelector("").Valid());
+  ASSERT_EQ((Selected { }), select(""));
+  ASSERT_TRUE(lifx::DeviceSelector("*").Valid());
+  ASSERT_EQ((Selected { 0, 1, 2, 3, 4 }), select("*"));
+
+  // MACs are matched as hex, with or without separators
+  ASSERT_EQ((Selected { 3 }), select("mac:D0:73:D5:12:AB:03"));
+  ASSERT_EQ((Selected { 0, 1, 2, 3, 4 }), select("mac:d073d5"));
+  ASSERT_EQ((Selected { 4 }), select("ab04"));
+  ASSERT_EQ((Selected { }), select("mac:zz"));
+
+  // A group or location name wins over labels that contain it
+  ASSERT_EQ((Selected { 4 }), select("outside"));
+  ASSERT_EQ((Selected { 2 }), select("Office"));
+  ASSERT_EQ((Selected { 4 }), select("group:outside"));
+  ASSERT_EQ((Selected { }), select("group:office"));
+  ASSERT_EQ((Selected { 2 }), select("location:office"));
+
+  // Sorted orders follow renames & removals
+  char renamed[32] = "Kitchen Ceiling";
+  index.Update(target(3).data(), renamed);
+  ASSERT_EQ((Selected { 0, 1, 3 }), select("kitchen*"));
+  ASSERT_TRUE(index.Remove(target(0).data()));
+  ASSERT_FALSE(index.Remove(target(0).data()));
+  ASSERT_EQ(4u, index.Size());
+  ASSERT_EQ((Selected { 1, 3 }), select("kitchen*"));
+  ASSERT_EQ((Selected { 4 }), select("mac:d073d512ab04"));
+}
+
+TEST(TestDuplicateFilter, ExpiresEntries)
+{
+  using Clock = lifx::DuplicateFilter::Clock;
+  lifx::DuplicateFilter filter(std::chrono::milliseconds(100));
+  lifx::Header header = { };
+  header.target[0] = 0xD0;
+  header.source = 7;
+  header.sequence = 9;
+  header.type = lifx::message::light::State::type;
+
+  auto start = Clock::now();
+  ASSERT_FALSE(filter.Contains(header, start));
+  filter.Record(header, start);
+  ASSERT_TRUE(filter.Contains(header, start));
+  ASSERT_TRUE(filter.Contains(header, start + std::chrono::milliseconds(99)));
+  ASSERT_FALSE(filter.Contains(header, start + std::chrono::milliseconds(100)));
+
+  filter.Clear();
+  ASSERT_FALSE(filter.Contains(header, start));
+
+  // Every sequence of a device fits in the cache at once
+  for (int sequence = 0; sequence <= UCHAR_MAX; ++sequence)
+  {
+    header.sequence = static_cast<uint8_t>(sequence);
+    filter.Record(header, start);
+  }
+  size_t remembered = 0;
+  for (int sequence = 0; sequence <= UCHAR_MAX; ++sequence)
+  {
+    header.sequence = static_cast<uint8_t>(sequence);
+    remembered += filter.Contains(header, start) ? 1 : 0;
+  }
+  ASSERT_EQ(static_cast<size_t>(UCHAR_MAX + 1), remembered);
+}
+
+TEST_F(TestClient, TileFrameBufferCommitsChangedTiles)
+{
+  lifx::TileFrameBuffer frame(*m_client, m_sendTarget.data(), 3);
+  ASSERT_EQ(3u, frame.Commit());
+  ASSERT_EQ(0u, frame.Commit());
+
+  while (m_client->WaitingToSend())
+  {
+    m_client->RunOnce();
+  }
+
+  frame.SetPixel(1, 2, 3, { 1, 2, 3, 4 });
+  ASSERT_EQ(1u, frame.Commit());
+  ASSERT_EQ(1u, m_client->PendingSendCount());
+
+  frame.Invalidate();
+  ASSERT_EQ(3u, frame.Commit());
+}
+
+TEST_F(TestClient, TileFrameBufferReplacesPendingTile)
+{
+  lifx::TileFrameBuffer frame(*m_client, m_sendTarget.data(), 2);
+  frame.Commit();
+  ASSERT_EQ(2u, m_client->PendingSendCount());
+
+  frame.SetPixel(0, 7, 7, { 100, 200, 300, 3500 });
+  ASSERT_EQ(1u, frame.Commit());
+  ASSERT_EQ(2u, m_client->PendingSendCount());
+
+  // Only the most recent frame of the tile should be waiting to be sent
+  bool found = false;
+  for (uint8_t gn = 1; gn != 0; ++gn)
+  {
+    auto header = m_client->GetPendingSendHeader(gn);
+    if (header.type != lifx::message::tile::Set64::type)
+      continue;
+    auto set = m_client->GetPendingSendMessage<lifx::message::tile::Set64>(
+      gn, header);
+    if (set.tile_index == 0)
+    {
+      ASSERT_EQ(100, set.colors[63].hue);
+      ASSERT_EQ(3500, set.colors[63].kelvin);
+      found = true;
+    }
+  }
+  ASSERT_TRUE(found);
+}
+
+TEST_F(TestClient, TileFrameBufferKeepsFrameOnReusedSequence)
+{
+  lifx::TileFrameBuffer frame(*m_client, m_sendTarget.data(), 2);
+  frame.Commit();
+  auto pendingTiles = [this]()
+  {
+    std::map<uint8_t, std::pair<uint8_t, uint16_t>> tiles;
+    for (uint8_t gn = 1; gn != 0; ++gn)
+    {
+      auto header = m_client->GetPendingSendHeader(gn);
+      if (header.type != lifx::message::tile::Set64::type)
+        continue;
+      auto set = m_client->GetPendingSendMessage<lifx::message::tile::Set64>(
+        gn, header);
+      tiles[set.tile_index] = { gn, set.colors[0].hue };
+    }
+    return tiles;
+  };
+  auto first = pendingTiles();
+  ASSERT_EQ(2u, first.size());
+  while (m_client->WaitingToSend())
+  {
+    m_client->RunOnce();
+  }
+
+  // Tile 1's next frame can only get the sequence tile 0 went out with
+  for (uint8_t gn = 1; gn != 0; ++gn)
+  {
+    if (gn != first[0].first)
+    {
+      m_client->OccupySequence(gn);
+    }
+  }
+  frame.SetPixel(1, 0, 0, { 111, 0, 0, 3500 });
+  ASSERT_EQ(1u, frame.Commit());
+  ASSERT_EQ(first[0].first, pendingTiles()[1].first);
+
+  // Tile 0's next frame must not take over tile 1's
+  m_client->ReleaseSequence(first[1].first);
+  frame.SetPixel(0, 0, 0, { 222, 0, 0, 3500 });
+  ASSERT_EQ(1u, frame.Commit());
+  auto tiles = pendingTiles();
+  ASSERT_EQ(2u, tiles.size());
+  ASSERT_EQ(111, tiles[1].second);
+  ASSERT_EQ(222, tiles[0].second);
+  ASSERT_EQ(first[1].first, tiles[0].first);
+}
+
+TEST_F(TestClient, ReassembleMultiZone)
+{
+  lifx::Reassembler reassembler(*m_client);
+  std::array<lifx::HSBK, 16> zones {};
+  size_t received = 0;
+  bool complete = false;
+
+  auto gn = reassembler.GetColorZones(m_sendTarget.data(), 0, 15,
+    zones.data(), zones.size(),
+    [&](const uint8_t*, const lifx::HSBK*, size_t count, bool done)
+    {
+      received = count;
+      complete = done;
+    });
+  ASSERT_NE(0, gn);
+  ASSERT_EQ(1u, reassembler.Pending());
+
+  for (uint8_t index : { 8, 0, 8 })
+  {
+    lifx::message::multizone::StateMultiZone msg {};
+    msg.count = 16;
+    msg.index = index;
+    for (uint16_t i = 0; i < 8; ++i)
+    {
+      msg.color[i].hue = index + i;
+    }
+    m_client->ReceivePacket<lifx::message::multizone::StateMultiZone>(
+      m_client->MakePacket(m_sendTarget.data(), gn, msg));
+  }
+
+  ASSERT_TRUE(complete);
+  ASSERT_EQ(16u, received);
+  ASSERT_EQ(0u, reassembler.Pending());
+  for (uint16_t i = 0; i < 16; ++i)
+  {
+    ASSERT_EQ(i, zones[i].hue);
+  }
+}
+
+TEST_F(TestClient, ReassembleMultiZoneFromDatagrams)
+{
+  lifx::Reassembler reassembler(*m_client);
+  std::array<lifx::HSBK, 16> zones {};
+  size_t received = 0;
+  bool complete = false;
+
+  auto gn = reassembler.GetColorZones(m_sendTarget.data(), 0, 15,
+    zones.data(), zones.size(),
+    [&](const uint8_t*, const lifx::HSBK*, size_t count, bool done)
+    {
+      received = count;
+      complete = done;
+    });
+
+  // The parts of a reply share their sequence & type, only the copy of a
+  // part is a duplicate
+  for (uint8_t index : { 0, 0, 8 })
+  {
+    lifx::message::multizone::StateMultiZone msg {};
+    msg.count = 16;
+    msg.index = index;
+    for (uint16_t i = 0; i < 8; ++i)
+    {
+      msg.color[i].hue = index + i;
+    }
+    auto packet = m_client->MakePacket(m_sendTarget.data(), gn, msg);
+    m_client->ProcessDatagram(packet.data(), packet.size());
+  }
+
+  ASSERT_TRUE(complete);
+  ASSERT_EQ(16u, received);
+  ASSERT_EQ(1u, m_client->DuplicateCount());
+  for (uint16_t i = 0; i < 16; ++i)
+  {
+    ASSERT_EQ(i, zones[i].hue);
+  }
+}
+
+TEST_F(TestClient, ReassembleCallbackStartsAnotherRequest)
+{
+  lifx::Reassembler reassembler(*m_client);
+  std::array<lifx::HSBK, 8> zones {};
+  std::array<uint8_t, 8> other = m_sendTarget;
+  other[0] = 0xFF;
+  std::array<uint8_t, 8> seen {};
+  size_t seenCount = 0;
+
+  auto gn = reassembler.GetColorZones(m_sendTarget.data(), 0, 7,
+    zones.data(), zones.size(),
+    [&](const uint8_t* target, const lifx::HSBK*, size_t count, bool)
+    {
+      // Takes over the slot of the request that just finished
+      reassembler.GetColorZones(other.data(), 0, 7, zones.data(), zones.size(),
+        [](const uint8_t*, const lifx::HSBK*, size_t, bool) { });
+      std::copy(target, target + seen.size(), seen.begin());
+      seenCount = count;
+    });
+
+  lifx::message::multizone::StateMultiZone msg {};
+  msg.count = 8;
+  m_client->ReceivePacket<lifx::message::multizone::StateMultiZone>(
+    m_client->MakePacket(m_sendTarget.data(), gn, msg));
+  ASSERT_EQ(m_sendTarget, seen);
+  ASSERT_EQ(8u, seenCount);
+  ASSERT_EQ(1u, reassembler.Pending());
+}
+
+TEST_F(TestClient, ReassembleTimeout)
+{
+  lifx::Reassembler reassembler(*m_client, std::chrono::milliseconds(0));
+  std::array<lifx::HSBK, 128> colors {};
+  bool called = false;
+  bool complete = true;
+
+  auto gn = reassembler.Get64(m_sendTarget.data(), 0, 2,
+    colors.data(), colors.size(),
+    [&](const uint8_t*, const lifx::HSBK*, size_t, bool done)
+    {
+      called = true;
+      complete = done;
+    });
+
+  lifx::message::tile::State64 msg {};
+  msg.tile_index = 1;
+  msg.colors[0].hue = 42;
+  m_client->ReceivePacket<lifx::message::tile::State64>(
+    m_client->MakePacket(m_sendTarget.data(), gn, msg));
+  ASSERT_FALSE(called);
+  ASSERT_EQ(42, colors[64].hue);
+
+  reassembler.Update();
+  ASSERT_TRUE(called);
+  ASSERT_FALSE(complete);
+  ASSERT_EQ(0u, reassembler.Pending());
+}
+
+TEST_F(TestClient, ReassembleRejectsSmallBuffer)
+{
+  lifx::Reassembler reassembler(*m_client);
+  std::array<lifx::HSBK, 8> zones {};
+  ASSERT_EQ(0, reassembler.GetColorZones(m_sendTarget.data(), 0, 15,
+    zones.data(), zones.size(), nullptr));
+  ASSERT_FALSE(m_client->WaitingToSend());
+}
+
+TEST(TestEffects, PlanPeriodicAsWaveform)
+{
+  constexpr lifx::HSBK off = { 0, 0, 0, 3500 };
+  constexpr lifx::HSBK on = { 0, 0, 65535, 3500 };
+
+  lifx::Effect breathe;
+  breathe.keyframes = {
+    { 0, off, lifx::Easing::LINEAR },
+    { 1000, on, lifx::Easing::EASE_IN_OUT },
+    { 2000, off, lifx::Easing::EASE_IN_OUT },
+  };
+  breathe.repeat = 300;
+
+  auto steps = lifx::EffectEngine::Plan(breathe, 50);
+  ASSERT_EQ(2u, steps.size());
+  ASSERT_FALSE(steps[0].waveform);
+  ASSERT_TRUE(steps[1].waveform);
+  ASSERT_EQ(static_cast<uint8_t>(lifx::Waveform::SINE), steps[1].wave.waveform);
+  ASSERT_EQ(2000u, steps[1].wave.period);
+  ASSERT_EQ(300.0f, steps[1].wave.cycles);
+  ASSERT_EQ(65535, steps[1].wave.color.brightness);
+}
+
+TEST(TestEffects, PlanLinearAsTransitions)
+{
+  lifx::Effect fade;
+  fade.keyframes = {
+    { 0, { 0, 65535, 65535, 3500 }, lifx::Easing::LINEAR },
+    { 5000, { 20000, 65535, 65535, 3500 }, lifx::Easing::LINEAR },
+    { 8000, { 40000, 65535, 65535, 3500 }, lifx::Easing::LINEAR },
+  };
+
+  auto steps = lifx::EffectEngine::Plan(fade, 50);
+  ASSERT_EQ(3u, steps.size());
+  ASSERT_EQ(0u, steps[1].time);
+  ASSERT_EQ(5000u, steps[1].color.duration);
+  ASSERT_EQ(5000u, steps[2].time);
+  ASSERT_EQ(3000u, steps[2].color.duration);
+}
+
+TEST(TestEffects, PlanEasedAsFrames)
+{
+  lifx::Effect ease;
+  ease.keyframes = {
+    { 0, { 0, 0, 0, 3500 }, lifx::Easing::LINEAR },
+    { 1000, { 0, 0, 65535, 3500 }, lifx::Easing::EASE_IN },
+  };
+
+  auto steps = lifx::EffectEngine::Plan(ease, 100);
+  ASSERT_EQ(11u, steps.size());
+  ASSERT_EQ(900u, steps.back().time);
+  ASSERT_EQ(65535, steps.back().color.color.brightness);
+  ASSERT_LT(steps[1].color.color.brightness, 65535 / 10);
+}
+
+TEST_F(TestClient, EffectEnginePhaseOffsets)
+{
+  lifx::Effect effect;
+  effect.keyframes = {
+    { 0, { 0, 0, 0, 3500 }, lifx::Easing::LINEAR },
+    { 1000, { 0, 0, 65535, 3500 }, lifx::Easing::LINEAR },
+  };
+
+  std::vector<std::array<uint8_t, 8>> targets(3, m_sendTarget);
+  targets[1][0] = 1;
+  targets[2][0] = 2;
+
+  lifx::EffectEngine engine(*m_client);
+  engine.Play(effect, targets, std::chrono::hours(1));
+  ASSERT_EQ(2u, engine.Update());
+  ASSERT_EQ(2u, m_client->PendingSendCount());
+  ASSERT_TRUE(engine.Playing());
+
+  engine.Stop(targets[1].data());
+  engine.Stop(targets[2].data());
+  ASSERT_FALSE(engine.Playing());
+}
+
+TEST_F(TestClient, EffectEngineCarriesOverWhenQueueIsFull)
+{
+  m_client->SetRateLimits(1000000, 1000000);
+
+  lifx::Effect effect;
+  effect.keyframes = {
+    { 0, { 0, 0, 0, 3500 }, lifx::Easing::LINEAR },
+    { 1000, { 0, 0, 65535, 3500 }, lifx::Easing::LINEAR },
+  };
+
+  std::vector<std::array<uint8_t, 8>> targets(300, m_sendTarget);
+  for (size_t i = 0; i < targets.size(); ++i)
+  {
+    targets[i][0] = static_cast<uint8_t>(i);
+    targets[i][1] = static_cast<uint8_t>(i >> 8);
+  }
+
+  lifx::EffectEngine engine(*m_client);
+  engine.Play(effect, targets);
+
+  size_t queued = 0;
+  while (engine.Playing())
+  {
+    auto count = engine.Update();
+    ASSERT_LE(m_client->PendingSendCount(), lifx::EFFECT_QUEUE_LIMIT);
+    ASSERT_TRUE(count > 0 || m_client->PendingSendCount() > 0);
+    queued += count;
+
+    while (m_client->WaitingToSend())
+    {
+      m_client->RunOnce();
+    }
+  }
+
+  ASSERT_EQ(2 * targets.size(), queued);
+  ASSERT_EQ(queued, m_client->m_sentCount);
+}
+
+TEST(TestWaveform, Helpers)
+{
+  constexpr lifx::HSBK red = { 62978, 65535, 65535, 3500 };
+
+  auto breathe = lifx::waveform::Breathe(red, 4000, 150.0f);
+  ASSERT_EQ(static_cast<uint8_t>(lifx::Waveform::SINE), breathe.waveform);
+  ASSERT_EQ(4000u, breathe.period);
+  ASSERT_EQ(150.0f, breathe.cycles);
+  ASSERT_EQ(1, breathe.transient);
+
+  auto pulse = lifx::waveform::Pulse(red, 1000, 10.0f, 0.25f);
+  ASSERT_EQ(static_cast<uint8_t>(lifx::Waveform::PULSE), pulse.waveform);
+  ASSERT_EQ(lifx::waveform::SkewRatio(0.25f), pulse.skew_ratio);
+
+  ASSERT_EQ(-32768, lifx::waveform::SkewRatio(-1.0f));
+  ASSERT_EQ(32767, lifx::waveform::SkewRatio(2.0f));
+
+  auto optional = lifx::waveform::BreatheBrightness(1000, 2000, 5.0f);
+  ASSERT_EQ(0, optional.set_hue);
+  ASSERT_EQ(0, optional.set_saturation);
+  ASSERT_EQ(1, optional.set_brightness);
+  ASSERT_EQ(0, optional.set_kelvin);
+  ASSERT_EQ(1000, optional.color.brightness);
+}
+
+TEST_F(TestClient, SendWaveformOptional)
+{
+  auto gn = m_client->Send(lifx::waveform::Optional(
+    lifx::waveform::Strobe({ 0, 0, 65535, 6500 }, 100, 20.0f),
+    false, false, true, false), m_sendTarget.data());
+  lifx::Header header = m_client->GetPendingSendHeader(gn);
+  ASSERT_EQ(lifx::message::light::SetWaveformOptional::type, header.type);
+  ASSERT_EQ(25u, sizeof(lifx::message::light::SetWaveformOptional));
+
+  auto msg = m_client->GetPendingSendMessage<
+    lifx::message::light::SetWaveformOptional>(gn, header);
+  ASSERT_EQ(20.0f, msg.cycles);
+  ASSERT_EQ(1, msg.set_brightness);
+}
+
+TEST_F(TestClient, ClockSyncAppliesAtCommonTime)
+{
+  constexpr int64_t second = 1000000000;
+  std::array<uint8_t, 8> other = m_sendTarget;
+  other[0] = 0xFF;
+
+  lifx::ClockSync sync(*m_client);
+  auto gnA = sync.Sample(m_sendTarget.data());
+  auto gnB = sync.Sample(other.data());
+  while (m_client->WaitingToSend())
+  {
+    m_client->RunOnce();
+  }
+
+  lifx::message::device::StateInfo info {};
+  info.time = lifx::ClockSync::Now() + 5 * second;
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(m_sendTarget.data(), gnA, info));
+  info.time = lifx::ClockSync::Now() - 2 * second;
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(other.data(), gnB, info));
+
+  lifx::ClockSync::Estimate estimate {};
+  ASSERT_TRUE(sync.GetEstimate(m_sendTarget.data(), estimate));
+  ASSERT_NEAR(5 * second, estimate.offset, second / 100);
+
+  lifx::message::light::SetColor color {};
+  auto applyTime = sync.Apply<lifx::message::light::SetColor>(
+    { { m_sendTarget, color }, { other, color } });
+  ASSERT_GT(applyTime, lifx::ClockSync::Now());
+  ASSERT_EQ(2u, m_client->PendingSendCount());
+
+  std::vector<uint64_t> atTimes;
+  for (uint8_t gn = 1; gn != 0; ++gn)
+  {
+    auto header = m_client->GetPendingSendHeader(gn);
+    if (header.type == lifx::message::light::SetColor::type)
+    {
+      ASSERT_NEAR(applyTime, header.at_time, 6 * second);
+      atTimes.push_back(header.at_time);
+    }
+  }
+  ASSERT_EQ(2u, atTimes.size());
+  ASSERT_NEAR(7 * second, std::abs(static_cast<int64_t>(atTimes[0] - atTimes[1])),
+    second / 50);
+}
+
+TEST_F(TestClient, ClockSyncOnlyUsesItsOwnSamples)
+{
+  constexpr int64_t second = 1000000000;
+  std::array<uint8_t, 8> other = m_sendTarget;
+  other[0] = 0xFF;
+
+  lifx::ClockSync sync(*m_client);
+  auto gn = sync.Sample(m_sendTarget.data());
+  auto unsampled = m_client->Send<lifx::message::device::GetInfo>(
+    m_sendTarget.data());
+  while (m_client->WaitingToSend())
+  {
+    m_client->RunOnce();
+  }
+
+  lifx::message::device::StateInfo info {};
+  info.time = lifx::ClockSync::Now() + 5 * second;
+  lifx::ClockSync::Estimate estimate {};
+
+  // Another controller's reply under the same sequence
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(m_sendTarget.data(), gn, info, 1234));
+  ASSERT_FALSE(sync.GetEstimate(m_sendTarget.data(), estimate));
+
+  // A reply to a request the clock sync didn't send
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(m_sendTarget.data(), unsampled, info));
+  ASSERT_FALSE(sync.GetEstimate(m_sendTarget.data(), estimate));
+
+  // Another device answering under the sample's sequence
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(other.data(), gn, info));
+  ASSERT_FALSE(sync.GetEstimate(other.data(), estimate));
+
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(m_sendTarget.data(), gn, info));
+  ASSERT_TRUE(sync.GetEstimate(m_sendTarget.data(), estimate));
+  ASSERT_NEAR(5 * second, estimate.offset, second / 100);
+
+  // The sample is answered, so a late copy can't replace it
+  info.time = lifx::ClockSync::Now() - 5 * second;
+  m_client->ReceivePacket<lifx::message::device::StateInfo>(
+    m_client->MakePacket(m_sendTarget.data(), gn, info));
+  ASSERT_TRUE(sync.GetEstimate(m_sendTarget.data(), estimate));
+  ASSERT_NEAR(5 * second, estimate.offset, second / 100);
+}
+
+TEST_F(TestClient, ClockSyncLeadTimeFollowsRateAndScenes)
+{
+  constexpr uint64_t millisecond = 1000000;
+  m_client->SetRateLimits(10, 10);
+  ASSERT_EQ(10u, m_client->RateLimit());
+
+  lifx::SceneBuilder builder;
+  for (int i = 0; i < 10; ++i)
+  {
+    builder.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  }
+  m_client->Apply(builder.Build());
+  ASSERT_EQ(10u, m_client->PendingSceneCount());
+
+  // Ten scene messages and two of its own at ten a second
+  lifx::ClockSync sync(*m_client);
+  auto before = lifx::ClockSync::Now();
+  lifx::message::light::SetColor color {};
+  auto applyTime = sync.Apply<lifx::message::light::SetColor>(
+    { { m_sendTarget, color }, { m_sendTarget, color } },
+    std::chrono::milliseconds(0));
+  ASSERT_GE(applyTime - before, 1200 * millisecond);
+  ASSERT_LT(applyTime - before, 1300 * millisecond);
+}
+
+TEST_F(TestClient, SceneInterleavesDevices)
+{
+  std::array<uint8_t, 8> other = m_sendTarget;
+  other[0] = 0xFF;
+
+  lifx::SceneBuilder builder;
+  builder.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  builder.Add(m_sendTarget.data(), lifx::message::light::SetColor{});
+  builder.Add(other.data(), lifx::message::device::SetPower{ 65535 });
+  auto scene = builder.Build();
+
+  ASSERT_EQ(3u, scene->Size());
+  ASSERT_EQ(lifx::TargetKey(m_sendTarget.data()), scene->GetEntry(0).device);
+  ASSERT_EQ(lifx::TargetKey(other.data()), scene->GetEntry(1).device);
+  ASSERT_EQ(lifx::TargetKey(m_sendTarget.data()), scene->GetEntry(2).device);
+}
+
+TEST_F(TestClient, SceneApplyAndReapply)
+{
+  lifx::SceneBuilder builder(123);
+  std::array<uint8_t, 8> target = m_sendTarget;
+  for (uint8_t i = 0; i < 10; ++i)
+  {
+    target[0] = i;
+    builder.Add(target.data(), lifx::message::light::SetColor{});
+  }
+  auto scene = builder.Build();
+
+  for (auto&& pass : { 1, 2 })
+  {
+    uint32_t finished = 0;
+    auto id = m_client->Apply(scene, [&finished](uint32_t done)
+    {
+      finished = done;
+    });
+    ASSERT_TRUE(m_client->Applying(id));
+    ASSERT_TRUE(m_client->WaitingToSend());
+    ASSERT_EQ(0u, m_client->PendingSendCount());
+
+    while (m_client->WaitingToSend())
+    {
+      m_client->RunOnce();
+    }
+    ASSERT_EQ(id, finished);
+    ASSERT_FALSE(m_client->Applying(id));
+    ASSERT_EQ(10u * pass, m_client->m_sentCount);
+  }
+
+  lifx::NetworkHeader nh;
+  memcpy(&nh, m_client->m_lastSent.data(), lifx::LIFX_HEADER_SIZE);
+  auto header = m_client->FromNetwork(nh);
+  ASSERT_EQ(123u, header.source);
+  ASSERT_EQ(lifx::SCENE_SEQUENCE, header.sequence);
+  ASSERT_EQ(m_client->m_lastSent.size(), header.size);
+}
+
+TEST_F(TestClient, SceneDeviceRateLimit)
+{
+  m_client->SetRateLimits(1000, 1);
+
+  lifx::SceneBuilder builder;
+  builder.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  builder.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  m_client->Apply(builder.Build());
+
+  ASSERT_EQ(TestLifxClient::RunResult::RUN_SENT_DATA, m_client->RunOnce());
+  ASSERT_EQ(TestLifxClient::RunResult::RUN_SENT_LIMIT, m_client->RunOnce());
+  ASSERT_EQ(1u, m_client->m_sentCount);
+}
+
+TEST_F(TestClient, SceneLimitedDeviceDoesNotBlockOthers)
+{
+  m_client->SetRateLimits(1000, 1);
+  std::array<uint8_t, 8> other = m_sendTarget;
+  other[0] = 0xFF;
+
+  lifx::SceneBuilder first;
+  first.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  first.Add(m_sendTarget.data(), lifx::message::device::SetPower{ 65535 });
+  auto firstId = m_client->Apply(first.Build());
+  lifx::SceneBuilder second;
+  second.Add(other.data(), lifx::message::device::SetPower{ 65535 });
+  uint32_t finished = 0;
+  auto secondId = m_client->Apply(second.Build(),
+    [&finished](uint32_t id) { finished = id; });
+
+  ASSERT_EQ(TestLifxClient::RunResult::RUN_SENT_DATA, m_client->RunOnce());
+  // The first scene's device is at its limit, the second scene goes ahead
+  ASSERT_EQ(TestLifxClient::RunResult::RUN_SENT_DATA, m_client->RunOnce());
+  ASSERT_EQ(secondId, finished);
+  ASSERT_TRUE(m_client->Applying(firstId));
+  ASSERT_EQ(TestLifxClient::RunResult::RUN_SENT_LIMIT, m_client->RunOnce());
+  ASSERT_EQ(2u, m_client->m_sentCount);
+}
+
+class TimeoutTransport : public lifx::Transport
+{
+  public:
+    int Send(const char*, size_t length) override
+    {
+      return static_cast<int>(length);
+    }
+
+    int Receive(std::chrono::microseconds timeout, const ReceiveHandler&) override
+    {
+      m_timeouts.push_back(timeout);
+      return 0;
+    }
+
+    std::vector<std::chrono::microseconds> m_timeouts;
+};
+
+TEST(TestSceneWait, WaitsForLimitedDevice)
+{
+  auto transport = new TimeoutTransport();
+  lifx::LifxClient client(std::unique_ptr<lifx::Transport>(transport), 0);
+  client.SetRateLimits(1000, 1);
+  uint8_t target[8] = { 1, 2, 3, 4, 5, 6, 0, 0 };
+
+  lifx::SceneBuilder builder;
+  builder.Add(target, lifx::message::device::SetPower{ 65535 });
+  builder.Add(target, lifx::message::device::SetPower{ 65535 });
+  client.Apply(builder.Build());
+
+  // The first message is ready, so there's no waiting for packets
+  ASSERT_EQ(lifx::LifxClient::RunResult::RUN_SENT_DATA, client.RunOnce(0, 500));
+  ASSERT_EQ(std::chrono::microseconds::zero(), transport->m_timeouts.back());
+
+  // The device is at its limit for a second, longer than the timeout
+  ASSERT_EQ(lifx::LifxClient::RunResult::RUN_SENT_LIMIT, client.RunOnce(0, 500));
+  ASSERT_EQ(std::chrono::milliseconds(500), transport->m_timeouts.back());
+
+  // And the wait ends once the device can take the next message
+  client.RunOnce(5, 0);
+  ASSERT_GT(transport->m_timeouts.back(), std::chrono::milliseconds(900));
+  ASSERT_LE(transport->m_timeouts.back(), std::chrono::seconds(1));
+}
+
+TEST(TestFanout, BroadcastWhenAllDevicesMatch)
+{
+  std::vector<std::array<uint8_t, 8>> targets;
+  lifx::FanoutPlanner planner;
+  for (uint8_t i = 0; i < 50; ++i)
+  {
+    targets.push_back({ { i, 1, 2, 3, 4, 5, 0, 0 } });
+    planner.AddDevice(targets.back().data());
+  }
+
+  lifx::message::device::SetPower off{ 0 };
+  auto scene = planner.Plan(targets, off, 2);
+  ASSERT_EQ(2u, scene->Size());
+  ASSERT_EQ(0u, scene->GetEntry(0).device);
+  ASSERT_EQ(0u, scene->GetEntry(1).device);
+
+  // Duplicates don't make up for a missing device
+  targets.back() = targets.front();
+  scene = planner.Plan(targets, off, 2);
+  ASSERT_EQ(100u, scene->Size());
+  ASSERT_NE(0u, scene->GetEntry(0).device);
+}
+
+TEST(TestFanout, TargetedWhenPayloadsDiffer)
+{
+  std::vector<std::pair<std::array<uint8_t, 8>, lifx::message::light::SetColor>>
+    entries;
+  lifx::FanoutPlanner planner;
+  for (uint8_t i = 0; i < 3; ++i)
+  {
+    entries.push_back({ { { i, 1, 2, 3, 4, 5, 0, 0 } }, {} });
+    planner.AddDevice(entries.back().first.data());
+  }
+
+  ASSERT_EQ(1u, planner.Plan(entries)->Size());
+
+  entries[1].second.color.hue = 1000;
+  auto scene = planner.Plan(entries);
+  ASSERT_EQ(3u, scene->Size());
+  for (size_t i = 0; i < scene->Size(); ++i)
+  {
+    ASSERT_EQ(lifx::TargetKey(entries[i].first.data()),
+      scene->GetEntry(i).device);
+  }
+}
+
+// Sends packets over the loopback interface and collects what arrives
+std::vector<std::vector<char>> Exchange(lifx::TransportType senderType,
+  lifx::TransportType receiverType, size_t count)
+{
+  auto receiver = lifx::CreateTransport(receiverType, lifx::EPHEMERAL_PORT);
+  auto port = static_cast<lifx::SocketTransport&>(*receiver).LocalPort();
+  auto sender = lifx::CreateTransport(senderType, lifx::EPHEMERAL_PORT,
+    "127.0.0.1", port);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    auto packet = lifx::LifxClient::Encode(
+      lifx::MakeHeader<lifx::message::device::StatePower>(nullptr, 0,
+        static_cast<uint8_t>(i)), lifx::message::device::StatePower { 1 });
+    EXPECT_EQ(static_cast<int>(packet.size()),
+      sender->Send(packet.data(), packet.size()));
+  }
+  sender->Flush();
+
+  std::vector<std::vector<char>> received;
+  for (size_t i = 0; i < count + 100 && received.size() < count; ++i)
+  {
+    auto result = receiver->Receive(std::chrono::milliseconds(10),
+      [&received](const lifx::Datagram& datagram)
+    {
+      EXPECT_FALSE(datagram.loopback);
+      received.emplace_back(datagram.data, datagram.data + datagram.length);
+    });
+    EXPECT_GE(result, 0);
+  }
+  return received;
+}
+
+TEST(TestTransport, SocketLoopback)
+{
+  auto received = Exchange(lifx::TransportType::SOCKET,
+    lifx::TransportType::SOCKET, 3);
+  ASSERT_EQ(3u, received.size());
+  for (size_t i = 0; i < received.size(); ++i)
+  {
+    ASSERT_EQ(i, lifx::wire::DecodeHeader(received[i].data()).sequence);
+  }
+}
+
+#ifdef __linux__
+TEST(TestTransport, KernelTimestamps)
+{
+  for (auto type : { lifx::TransportType::SOCKET, lifx::TransportType::IO_URING })
+  {
+    auto receiver = lifx::CreateTransport(type, lifx::EPHEMERAL_PORT);
+    lifx::SocketTransport sender(lifx::EPHEMERAL_PORT, "127.0.0.1",
+      static_cast<lifx::SocketTransport&>(*receiver).LocalPort());
+
+    auto before = lifx::ClockSync::Now();
+    auto packet = lifx::LifxClient::Encode(
+      lifx::MakeHeader<lifx::message::device::GetPower>(nullptr, 0, 1),
+      lifx::message::device::GetPower { });
+    ASSERT_EQ(static_cast<int>(packet.size()), sender.Send(packet.data(), packet.size()));
+
+    // Stamped on arrival, before the receiver got around to reading it
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t timestamp = 0;
+    ASSERT_EQ(1, receiver->Receive(std::chrono::seconds(1),
+      [&timestamp](const lifx::Datagram& datagram) { timestamp = datagram.timestamp; }));
+    ASSERT_GE(timestamp, before);
+    ASSERT_LT(timestamp, lifx::ClockSync::Now() - 10000000);
+  }
+}
+#endif
+
+TEST(TestTransport, LowLatencySocket)
+{
+  lifx::SocketTransport receiver(lifx::EPHEMERAL_PORT);
+  lifx::LowLatencyOptions options;
+  options.yield = true;
+  options.busyPoll = std::chrono::microseconds::zero();
+  options.priority = 6;
+  options.dscp = 46;
+  ASSERT_TRUE(receiver.EnableLowLatency(options));
+  lifx::SocketTransport sender(lifx::EPHEMERAL_PORT, "127.0.0.1",
+    receiver.LocalPort());
+  ASSERT_TRUE(sender.EnableLowLatency(options));
+
+  // Spinning gives up once the timeout has passed
+  size_t received = 0;
+  auto count = [&received](const lifx::Datagram&) { ++received; };
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(0, receiver.Receive(std::chrono::milliseconds(5), count));
+  ASSERT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(5));
+  ASSERT_EQ(0, receiver.Receive(std::chrono::microseconds::zero(), count));
+
+  auto packet = lifx::LifxClient::Encode(
+    lifx::MakeHeader<lifx::message::device::GetPower>(nullptr, 0, 1),
+    lifx::message::device::GetPower { });
+  ASSERT_EQ(static_cast<int>(packet.size()), sender.Send(packet.data(), packet.size()));
+  ASSERT_EQ(1, receiver.Receive(std::chrono::seconds(1), count));
+  ASSERT_EQ(1u, received);
+}
+
+#ifdef LIFX_IO_URING
+TEST(TestTransport, UringLoopback)
+{
+  // More than the ring has send slots or receive buffers
+  for (auto types : { std::make_pair(lifx::TransportType::IO_URING,
+    lifx::TransportType::SOCKET), std::make_pair(lifx::TransportType::SOCKET,
+    lifx::TransportType::IO_URING), std::make_pair(
+    lifx::TransportType::IO_URING, lifx::TransportType::IO_URING) })
+  {
+    auto received = Exchange(types.first, types.second, 200);
+    ASSERT_EQ(200u, received.size());
+    for (size_t i = 0; i < received.size(); ++i)
+    {
+      auto header = lifx::wire::DecodeHeader(received[i].data());
+      ASSERT_EQ(static_cast<uint8_t>(i), header.sequence);
+      ASSERT_EQ(header.size, received[i].size());
+    }
+  }
+}
+#endif
+
+// A client & devices on a loopback network
+struct SimulatedFleet
+{
+  SimulatedFleet(size_t count, uint32_t seed = 1)
+    : network(seed)
+    , client(std::unique_ptr<lifx::Transport>(
+      new lifx::LoopbackTransport(network)), 42)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, static_cast<uint8_t>(i + 1) };
+      devices.emplace_back(new lifx::SimulatedDevice(network, target));
+    }
+  }
+
+  // Runs the client & devices until nothing is left to send or deliver
+  void Run(std::chrono::microseconds step = std::chrono::microseconds(1000))
+  {
+    for (int i = 0; i < 1000 && (client.WaitingToSend() ||
+      network.InFlight() > 0); ++i)
+    {
+      while (client.RunOnce(0, 0) !=
+        lifx::LifxClient::RunResult::RUN_WAITING) { }
+      for (auto& device : devices)
+      {
+        device->Poll();
+      }
+      network.Advance(step);
+    }
+  }
+
+  lifx::LoopbackNetwork network;
+  lifx::LifxClient client;
+  std::vector<std::unique_ptr<lifx::SimulatedDevice>> devices;
+};
+
+TEST(TestLoopback, DiscoversSimulatedDevices)
+{
+  SimulatedFleet fleet(3);
+  std::vector<uint64_t> found;
+  fleet.client.Subscribe<lifx::message::device::StateService>(
+    [&found](const lifx::Header& header,
+      const lifx::message::device::StateService& service)
+    {
+      ASSERT_EQ(42u, header.source);
+      ASSERT_EQ(lifx::LIFX_PORT, service.port);
+      found.push_back(lifx::TargetKey(header.target));
+    });
+
+  fleet.client.Broadcast<lifx::message::device::GetService>();
+  fleet.Run();
+  ASSERT_EQ(3u, found.size());
+  std::sort(found.begin(), found.end());
+  ASSERT_EQ(found.end(), std::unique(found.begin(), found.end()));
+
+  // Targeted sets only reach their device
+  uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, 2 };
+  lifx::message::light::SetColor color = { };
+  color.color = { 1, 2, 3, 4 };
+  fleet.client.Send(color, target);
+  fleet.Run();
+  ASSERT_EQ(0u, fleet.devices[0]->Light().color.hue);
+  ASSERT_EQ(1u, fleet.devices[1]->Light().color.hue);
+  // Like on a real network the client broadcasts targeted packets too
+  ASSERT_EQ(9u, fleet.network.Stats().delivered);
+}
+
+TEST(TestLoopback, InjectsFaults)
+{
+  SimulatedFleet fleet(2);
+  lifx::LoopbackFaults faults;
+  faults.loss = 1;
+  fleet.network.SetFaults(faults);
+  fleet.client.Broadcast<lifx::message::device::GetService>();
+  fleet.Run();
+  ASSERT_EQ(2u, fleet.network.Stats().lost);
+  ASSERT_EQ(0u, fleet.devices[0]->HandledCount());
+
+  // Each device answers both copies of the request, and the client drops
+  // all but one of the four replies that arrive from each
+  int replies = 0;
+  fleet.client.Subscribe<lifx::message::device::StateService>(
+    [&replies](const lifx::Header&, const lifx::message::device::StateService&)
+    { ++replies; });
+  faults = lifx::LoopbackFaults();
+  faults.duplicate = 1;
+  fleet.network.SetFaults(faults);
+  fleet.client.Broadcast<lifx::message::device::GetService>();
+  fleet.Run();
+  ASSERT_EQ(2, replies);
+  ASSERT_EQ(6u, fleet.client.DuplicateCount());
+  ASSERT_EQ(2u, fleet.devices[0]->HandledCount());
+
+  // Nothing arrives before its delay has passed
+  faults = lifx::LoopbackFaults();
+  faults.delay = std::chrono::milliseconds(5);
+  fleet.network.SetFaults(faults);
+  fleet.client.Broadcast<lifx::message::device::GetService>();
+  while (fleet.client.WaitingToSend())
+  {
+    fleet.client.RunOnce(0, 0);
+  }
+  fleet.network.Advance(std::chrono::milliseconds(4));
+  ASSERT_EQ(0u, fleet.devices[0]->Poll());
+  fleet.network.Advance(std::chrono::milliseconds(1));
+  ASSERT_EQ(1u, fleet.devices[0]->Poll());
+}
+
+TEST(TestLoopback, FaultsAreDeterministic)
+{
+  auto run = [](uint32_t seed)
+  {
+    lifx::LoopbackNetwork network(seed);
+    lifx::LoopbackFaults faults;
+    faults.loss = 0.2;
+    faults.duplicate = 0.2;
+    faults.reorder = 0.3;
+    faults.jitter = std::chrono::microseconds(500);
+    network.SetFaults(faults);
+
+    auto sender = network.Attach();
+    auto receiver = network.Attach();
+    for (char i = 0; i < 100; ++i)
+    {
+      network.Send(sender, receiver, &i, 1);
+    }
+    network.Advance(std::chrono::milliseconds(1));
+    std::vector<char> order;
+    network.Deliver(receiver, [&order](uint32_t, const char* data, size_t)
+    {
+      order.push_back(*data);
+    });
+
+    auto stats = network.Stats();
+    EXPECT_EQ(100u, stats.sent);
+    EXPECT_EQ(100u - stats.lost + stats.duplicated, order.size());
+    EXPECT_GT(stats.reordered, 0u);
+    EXPECT_FALSE(std::is_sorted(order.begin(), order.end()));
+    return order;
+  };
+
+  ASSERT_EQ(run(7), run(7));
+  ASSERT_NE(run(7), run(8));
+}
+
+TEST(TestLoopback, RoutesToDevices)
+{
+  SimulatedFleet fleet(3);
+  auto* transport = new lifx::LoopbackTransport(fleet.network);
+  transport->SetRouting(true);
+  lifx::LifxClient client(std::unique_ptr<lifx::Transport>(transport), 43);
+  client.Broadcast<lifx::message::device::GetService>();
+  for (int i = 0; i < 3; ++i)
+  {
+    while (client.RunOnce(0, 0) != lifx::LifxClient::RunResult::RUN_WAITING) { }
+    for (auto& device : fleet.devices)
+    {
+      device->Poll();
+    }
+  }
+
+  // Once a device has answered, packets for it only go to it
+  auto delivered = fleet.network.Stats().delivered;
+  uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, 3 };
+  client.Send<lifx::message::light::Get>(target);
+  while (client.RunOnce(0, 0) != lifx::LifxClient::RunResult::RUN_WAITING) { }
+  for (auto& device : fleet.devices)
+  {
+    device->Poll();
+  }
+  ASSERT_EQ(delivered + 1, fleet.network.Stats().delivered);
+  ASSERT_EQ(2u, fleet.devices[2]->HandledCount());
+}
+
+TEST(TestSharded, RoutesRepliesToOwningShard)
+{
+  constexpr size_t DEVICES = 32;
+  lifx::LoopbackNetwork network;
+  std::vector<std::unique_ptr<lifx::SimulatedDevice>> devices;
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, static_cast<uint8_t>(i + 1) };
+    devices.emplace_back(new lifx::SimulatedDevice(network, target));
+  }
+
+  lifx::ShardedController controller(4, [&network](size_t)
+  {
+    auto* transport = new lifx::LoopbackTransport(network);
+    transport->SetRouting(true);
+    return std::unique_ptr<lifx::Transport>(transport);
+  }, 100);
+  ASSERT_EQ(4u, controller.ShardCount());
+  ASSERT_EQ(103u, controller.SourceOf(3));
+
+  std::atomic<int> discovered(0);
+  std::atomic<int> replies(0);
+  std::atomic<int> misrouted(0);
+  controller.Subscribe<lifx::message::device::StateService>(
+    [&discovered](const lifx::Header&, const lifx::message::device::StateService&)
+    { ++discovered; });
+  controller.Subscribe<lifx::message::light::State>(
+    [&](const lifx::Header& header, const lifx::message::light::State&)
+    {
+      ++replies;
+      if (header.source != controller.SourceOf(controller.ShardOf(header.target)))
+      {
+        ++misrouted;
+      }
+    });
+  controller.PostAll([](lifx::LifxClient& client)
+  {
+    client.Broadcast<lifx::message::device::GetService>();
+  });
+
+  auto poll = [&devices](const std::function<bool()>& done)
+  {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done() && std::chrono::steady_clock::now() < deadline)
+    {
+      for (auto& device : devices)
+      {
+        device->Poll();
+      }
+      std::this_thread::yield();
+    }
+  };
+  poll([&discovered]() { return discovered == 4 * DEVICES; });
+  ASSERT_EQ(static_cast<int>(4 * DEVICES), discovered);
+
+  std::vector<size_t> owners(controller.ShardCount());
+  for (size_t i = 0; i < DEVICES; ++i)
+  {
+    uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, static_cast<uint8_t>(i + 1) };
+    ++owners[controller.ShardOf(target)];
+    controller.Send(target, lifx::message::light::Get());
+  }
+  poll([&replies]() { return replies == DEVICES; });
+  controller.Stop();
+  ASSERT_EQ(static_cast<int>(DEVICES), replies);
+  ASSERT_EQ(0, misrouted);
+  for (auto owned : owners)
+  {
+    ASSERT_GT(owned, 0u);
+  }
+  // Each device heard every shard's discovery but only its own request
+  for (auto& device : devices)
+  {
+    ASSERT_EQ(controller.ShardCount() + 1, device->HandledCount());
+  }
+}
+
+#ifdef __linux__
+TEST(TestSharded, SocketShardsGetTheirOwnReplies)
+{
+  // A device on the loopback interface, answering whoever asked
+  int device = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(device, 0);
+  sockaddr_in address = { };
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addressLength = sizeof(address);
+  ASSERT_EQ(0, bind(device, reinterpret_cast<sockaddr*>(&address), sizeof(address)));
+  ASSERT_EQ(0, getsockname(device, reinterpret_cast<sockaddr*>(&address),
+    &addressLength));
+  timeval timeout = { 0, 10000 };
+  setsockopt(device, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  constexpr size_t SHARDS = 4;
+  lifx::ShardedController controller(SHARDS, lifx::TransportType::SOCKET, 100,
+    "127.0.0.1", ntohs(address.sin_port));
+  std::array<std::atomic<int>, SHARDS> replies {};
+  controller.Subscribe<lifx::message::device::StatePower>(
+    [&replies](const lifx::Header& header, const lifx::message::device::StatePower&)
+    {
+      ++replies[header.source - 100];
+    });
+  for (size_t shard = 0; shard < SHARDS; ++shard)
+  {
+    controller.Post(shard, [](lifx::LifxClient& client)
+    {
+      uint8_t target[8] = { 0xD0, 0x73, 0xD5, 0, 0, 1 };
+      client.Send<lifx::message::device::GetPower>({}, target);
+    });
+  }
+
+  int answered = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (std::chrono::steady_clock::now() < deadline)
+  {
+    int total = 0;
+    for (auto& count : replies)
+    {
+      total += count;
+    }
+    if (total == static_cast<int>(SHARDS))
+      break;
+
+    char buffer[lifx::MAX_LIFX_PACKET_SIZE];
+    sockaddr_in from = { };
+    socklen_t fromLength = sizeof(from);
+    auto length = recvfrom(device, buffer, sizeof(buffer), 0,
+      reinterpret_cast<sockaddr*>(&from), &fromLength);
+    if (length < static_cast<ssize_t>(lifx::LIFX_HEADER_SIZE))
+      continue;
+
+    auto request = lifx::wire::DecodeHeader(buffer);
+    auto reply = lifx::LifxClient::Encode(
+      lifx::MakeHeader<lifx::message::device::StatePower>(request.target,
+        request.source, request.sequence),
+      lifx::message::device::StatePower { 65535 });
+    sendto(device, reply.data(), reply.size(), 0,
+      reinterpret_cast<sockaddr*>(&from), fromLength);
+    ++answered;
+  }
+  controller.Stop();
+  close(device);
+
+  ASSERT_EQ(static_cast<int>(SHARDS), answered);
+  for (auto& count : replies)
+  {
+    ASSERT_EQ(1, count);
+  }
+}
+#endif
+
+TEST(TestHeaderCache, MatchesFullEncode)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  lifx::HeaderCache cache;
+
+  for (auto&& sequence : { 1, 77, 255 })
+  {
+    auto header = lifx::MakeHeader<lifx::message::light::SetColor>(target,
+      0xDEADBEEF, static_cast<uint8_t>(sequence), 0x0102030405060708ull);
+    header.ack_required = 1;
+    auto expected = lifx::LifxClient::ToNetwork(header);
+
+    std::array<char, lifx::LIFX_HEADER_SIZE> buffer {};
+    cache.Encode<lifx::message::light::SetColor>(buffer.data(), target,
+      0xDEADBEEF, static_cast<uint8_t>(sequence), 0x0102030405060708ull, true);
+    ASSERT_EQ(0, memcmp(&expected, buffer.data(), lifx::LIFX_HEADER_SIZE));
+  }
+  ASSERT_EQ(1u, cache.Size());
+
+  std::array<char, lifx::LIFX_HEADER_SIZE> buffer {};
+  cache.Encode<lifx::message::light::Get>(buffer.data(), target, 0, 1);
+  cache.Encode<lifx::message::light::Get>(buffer.data(), nullptr, 0, 1);
+  ASSERT_EQ(3u, cache.Size());
+
+  auto expected = lifx::LifxClient::ToNetwork(
+    lifx::MakeHeader<lifx::message::light::Get>(nullptr, 0, 1));
+  ASSERT_EQ(0, memcmp(&expected, buffer.data(), lifx::LIFX_HEADER_SIZE));
+}
+
+TEST(TestWire, GoldenSetColorBroadcast)
+{
+  // The "set all lights to green" example from the LIFX protocol docs
+  const std::vector<uint8_t> golden = {
+    0x31, 0x00, 0x00, 0x34, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x66, 0x00, 0x00, 0x00,
+    0x00, 0x55, 0x55, 0xFF, 0xFF, 0xFF, 0xFF, 0xAC, 0x0D, 0x00, 0x04, 0x00, 0x00 };
+
+  lifx::message::light::SetColor msg = { };
+  msg.color = { 0x5555, 0xFFFF, 0xFFFF, 3500 };
+  msg.duration = 1024;
+  auto header = lifx::MakeHeader<lifx::message::light::SetColor>(nullptr, 0, 0);
+  header.res_required = 0;
+  auto packet = lifx::LifxClient::Encode(header, msg);
+  ASSERT_EQ(golden.size(), packet.size());
+  ASSERT_EQ(0, memcmp(golden.data(), packet.data(), golden.size()));
+
+  auto decoded = lifx::wire::DecodeHeader(packet.data());
+  ASSERT_EQ(49u, decoded.size);
+  ASSERT_EQ(1u, decoded.tagged);
+  ASSERT_EQ(lifx::message::light::SetColor::type, decoded.type);
+  lifx::message::light::SetColor decodedMsg = { };
+  lifx::wire::Decode(packet.data() + lifx::LIFX_HEADER_SIZE, decodedMsg);
+  ASSERT_EQ(0x5555, decodedMsg.color.hue);
+  ASSERT_EQ(3500, decodedMsg.color.kelvin);
+  ASSERT_EQ(1024u, decodedMsg.duration);
+}
+
+TEST(TestWire, GoldenHeaderFields)
+{
+  const std::vector<uint8_t> golden = {
+    0x24, 0x00, 0x00, 0x54, 0x78, 0x56, 0x34, 0x12,
+    0xD0, 0x73, 0xD5, 0x01, 0x02, 0x03, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0xAB,
+    0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+    0x3A, 0x00, 0x00, 0x00 };
+
+  lifx::Header header = { };
+  header.size = 36;
+  header.protocol = lifx::LIFX_PROTOCOL;
+  header.addressable = 1;
+  header.origin = 1;
+  header.source = 0x12345678;
+  const uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  memcpy(header.target, target, sizeof(target));
+  header.res_required = 1;
+  header.ack_required = 1;
+  header.sequence = 0xAB;
+  header.at_time = 0x0102030405060708ull;
+  header.type = lifx::message::device::EchoRequest::type;
+
+  std::array<char, lifx::LIFX_HEADER_SIZE> buffer {};
+  lifx::wire::EncodeHeader(header, buffer.data());
+  ASSERT_EQ(0, memcmp(golden.data(), buffer.data(), golden.size()));
+  ASSERT_EQ(lifx::HEADER_ACK_REQUIRED_BIT,
+    buffer[lifx::HEADER_FLAGS_OFFSET] & lifx::HEADER_ACK_REQUIRED_BIT);
+
+  auto decoded = lifx::wire::DecodeHeader(buffer.data());
+  ASSERT_EQ(0, memcmp(&header, &decoded, sizeof(header)));
+}
+
+TEST(TestWire, GoldenWaveform)
+{
+  const std::vector<uint8_t> golden = {
+    0x00, 0x01, 0x00, 0x80, 0xFF, 0xFF, 0x00, 0x40, 0xAC, 0x0D,
+    0xE8, 0x03, 0x00, 0x00, 0x00, 0x00, 0x20, 0x40, 0x00, 0x00, 0x01 };
+
+  lifx::message::light::SetWaveform msg = { };
+  msg.transient = 1;
+  msg.color = { 0x8000, 0xFFFF, 0x4000, 3500 };
+  msg.period = 1000;
+  msg.cycles = 2.5f;
+  msg.skew_ratio = 0;
+  msg.waveform = static_cast<uint8_t>(lifx::Waveform::SINE);
+
+  std::array<char, lifx::wire::Size<lifx::message::light::SetWaveform>()> buffer {};
+  lifx::wire::Encode(msg, buffer.data());
+  ASSERT_EQ(golden.size(), buffer.size());
+  ASSERT_EQ(0, memcmp(golden.data(), buffer.data(), golden.size()));
+
+  lifx::message::light::SetWaveform decoded = { };
+  lifx::wire::Decode(buffer.data(), decoded);
+  ASSERT_EQ(2.5f, decoded.cycles);
+  ASSERT_EQ(1000u, decoded.period);
+}
+
+uint16_t ReadLevel(const lifx::message::device::StatePower& msg)
+{
+  return msg.level;
+}
+
+uint16_t ReadLevel(const lifx::message::device::StateService&)
+{
+  return 0;
+}
+
+template<typename T> void ExpectRoundTrip()
+{
+  // Fill every byte, decode and encode again: reserved bytes come back as
+  // zero and everything else must survive unchanged
+  constexpr auto size = lifx::wire::Size<T>();
+  std::vector<char> pattern(size + 1);
+  for (size_t i = 0; i < pattern.size(); ++i)
+  {
+    pattern[i] = static_cast<char>(i * 7 + 1);
+  }
+
+  T msg = { };
+  lifx::wire::Decode(pattern.data(), msg);
+  std::vector<char> encoded(size + 1, 0x55);
+  lifx::wire::Encode(msg, encoded.data());
+  EXPECT_EQ(0x55, encoded[size]) << T::type;
+
+  T again = { };
+  lifx::wire::Decode(encoded.data(), again);
+  std::vector<char> reencoded(size + 1, 0x55);
+  lifx::wire::Encode(again, reencoded.data());
+  EXPECT_EQ(encoded, reencoded) << T::type;
+
+  for (size_t i = 0; i < size; ++i)
+  {
+    if (encoded[i] != pattern[i])
+    {
+      EXPECT_EQ(0, encoded[i]) << T::type << " byte " << i;
+    }
+  }
+
+  // Packed structs share the wire layout on little endian hosts
+  uint16_t probe = 1;
+  if (size > 0 && *reinterpret_cast<uint8_t*>(&probe) == 1)
+  {
+    EXPECT_EQ(0, memcmp(&msg, encoded.data(), size)) << T::type;
+  }
+}
+
+template<typename... T> void ExpectRoundTrips(lifx::MessageList<T...>)
+{
+  int expand[] = { 0, (ExpectRoundTrip<T>(), 0)... };
+  (void)expand;
+}
+
+TEST(TestWire, RoundTripAllMessages)
+{
+  ExpectRoundTrips(lifx::DefaultMessages());
+}
+
+TEST(TestCodec, EncodeIntoMatchesClientEncode)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  lifx::message::light::SetColor msg = { };
+  msg.color = { 100, 200, 300, 4000 };
+  msg.duration = 500;
+
+  lifx::HeaderOptions options;
+  options.target = target;
+  options.source = 0xCAFE;
+  options.sequence = 9;
+  options.atTime = 123456789;
+  options.ackRequired = true;
+
+  std::array<char, lifx::MAX_LIFX_PACKET_SIZE> buffer {};
+  auto length = lifx::EncodeInto(buffer.data(), buffer.size(), msg, options);
+
+  auto header = lifx::MakeHeader<lifx::message::light::SetColor>(target,
+    0xCAFE, 9, 123456789);
+  header.ack_required = 1;
+  auto expected = lifx::LifxClient::Encode(header, msg);
+  ASSERT_EQ(expected.size(), length);
+  ASSERT_EQ(0, memcmp(expected.data(), buffer.data(), length));
+
+  // Too small a buffer is left alone
+  std::array<char, 40> small {};
+  ASSERT_EQ(0u, lifx::EncodeInto(small.data(), small.size(), msg, options));
+  ASSERT_TRUE(std::all_of(small.begin(), small.end(),
+    [](char c) { return c == 0; }));
+
+  // Responses can be turned off
+  options.resRequired = false;
+  lifx::EncodeInto(buffer.data(), buffer.size(),
+    lifx::message::device::GetInfo(), options);
+  ASSERT_EQ(0, buffer[lifx::HEADER_FLAGS_OFFSET] & 0x1);
+}
+
+TEST(TestCodec, DecodeDispatchesByType)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  std::array<char, lifx::MAX_LIFX_PACKET_SIZE> buffer {};
+  lifx::HeaderOptions options;
+  options.target = target;
+  options.sequence = 3;
+  auto length = lifx::EncodeInto(buffer.data(), buffer.size(),
+    lifx::message::device::StatePower { 65535 }, options);
+
+  uint16_t level = 0;
+  uint16_t type = 0;
+  auto handler = [&](const lifx::Header& header, const auto& msg)
+  {
+    type = header.type;
+    level = ReadLevel(msg);
+  };
+  auto result = lifx::Decode<
+    lifx::message::device::StateService,
+    lifx::message::device::StatePower>(buffer.data(), length, handler);
+  ASSERT_EQ(lifx::DecodeResult::DECODED, result);
+  ASSERT_EQ(lifx::message::device::StatePower::type, type);
+  ASSERT_EQ(65535u, level);
+
+  ASSERT_EQ(lifx::DecodeResult::UNKNOWN_TYPE,
+    lifx::Decode<lifx::message::device::StateService>(
+      buffer.data(), length, handler));
+  ASSERT_EQ(lifx::DecodeResult::MALFORMED,
+    lifx::Decode<lifx::message::device::StatePower>(
+      buffer.data(), length - 1, handler));
+
+  // The header can promise the whole packet while the payload is too short
+  buffer[0] = static_cast<char>(length - 1);
+  ASSERT_EQ(lifx::DecodeResult::MALFORMED,
+    lifx::Decode<lifx::message::device::StatePower>(
+      buffer.data(), length, handler));
+}
+
+template<typename... T> void ExpectDispatches(lifx::MessageList<T...>)
+{
+  int expand[] = { 0, (
+    [] {
+      std::array<char, lifx::MAX_LIFX_PACKET_SIZE> buffer {};
+      auto length = lifx::EncodeInto(buffer.data(), buffer.size(), T());
+      uint16_t type = 0;
+      auto result = lifx::Dispatcher<lifx::DefaultMessages>::Decode(
+        buffer.data(), length,
+        [&type](const lifx::Header& header, const auto&) { type = header.type; });
+      EXPECT_EQ(lifx::DecodeResult::DECODED, result) << T::type;
+      EXPECT_EQ(T::type, type);
+    }(), 0)... };
+  (void)expand;
+}
+
+TEST(TestRegistry, DispatchesEveryDefaultType)
+{
+  ExpectDispatches(lifx::DefaultMessages());
+
+  std::array<char, lifx::LIFX_HEADER_SIZE> buffer {};
+  lifx::Header header = lifx::MakeHeader<lifx::message::device::GetService>(
+    nullptr, 0, 0);
+  header.type = 9999;
+  lifx::wire::EncodeHeader(header, buffer.data());
+  ASSERT_EQ(lifx::DecodeResult::UNKNOWN_TYPE,
+    lifx::Dispatcher<lifx::DefaultMessages>::Decode(buffer.data(),
+      buffer.size(), [](const lifx::Header&, const auto&) { }));
+}
+
+TEST(TestDelegate, HoldsCallablesInline)
+{
+  lifx::Delegate<int(int)> empty;
+  ASSERT_FALSE(empty);
+
+  // Captured state is copied, moved & destroyed with the delegate
+  auto state = std::make_shared<int>(10);
+  {
+    lifx::Delegate<int(int)> add([state](int value) { return *state + value; });
+    ASSERT_TRUE(add);
+    ASSERT_EQ(15, add(5));
+    ASSERT_EQ(2, state.use_count());
+
+    auto copy = add;
+    ASSERT_EQ(3, state.use_count());
+    auto moved = std::move(add);
+    ASSERT_FALSE(add);
+    ASSERT_EQ(3, state.use_count());
+    ASSERT_EQ(16, moved(6));
+
+    copy = nullptr;
+    ASSERT_EQ(2, state.use_count());
+  }
+  ASSERT_EQ(1, state.use_count());
+
+  // Mutable callables keep their changes between calls
+  int calls = 0;
+  lifx::Delegate<int()> counter([count = 0]() mutable { return ++count; });
+  calls += counter();
+  calls += counter();
+  ASSERT_EQ(3, calls);
+}
+
+} // local namespace
+
+// A message that the library doesn't define, the way a user would add it
+namespace hev
+{
+  #pragma pack(push, 1)
+  struct StateHevCycle
+  {
+    static constexpr uint16_t type = 144;
+    static constexpr bool has_response = false;
+    uint32_t duration_s;
+    uint32_t remaining_s;
+    uint8_t last_power;
+  };
+  #pragma pack(pop)
+  constexpr uint16_t StateHevCycle::type;
+
+  template<typename IO> constexpr void Visit(IO& io, StateHevCycle& m)
+  {
+    lifx::wire::Visit(io, m.duration_s);
+    lifx::wire::Visit(io, m.remaining_s);
+    lifx::wire::Visit(io, m.last_power);
+  }
+}
+
+namespace
+{
+
+TEST_F(TestClient, UserDefinedMessages)
+{
+  constexpr uint8_t target[8] = { 0xD0, 0x73, 0xD5, 1, 2, 3, 0, 0 };
+  uint32_t remaining = 0;
+  m_client->RegisterCallback<hev::StateHevCycle>(
+    [&remaining](const lifx::Header&, const hev::StateHevCycle& msg)
+    {
+      remaining = msg.remaining_s;
+    });
+
+  static_assert(lifx::wire::Size<hev::StateHevCycle>() == 9, "HEV size");
+  auto packet = m_client->MakePacket(target, 1, hev::StateHevCycle { 7200, 3600, 1 });
+
+  // Unknown to the default registry
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_EQ(0u, remaining);
+
+  // A new sequence, the same one would be dropped as a duplicate
+  m_client->UseMessages<lifx::DefaultMessages::Append<hev::StateHevCycle>>();
+  packet = m_client->MakePacket(target, 2, hev::StateHevCycle { 7200, 3600, 1 });
+  ASSERT_TRUE(m_client->ProcessDatagram(packet.data(), packet.size()));
+  ASSERT_EQ(3600u, remaining);
+}
+
 } // local namespace
 
 int main(int argc, char** argv)